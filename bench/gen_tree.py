@@ -0,0 +1,284 @@
+#!/usr/bin/env python3
+"""
+Generates a synthetic ppremake source tree for benchmarking.
+
+The tree is laid out the way a Panda-style tree is: a top-level
+directory holding Package.pp, Global.pp, Depends.pp and Template.pp,
+a number of package directories, and a number of library directories
+within each package.  Each library directory has a Sources.pp that
+defines one lib_target (named after the directory) and optionally some
+bin_targets, each with its own C++ files.  Libraries depend on a few
+libraries that come before them, and the C++ files #include headers
+from their own library and from the libraries it depends on, so that
+both the inter-directory and the inter-file dependency machinery have
+real work to do.
+
+The output is deterministic for a given set of options and --seed.
+
+Usage:
+  gen_tree.py [options] outdir
+"""
+
+import argparse
+import os
+import random
+import sys
+
+PACKAGE_PP = """\
+// Package.pp for a generated benchmark tree.
+
+#define TEMPLATE_FILE $[TOPDIR]/Template.pp
+#define GLOBAL_FILE $[TOPDIR]/Global.pp
+#define DEPENDS_FILE $[TOPDIR]/Depends.pp
+#define DEPENDENCY_CACHE_FILENAME pp.dep
+#define SEARCH_CACHE_FILENAME pp.search
+#define SHELL_CACHE_FILENAME pp.shcache
+
+#define ODIR Opt3-$[PLATFORM]
+#define OPTIMIZE 3
+#define CXX g++
+#define CXXFLAGS -O$[OPTIMIZE] -fPIC
+"""
+
+GLOBAL_PP = """\
+// Global.pp for a generated benchmark tree.
+
+// Every library target in the tree, keyed by its name.
+#map all_libs TARGET(*/lib_target)
+
+// The complete set of libraries the current target links with,
+// directly or indirectly.
+#defun get_link_libs
+  $[sort $[closure all_libs,$[LOCAL_LIBS]]]
+#end get_link_libs
+
+// The directories to search for header files.
+#defun get_include_dirs
+  $[sort . $[all_libs $[RELDIR],$[get_link_libs]]]
+#end get_include_dirs
+
+#defun get_objs
+  $[patsubst %.cxx,$[ODIR]/$[TARGET]_%.o,$[filter %.cxx,$[SOURCES]]]
+#end get_objs
+
+#defer compile_flags $[CXXFLAGS] $[patsubst %,-I%,$[get_include_dirs]]
+#defer install_headers $[filter %.h %.I,$[SOURCES]]
+"""
+
+DEPENDS_PP = """\
+// Depends.pp for a generated benchmark tree.
+
+#if $[eq $[DIR_TYPE],src]
+  #define DEPENDABLE_HEADERS \\
+    $[sort $[filter %.h %.I,$[SOURCES(lib_target bin_target)]]]
+  #define DEPEND_DIRS \\
+    $[sort $[all_libs $[DIRNAME],$[LOCAL_LIBS(lib_target bin_target)]]]
+#endif
+"""
+
+TEMPLATE_PP = """\
+// Template.pp for a generated benchmark tree: writes a Makefile in
+// each directory.
+
+#output Makefile
+#### Generated automatically by $[PPREMAKE] $[PPREMAKE_VERSION] from $[SOURCEFILE].
+#### Do not edit.
+
+#if $[eq $[DIR_TYPE],src]
+all : $[forscopes lib_target,lib$[TARGET].so] $[forscopes bin_target,$[TARGET]]
+
+install_headers : $[sort $[forscopes lib_target bin_target,$[install_headers]]]
+
+#forscopes lib_target
+lib$[TARGET].so : $[get_objs]
+\t$[CXX] -shared -o $@ $^ $[patsubst %,-l%,$[get_link_libs]]
+
+#foreach file $[filter %.cxx,$[SOURCES]]
+$[ODIR]/$[TARGET]_$[file:%.cxx=%.o] : $[file] $[dependencies $[file]]
+\t$[CXX] -c -o $@ $[compile_flags] $<
+#end file
+#end lib_target
+
+#forscopes bin_target
+$[TARGET] : $[get_objs]
+\t$[CXX] -o $@ $^ $[patsubst %,-l%,$[get_link_libs]]
+
+#foreach file $[filter %.cxx,$[SOURCES]]
+$[ODIR]/$[TARGET]_$[file:%.cxx=%.o] : $[file] $[dependencies $[file]]
+\t$[CXX] -c -o $@ $[compile_flags] $<
+#end file
+#end bin_target
+
+#else
+all : $[SUBDIRS]
+
+#foreach dir $[SUBDIRS]
+$[dir] :
+\tcd ./$[dir] && $(MAKE) all
+#end dir
+
+#if $[eq $[DIR_TYPE],toplevel]
+libs : $[sort $[forscopes */lib_target,lib$[TARGET].so]]
+#endif
+#endif
+#end Makefile
+"""
+
+
+def write_file(path, contents):
+    with open(path, "w") as f:
+        f.write(contents)
+
+
+def header_guard(name):
+    return name.upper().replace(".", "_")
+
+
+class Library:
+    def __init__(self, name, package):
+        self.name = name
+        self.package = package
+        self.deps = []
+        self.headers = []
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generate a synthetic ppremake source tree.")
+    parser.add_argument("outdir",
+                        help="directory to create; must not already exist")
+    parser.add_argument("--packages", type=int, default=6,
+                        help="number of package directories (default 6)")
+    parser.add_argument("--libs", type=int, default=12,
+                        help="library directories per package (default 12)")
+    parser.add_argument("--targets", type=int, default=2,
+                        help="targets per library directory, the first "
+                        "being the library itself (default 2)")
+    parser.add_argument("--files", type=int, default=8,
+                        help="C++ files per target, each with a header "
+                        "(default 8)")
+    parser.add_argument("--deps", type=int, default=4,
+                        help="most libraries each library depends on "
+                        "directly (default 4)")
+    parser.add_argument("--includes", type=int, default=6,
+                        help="most #include lines in each file "
+                        "(default 6)")
+    parser.add_argument("--seed", type=int, default=1,
+                        help="random seed (default 1)")
+    args = parser.parse_args()
+
+    if os.path.exists(args.outdir):
+        sys.exit("%s already exists" % args.outdir)
+
+    rng = random.Random(args.seed)
+    os.makedirs(args.outdir)
+
+    write_file(os.path.join(args.outdir, "Package.pp"), PACKAGE_PP)
+    write_file(os.path.join(args.outdir, "Global.pp"), GLOBAL_PP)
+    write_file(os.path.join(args.outdir, "Depends.pp"), DEPENDS_PP)
+    write_file(os.path.join(args.outdir, "Template.pp"), TEMPLATE_PP)
+    write_file(os.path.join(args.outdir, "Sources.pp"),
+               "#define DIR_TYPE toplevel\n")
+
+    # Lay out the libraries first, so that each one can depend on the
+    # ones before it, in its own package or an earlier one.
+    libs = []
+    for p in range(args.packages):
+        package = "pkg%d" % p
+        for l in range(args.libs):
+            lib = Library("%s_lib%d" % (package, l), package)
+            if libs:
+                # Favor the nearby libraries, as real trees do.
+                candidates = libs[-3 * args.deps:]
+                count = rng.randint(0, min(args.deps, len(candidates)))
+                lib.deps = sorted(rng.sample(candidates, count),
+                                  key=lambda x: x.name)
+            libs.append(lib)
+
+    num_files = 0
+    for p in range(args.packages):
+        package = "pkg%d" % p
+        pkgdir = os.path.join(args.outdir, package)
+        os.makedirs(pkgdir)
+        write_file(os.path.join(pkgdir, "Sources.pp"),
+                   "#define DIR_TYPE group\n")
+
+    for lib in libs:
+        libdir = os.path.join(args.outdir, lib.package, lib.name)
+        os.makedirs(libdir)
+
+        # Headers visible to this library: its own, as they are
+        # written, and those of everything it depends on.
+        dep_headers = []
+        for dep in lib.deps:
+            dep_headers.extend(dep.headers)
+
+        sources = []
+        for t in range(args.targets):
+            if t == 0:
+                kind, target = "lib_target", lib.name
+            else:
+                kind, target = "bin_target", "%s_tool%d" % (lib.name, t)
+
+            files = []
+            for f in range(args.files):
+                base = "%s_%d" % (target, f)
+                header = base + ".h"
+                source = base + ".cxx"
+
+                # A header includes a few earlier headers; a source file
+                # includes its own header and a few more.
+                includes = rng.sample(lib.headers + dep_headers,
+                                      min(len(lib.headers + dep_headers),
+                                          rng.randint(0, args.includes // 2)))
+                lines = ["#ifndef %s" % header_guard(header),
+                         "#define %s" % header_guard(header), ""]
+                lines += ['#include "%s"' % h for h in includes]
+                lines += ["#include <string>", "",
+                          "class %s {" % base,
+                          "public:",
+                          "  std::string get_name() const;",
+                          "};", "", "#endif"]
+                write_file(os.path.join(libdir, header),
+                           "\n".join(lines) + "\n")
+
+                includes = rng.sample(lib.headers + dep_headers,
+                                      min(len(lib.headers + dep_headers),
+                                          rng.randint(0, args.includes)))
+                lines = ['#include "%s"' % header]
+                lines += ['#include "%s"' % h for h in includes]
+                lines += ["#include <vector>", "",
+                          "std::string %s::" % base,
+                          "get_name() const {",
+                          '  return "%s";' % base,
+                          "}"]
+                write_file(os.path.join(libdir, source),
+                           "\n".join(lines) + "\n")
+
+                lib.headers.append(header)
+                files += [source, header]
+                num_files += 2
+
+            local_libs = [dep.name for dep in lib.deps]
+            if t != 0:
+                local_libs.insert(0, lib.name)
+            sources.append((kind, target, local_libs, files))
+
+        lines = ["#define DIR_TYPE src", ""]
+        for kind, target, local_libs, files in sources:
+            lines += ["#begin %s" % kind,
+                      "  #define TARGET %s" % target,
+                      "  #define LOCAL_LIBS %s" % " ".join(local_libs),
+                      "  #define SOURCES \\"]
+            for i in range(0, len(files), 4):
+                more = " \\" if i + 4 < len(files) else ""
+                lines.append("    " + " ".join(files[i:i + 4]) + more)
+            lines += ["#end %s" % kind, ""]
+        write_file(os.path.join(libdir, "Sources.pp"), "\n".join(lines))
+
+    print("Generated %d packages, %d library directories and %d C++ files "
+          "in %s." % (args.packages, len(libs), num_files, args.outdir))
+
+
+if __name__ == "__main__":
+    main()
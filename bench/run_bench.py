@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+"""
+Times ppremake end to end on a generated source tree.
+
+Generates a tree with gen_tree.py (or uses an existing one), then for
+each ppremake binary named, repeatedly:
+
+  - copies the pristine tree to a scratch directory and runs ppremake
+    over the whole tree ("cold": no dependency caches or output files
+    yet);
+  - runs it again in the same directory ("warm": the caches and the
+    unchanged output files from the cold run are in place);
+  - optionally regenerates a single directory, with and without
+    --lazy.
+
+Each run is made with --trace, and the trace is summed up by phase, so
+the report shows where the time went as well as the total.  The median
+of the runs is reported.
+
+Usage:
+  run_bench.py [options] [--ppremake path ...]
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# The trace categories, other than "phase", whose spans are summed up
+# into a line of their own.  Spans nest, so these overlap the phases.
+CATEGORIES = [
+    ("dir", "templates (all dirs)"),
+    ("scan", "  #include scans"),
+    ("include", "  #include files"),
+    ("shell", "  shell commands"),
+    ("output", "  output files"),
+]
+
+
+def get_options(binary):
+    """Returns the set of long options, among the ones this script
+    uses, that the indicated ppremake understands.  Older builds may
+    not have all of them."""
+    result = subprocess.run([binary, "-h"], stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    return set(option for option in ("--trace", "--lazy")
+               if option in result.stdout)
+
+
+def run_ppremake(binary, cwd, args, trace):
+    """Runs ppremake once, and returns a dictionary of times in
+    seconds: "total" for the wall-clock time of the whole run, and one
+    entry per phase from the trace, if trace is not None."""
+    cmd = [binary] + args
+    if trace:
+        cmd.insert(1, "--trace=" + trace)
+    start = time.perf_counter()
+    result = subprocess.run(cmd, cwd=cwd, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        sys.stderr.write(result.stdout)
+        sys.exit("%s failed in %s" % (" ".join(cmd), cwd))
+
+    times = {"total": elapsed}
+    if not trace:
+        return times
+    with open(trace) as f:
+        events = json.load(f)["traceEvents"]
+    for event in events:
+        if event.get("ph") != "X":
+            continue
+        cat = event["cat"]
+        if cat == "phase":
+            # "load <dir>" spans from --lazy are summed together.
+            key = event["name"].split(" ")[0]
+        else:
+            key = cat
+        times[key] = times.get(key, 0.0) + event["dur"] / 1e6
+    os.unlink(trace)
+    return times
+
+
+def bench_binary(binary, pristine, scratch, args):
+    """Runs all of the scenarios for one binary, and returns a
+    dictionary mapping scenario name to a list of per-run times."""
+    results = {}
+
+    def record(scenario, times):
+        results.setdefault(scenario, []).append(times)
+
+    options = get_options(binary)
+    trace = None
+    if "--trace" in options:
+        trace = os.path.join(scratch, "trace.json")
+    else:
+        print("%s has no --trace; reporting totals only." % binary)
+
+    for i in range(args.runs):
+        work = os.path.join(scratch, "tree")
+        if os.path.exists(work):
+            shutil.rmtree(work)
+        shutil.copytree(pristine, work)
+
+        record("cold", run_ppremake(binary, work, [], trace))
+        record("warm", run_ppremake(binary, work, [], trace))
+
+        if args.single:
+            subdir = os.path.join(work, args.single)
+            record("single", run_ppremake(binary, subdir, ["."], trace))
+            if "--lazy" in options:
+                record("single --lazy",
+                       run_ppremake(binary, subdir, ["--lazy", "."], trace))
+    return results
+
+
+def median_times(runs):
+    """Returns the median time of each key across the runs, as a list
+    of (key, time) pairs in the order the keys were first seen."""
+    keys = []
+    for times in runs:
+        keys += [key for key in times if key not in keys]
+    return [(key, statistics.median([t.get(key, 0.0) for t in runs]))
+            for key in keys]
+
+
+def report(binaries, all_results):
+    print()
+    for i, binary in enumerate(binaries):
+        print("[%d] %s" % (i + 1, binary))
+
+    scenarios = []
+    for results in all_results:
+        for scenario in results:
+            if scenario not in scenarios:
+                scenarios.append(scenario)
+
+    for scenario in scenarios:
+        medians = [median_times(results.get(scenario, []))
+                   for results in all_results]
+        phases = []
+        for m in medians:
+            for key, t in m:
+                if key not in phases and key != "total" and \
+                   key not in dict(CATEGORIES):
+                    phases.append(key)
+        medians = [dict(m) for m in medians]
+
+        rows = [("total (wall clock)", "total")]
+        rows += [(key, key) for key in phases]
+        rows += [(label, cat) for cat, label in CATEGORIES]
+
+        print()
+        print("%s run, median ms:" % scenario)
+        header = "%-28s" % ""
+        for i in range(len(binaries)):
+            header += "%14s" % ("[%d]" % (i + 1))
+        print(header)
+        for label, key in rows:
+            if not any(key in m for m in medians):
+                continue
+            line = "%-28s" % label
+            for m in medians:
+                if not m:
+                    # This binary didn't run this scenario at all.
+                    line += "%14s" % "-"
+                else:
+                    line += "%14.1f" % (m.get(key, 0.0) * 1000.0)
+            print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time ppremake on a generated source tree.  Options "
+        "not listed here are passed on to gen_tree.py.")
+    parser.add_argument("--ppremake", action="append", default=[],
+                        help="ppremake binary to time; may be repeated "
+                        "to compare several (default: ppremake on PATH)")
+    parser.add_argument("--tree",
+                        help="use this existing source tree instead of "
+                        "generating one")
+    parser.add_argument("--runs", type=int, default=3,
+                        help="number of times to repeat each scenario "
+                        "(default 3)")
+    parser.add_argument("--single", default="pkg0/pkg0_lib0",
+                        help="directory, relative to the root, to "
+                        "regenerate by itself; empty to skip "
+                        "(default pkg0/pkg0_lib0)")
+    parser.add_argument("--keep", action="store_true",
+                        help="keep the scratch directory")
+    args, gen_args = parser.parse_known_args()
+
+    binaries = args.ppremake or [shutil.which("ppremake") or "ppremake"]
+    binaries = [os.path.abspath(b) if os.path.sep in b else b
+                for b in binaries]
+
+    scratch = tempfile.mkdtemp(prefix="ppremake-bench-")
+    try:
+        if args.tree:
+            pristine = os.path.abspath(args.tree)
+        else:
+            pristine = os.path.join(scratch, "pristine")
+            subprocess.check_call([sys.executable,
+                                   os.path.join(BENCH_DIR, "gen_tree.py"),
+                                   pristine] + gen_args)
+
+        if args.single and \
+           not os.path.isdir(os.path.join(pristine, args.single)):
+            sys.exit("No directory %s in %s" % (args.single, pristine))
+
+        all_results = []
+        for binary in binaries:
+            print("Timing %s ..." % binary)
+            all_results.append(bench_binary(binary, pristine, scratch, args))
+        report(binaries, all_results)
+    finally:
+        if args.keep:
+            print("\nScratch directory kept in %s" % scratch)
+        else:
+            shutil.rmtree(scratch)
+
+
+if __name__ == "__main__":
+    main()
@@ -40,6 +40,9 @@
 /* Define if you have the `getopt' function.  */
 /* #undef HAVE_GETOPT */
 
+/* Define if you have the `getopt_long' function.  */
+/* #undef HAVE_GETOPT_LONG */
+
 /* Define if you have the <alloca.h> header file.  */
 /* #undef HAVE_ALLOCA_H */
 
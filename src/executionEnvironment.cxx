@@ -20,6 +20,7 @@
 
 #include <errno.h>
 #include <stdio.h>  // for perror
+#include <vector>
 
 #ifdef WIN32_VC
 // Windows requires this for getcwd().
@@ -109,25 +110,16 @@ expand_string(const string &str) {
 ////////////////////////////////////////////////////////////////////
 Filename ExecutionEnvironment::
 get_cwd() {
-  // getcwd() requires us to allocate a dynamic buffer and grow it on
-  // demand.
-  static size_t bufsize = 1024;
-  static char *buffer = NULL;
-
-  if (buffer == (char *)NULL) {
-    buffer = new char[bufsize];
-  }
-
-  while (getcwd(buffer, bufsize) == (char *)NULL) {
+  // getcwd() requires us to allocate a buffer and grow it on demand.
+  // This may be called from any thread, so the buffer is our own.
+  vector<char> buffer(1024);
+  while (getcwd(&buffer[0], buffer.size()) == (char *)NULL) {
     if (errno != ERANGE) {
       perror("getcwd");
       return string();
     }
-    delete[] buffer;
-    bufsize = bufsize * 2;
-    buffer = new char[bufsize];
-    assert(buffer != (char *)NULL);
+    buffer.resize(buffer.size() * 2);
   }
 
-  return Filename::from_os_specific(buffer);
+  return Filename::from_os_specific(&buffer[0]);
 }
@@ -2240,6 +2240,74 @@ atomic_read_contents(string &contents) const {
 #endif  // WIN32_VC
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: Filename::atomic_write_contents
+//       Access: Public
+//  Description: Replaces the contents of the file with the indicated
+//               contents, in such a way that another process will
+//               see either the old file or the new one, but never a
+//               half-written file.  The contents are first written to
+//               a temporary file in the same directory, which is then
+//               given the original's permissions and renamed over it.
+//
+//               Returns true on success.  On failure, an error
+//               message is written to cerr, and the original file is
+//               left alone (except on Windows, where it may already
+//               have been removed).
+////////////////////////////////////////////////////////////////////
+bool Filename::
+atomic_write_contents(const string &contents) const {
+  assert(!get_pattern());
+
+  char suffix[32];
+#ifdef WIN32_VC
+  sprintf(suffix, ".tmp%d", (int)GetCurrentProcessId());
+#else
+  sprintf(suffix, ".tmp%d", (int)getpid());
+#endif
+  Filename temp_filename = get_fullpath() + string(suffix);
+  temp_filename._flags = _flags;
+
+  {
+    ofstream out;
+    if (!temp_filename.open_write(out)) {
+      cerr << "Unable to open " << temp_filename << " for writing.\n";
+      return false;
+    }
+    out.write(contents.data(), contents.length());
+    out.close();
+    if (out.fail()) {
+      cerr << "Unable to write to " << temp_filename << "\n";
+      temp_filename.unlink();
+      return false;
+    }
+  }
+
+#ifndef WIN32_VC
+  // Otherwise the file would get the default permissions, and e.g.
+  // an executable script would lose its execute bits.
+  struct stat this_buf;
+  if (stat(to_os_specific().c_str(), &this_buf) == 0) {
+    chmod(temp_filename.to_os_specific().c_str(), this_buf.st_mode & 07777);
+  }
+#endif  // WIN32_VC
+
+  if (!temp_filename.rename_to(*this)) {
+#ifdef WIN32_VC
+    // Windows won't rename over an existing file.
+    unlink();
+    if (temp_filename.rename_to(*this)) {
+      return true;
+    }
+#endif  // WIN32_VC
+    cerr << "Unable to replace " << *this << "\n";
+    temp_filename.unlink();
+    return false;
+  }
+
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: Filename::locate_basename
 //       Access: Protected
@@ -192,6 +192,7 @@ PUBLISHED:
 public:
   bool atomic_compare_and_exchange_contents(string &orig_contents, const string &old_contents, const string &new_contents) const;
   bool atomic_read_contents(string &contents) const;
+  bool atomic_write_contents(const string &contents) const;
 
 protected:
   void locate_basename();
@@ -19,7 +19,7 @@
 
 #include "ppremake.h"
 
-#if !defined(HAVE_GETOPT)
+#if !defined(HAVE_GETOPT) || !defined(HAVE_GETOPT_LONG)
 
 #ifdef WIN32_VC
 /* This file seems particularly egregious with this particular warning,
@@ -678,6 +678,17 @@ getopt (argc, argv, optstring)
 			   0);
 }
 
+int
+getopt_long (argc, argv, options, long_options, opt_index)
+     int argc;
+     char *const *argv;
+     const char *options;
+     const struct option *long_options;
+     int *opt_index;
+{
+  return _getopt_internal (argc, argv, options, long_options, opt_index, 0);
+}
+
 #endif	/* _LIBC or not __GNU_LIBRARY__.  */
 
 #ifdef TEST
@@ -752,4 +763,4 @@ main (argc, argv)
 
 #endif /* TEST */
 
-#endif /* HAVE_GETOPT */
+#endif /* HAVE_GETOPT && HAVE_GETOPT_LONG */
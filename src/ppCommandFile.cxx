@@ -5,9 +5,16 @@
 
 #include "ppCommandFile.h"
 #include "ppScope.h"
+#include "ppContext.h"
 #include "ppNamedScopes.h"
 #include "ppSubroutine.h"
+#include "ppOutputQueue.h"
+#include "ppProfiler.h"
+#include "ppStats.h"
+#include "ppTrace.h"
+#include "executionEnvironment.h"
 #include "tokenize.h"
+#include "md5.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -73,7 +80,9 @@ pop(PPCommandFile *file) {
 //  Description:
 ////////////////////////////////////////////////////////////////////
 PPCommandFile::WriteState::
-WriteState() {
+WriteState(PPContext *context) :
+  _context(context)
+{
   _out = NULL;
   _format = WF_collapse;
   _last_blank = true;
@@ -86,6 +95,7 @@ WriteState() {
 ////////////////////////////////////////////////////////////////////
 PPCommandFile::WriteState::
 WriteState(const WriteState &copy) :
+  _context(copy._context),
   _out(copy._out),
   _format(copy._format),
   _last_blank(copy._last_blank)
@@ -119,7 +129,7 @@ write_line(const string &line) {
     }
 
     cerr << "Unsupported write format: " << (int)_format << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 }
@@ -245,13 +255,15 @@ pop(PPCommandFile *file) {
 ////////////////////////////////////////////////////////////////////
 PPCommandFile::
 PPCommandFile(PPScope *scope) {
+  _context = scope->get_context();
   _native_scope = scope;
   _scope = scope;
   _got_command = false;
   _in_for = false;
+  _line_number = 0;
   _if_nesting = (IfNesting *)NULL;
   _block_nesting = (BlockNesting *)NULL;
-  _write_state = new WriteState;
+  _write_state = new WriteState(_context);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -279,12 +291,14 @@ set_output(ostream *out) {
 ////////////////////////////////////////////////////////////////////
 //     Function: PPCommandFile::set_scope
 //       Access: Public
-//  Description: Changes the command file to use the indicated scope.
-//               This scope will *not* be deleted when the command
-//               file destructs.
+//  Description: Changes the command file to use the indicated scope,
+//               which must belong to the same context as the
+//               original scope.  This scope will *not* be deleted
+//               when the command file destructs.
 ////////////////////////////////////////////////////////////////////
 void PPCommandFile::
 set_scope(PPScope *scope) {
+  assert(scope->get_context() == _context);
   _native_scope = scope;
   _scope = scope;
 }
@@ -311,16 +325,18 @@ get_scope() const {
 bool PPCommandFile::
 read_file(Filename filename) {
   filename.set_text();
+  _context->get_output_queue()->wait_for(filename);
   ifstream in;
 
   if (!filename.open_read(in)) {
     cerr << "Unable to open " << filename << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (verbose) {
     cerr << "Reading (cmd) \"" << filename << "\"\n";
   }
+  _context->record_source_file(filename);
 
   return read_stream(in, filename);
 }
@@ -343,11 +359,18 @@ read_file(Filename filename) {
 bool PPCommandFile::
 read_stream(istream &in, const string &filename) {
   PushFilename pushed(_scope, filename);
+  string old_source_filename = _source_filename;
+  int old_line_number = _line_number;
+  _source_filename = filename;
+
+  bool okflag = read_stream(in);
+  _source_filename = old_source_filename;
+  _line_number = old_line_number;
 
-  if (!read_stream(in)) {
+  if (!okflag) {
     if (!in.eof()) {
       cerr << "Error reading " << filename << ".\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
     }
     return false;
   }
@@ -371,8 +394,10 @@ read_stream(istream &in, const string &filename) {
 bool PPCommandFile::
 read_stream(istream &in) {
   string line;
+  int line_number = 0;
   begin_read();
   while (getline(in, line)) {
+    _line_number = ++line_number;
     if (!read_line(line)) {
       return false;
     }
@@ -405,6 +430,9 @@ begin_read() {
 ////////////////////////////////////////////////////////////////////
 bool PPCommandFile::
 read_line(string line) {
+  PPProfiler::Frame frame("line", _source_filename, _line_number);
+  PPStats::count(PPStats::C_script_lines);
+
   // First things first: strip off any comment in the line.
 
   // We only recognize comments that are proceeded by whitespace, or
@@ -437,6 +465,7 @@ read_line(string line) {
     if (_in_for) {
       // Save up the lines for later execution if we're within a #forscopes.
       _saved_lines.push_back(line);
+      _saved_line_numbers.push_back(_line_number);
     }
 
     if (_got_command) {
@@ -485,7 +514,7 @@ end_read() {
 
   if (_if_nesting != (IfNesting *)NULL) {
     cerr << "Unclosed if\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     _if_nesting = (IfNesting *)NULL;
     okflag = false;
   }
@@ -494,52 +523,52 @@ end_read() {
     switch (_block_nesting->_state) {
     case BS_begin:
       cerr << "Unclosed begin " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_while:
     case BS_nested_while:
       cerr << "Unclosed while " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_forscopes:
     case BS_nested_forscopes:
       cerr << "Unclosed forscopes " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_foreach:
     case BS_nested_foreach:
       cerr << "Unclosed foreach " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_formap:
     case BS_nested_formap:
       cerr << "Unclosed formap " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_fordict:
     case BS_nested_fordict:
       cerr << "Unclosed fordict " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_defsub:
       cerr << "Unclosed defsub " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_defun:
       cerr << "Unclosed defun " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
 
     case BS_output:
       cerr << "Unclosed output " << _block_nesting->_name << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       break;
     }
     _block_nesting = (BlockNesting *)NULL;
@@ -549,6 +578,35 @@ end_read() {
   return okflag;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPCommandFile::read_lines
+//       Access: Public
+//  Description: Reads a sequence of lines that were saved earlier,
+//               for instance the body of a #for loop or a #defsub,
+//               along with the file and line number each came from.
+//               The line numbers are only used to report where we
+//               are.  Returns true on success, false if any line
+//               failed.
+////////////////////////////////////////////////////////////////////
+bool PPCommandFile::
+read_lines(const vector<string> &lines, const vector<int> &line_numbers,
+           const string &filename) {
+  assert(lines.size() == line_numbers.size());
+  string old_source_filename = _source_filename;
+  int old_line_number = _line_number;
+  _source_filename = filename;
+
+  bool okflag = true;
+  for (size_t i = 0; i < lines.size() && okflag; ++i) {
+    _line_number = line_numbers[i];
+    okflag = read_line(lines[i]);
+  }
+
+  _source_filename = old_source_filename;
+  _line_number = old_line_number;
+  return okflag;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPCommandFile::handle_command
 //       Access: Protected
@@ -687,6 +745,9 @@ handle_command(const string &line) {
   } else if (_command == "defer") {
     return handle_defer_command();
 
+  } else if (_command == "memo") {
+    return handle_memo_command();
+
   } else if (_command == "define") {
     return handle_define_command();
 
@@ -713,7 +774,7 @@ handle_command(const string &line) {
   }
 
   cerr << "Invalid command: " << COMMAND_PREFIX << _command << "\n";
-  errors_occurred = true;
+  _context->set_errors_occurred();
   return false;
 }
 
@@ -766,12 +827,12 @@ bool PPCommandFile::
 handle_elif_command() {
   if (_if_nesting == (IfNesting *)NULL) {
     cerr << "elif encountered without if.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (_if_nesting->_state == IS_else) {
     cerr << "elif encountered after else.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (_if_nesting->_state == IS_on || _if_nesting->_state == IS_done) {
@@ -806,12 +867,12 @@ bool PPCommandFile::
 handle_else_command() {
   if (_if_nesting == (IfNesting *)NULL) {
     cerr << "else encountered without if.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (_if_nesting->_state == IS_else) {
     cerr << "else encountered after else.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (_if_nesting->_state == IS_on || _if_nesting->_state == IS_done) {
@@ -833,7 +894,7 @@ bool PPCommandFile::
 handle_endif_command() {
   if (_if_nesting == (IfNesting *)NULL) {
     cerr << "endif encountered without if.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -843,10 +904,10 @@ handle_endif_command() {
   if (nest->_block != _block_nesting) {
     if (nest->_block != (BlockNesting *)NULL) {
       cerr << "If block not closed within scoping block " << nest->_block->_name << ".\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
     } else {
       cerr << "If block not closed within scoping block " << _block_nesting->_name << ".\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
     }
     return false;
   }
@@ -872,7 +933,7 @@ handle_begin_command() {
   if (contains_whitespace(name)) {
     cerr << "Attempt to define scope named \"" << name
          << "\".\nScope names may not contain whitespace.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -880,7 +941,7 @@ handle_begin_command() {
     cerr << "Attempt to define scope named \"" << name
          << "\".\nScope names may not contain the '"
          << SCOPE_DIRNAME_SEPARATOR << "' character.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -911,6 +972,7 @@ handle_while_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
   }
 
   return true;
@@ -931,7 +993,7 @@ handle_for_command() {
 
   if (name.empty()) {
     cerr << "#for without varname\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -941,7 +1003,7 @@ handle_for_command() {
   if (words.size() != 2 && words.size() != 3) {
     cerr << "Invalid numeric range: '" << _params.substr(p)
          << "' for #for " << name << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -952,6 +1014,7 @@ handle_for_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
 
     nest->_words.swap(words);
   }
@@ -977,6 +1040,7 @@ handle_forscopes_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
   }
 
   return true;
@@ -1000,7 +1064,7 @@ handle_foreach_command() {
 
   if (words.empty()) {
     cerr << "#foreach requires at least one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1016,6 +1080,7 @@ handle_foreach_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
   }
 
   return true;
@@ -1040,7 +1105,7 @@ handle_formap_command() {
 
   if (words.size() != 2) {
     cerr << "#formap requires exactly two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1055,6 +1120,7 @@ handle_formap_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
   }
 
   return true;
@@ -1078,7 +1144,7 @@ handle_fordict_command() {
 
   if (words.size() != 2) {
     cerr << "#fordict requires exactly two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1093,6 +1159,7 @@ handle_fordict_command() {
   if (!_in_for) {
     _in_for = true;
     _saved_lines.clear();
+    _saved_line_numbers.clear();
   }
 
   return true;
@@ -1125,7 +1192,7 @@ handle_defsub_command(bool is_defsub) {
 
   if (subroutine_name.empty()) {
     cerr << command << " requires at least one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1137,7 +1204,7 @@ handle_defsub_command(bool is_defsub) {
     if (!is_valid_formal(*fi)) {
       cerr << command << " " << subroutine_name
            << ": invalid formal parameter name '" << (*fi) << "'\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       return false;
     }
   }
@@ -1145,7 +1212,7 @@ handle_defsub_command(bool is_defsub) {
   if (_in_for) {
     cerr << command << " may not appear within another block scoping command like\n"
          << "#forscopes, #foreach, #formap, #defsub, or #defun.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1157,6 +1224,7 @@ handle_defsub_command(bool is_defsub) {
 
   _in_for = true;
   _saved_lines.clear();
+  _saved_line_numbers.clear();
 
   return true;
 }
@@ -1178,7 +1246,7 @@ handle_output_command() {
 
   if (name.empty()) {
     cerr << "#output command requires one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1196,7 +1264,7 @@ handle_output_command() {
       nest->_flags |= OF_binary;
     } else {
       cerr << "Invalid output flag: " << words[i] << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
     }
   }
 
@@ -1206,7 +1274,7 @@ handle_output_command() {
     Filename filename = trim_blanks(_scope->expand_string(nest->_name));
     if (filename.empty()) {
       cerr << "Attempt to output to empty filename\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       return false;
     }
 
@@ -1235,7 +1303,7 @@ bool PPCommandFile::
 handle_end_command() {
   if (_block_nesting == (BlockNesting *)NULL) {
     cerr << "Unmatched end " << _params << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1249,7 +1317,7 @@ handle_end_command() {
   if (name != _block_nesting->_name) {
     cerr << "end " << name << " encountered where end "
          << _block_nesting->_name << " expected.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1258,7 +1326,7 @@ handle_end_command() {
 
   if (nest->_if != _if_nesting) {
     cerr << "If block not closed within scoping block " << name << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1311,23 +1379,29 @@ handle_end_command() {
     PPSubroutine *sub = new PPSubroutine;
     sub->_formals.swap(nest->_words);
     sub->_lines.swap(_saved_lines);
+    sub->_line_numbers.swap(_saved_line_numbers);
+    sub->_filename = _source_filename;
 
     // Remove the #end command.  This will fail if someone makes an
     // #end command that spans multiple lines.  Don't do that.
     assert(!sub->_lines.empty());
     sub->_lines.pop_back();
+    sub->_line_numbers.pop_back();
 
     if (nest->_state == BS_defsub) {
-      PPSubroutine::define_sub(nest->_name, sub);
+      _context->define_sub(nest->_name, sub);
     } else {
-      PPSubroutine::define_func(nest->_name, sub);
+      _context->define_func(nest->_name, sub);
+
+      // A function shadows a variable of the same name.
+      _scope->invalidate_memos(nest->_name);
     }
 
   } else if (nest->_state == BS_output) {
     if (!_in_for) {
       if (!nest->_output) {
         cerr << "Error while writing " << nest->_params << "\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         return false;
       }
 
@@ -1377,7 +1451,7 @@ handle_format_command() {
 
   } else {
     cerr << "Ignoring invalid write format: " << _params << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
   }
 
   return true;
@@ -1462,6 +1536,7 @@ handle_sinclude_command() {
   }
 
   Filename fn(filename);
+  _context->get_output_queue()->wait_for(fn);
 
   if (!fn.exists()) {
     // No such file; no error.
@@ -1492,11 +1567,12 @@ handle_copy_command() {
 
   Filename fn(filename);
   fn.set_text();
+  _context->get_output_queue()->wait_for(fn);
 
   ifstream in;
   if (!fn.open_read(in)) {
     cerr << "Unable to open copy file " << fn << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (verbose) {
@@ -1512,7 +1588,7 @@ handle_copy_command() {
 
   if (!in.eof()) {
     cerr << "Error reading " << fn << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1541,34 +1617,29 @@ handle_call_command() {
 
   if (subroutine_name.empty()) {
     cerr << "#call requires at least one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
-  const PPSubroutine *sub = PPSubroutine::get_sub(subroutine_name);
+  const PPSubroutine *sub = _context->get_sub(subroutine_name);
   if (sub == (const PPSubroutine *)NULL) {
     cerr << "Attempt to call undefined subroutine " << subroutine_name << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
   }
 
+  PPProfiler::Frame frame("defsub", subroutine_name);
+
   PPScope *old_scope = _scope;
-  PPScope::push_scope(_scope);
-  PPScope *nested_scope = new PPScope(_scope->get_named_scopes());
-  _scope = nested_scope;
-  nested_scope->define_formals(subroutine_name, sub->_formals, params);
-
-  vector<string>::const_iterator li;
-  for (li = sub->_lines.begin(); li != sub->_lines.end(); ++li) {
-    if (!read_line(*li)) {
-      PPScope::pop_scope();
-      _scope = old_scope;
-      return false;
-    }
-  }
+  _context->push_scope(_scope);
+  PPScope nested_scope(_context, _scope->get_named_scopes());
+  _scope = &nested_scope;
+  nested_scope.define_formals(subroutine_name, sub->_formals, params);
+
+  bool okflag = read_lines(sub->_lines, sub->_line_numbers, sub->_filename);
 
-  PPScope::pop_scope();
+  _context->pop_scope();
   _scope = old_scope;
-  return true;
+  return okflag;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -1583,7 +1654,7 @@ handle_error_command() {
 
   if (!message.empty()) {
     cerr << message << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
   }
   return false;
 }
@@ -1612,7 +1683,7 @@ handle_mkdir_command() {
     if (!filename.make_dir()) {
       if (!dirname.is_directory()) {
         cerr << "Unable to create directory " << dirname << "\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
       }
     }
   }
@@ -1638,7 +1709,7 @@ handle_defer_command() {
   size_t p = _scope->scan_to_whitespace(_params);
   string varname = trim_blanks(_scope->expand_string(_params.substr(0, p)));
 
-  if (PPSubroutine::get_func(varname) != (const PPSubroutine *)NULL) {
+  if (_context->get_func(varname) != (const PPSubroutine *)NULL) {
     cerr << "Warning: variable " << varname
          << " shadowed by function definition.\n";
   }
@@ -1662,6 +1733,26 @@ handle_defer_command() {
   return true;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPCommandFile::handle_memo_command
+//       Access: Protected
+//  Description: Handles the #memo command: the named variables,
+//               usually defined with #defer, have their expansions
+//               remembered within each scope, and expanded again only
+//               after one of the variables they read is redefined.
+////////////////////////////////////////////////////////////////////
+bool PPCommandFile::
+handle_memo_command() {
+  vector<string> words;
+  tokenize_whitespace(_scope->expand_string(_params), words);
+
+  vector<string>::const_iterator wi;
+  for (wi = words.begin(); wi != words.end(); ++wi) {
+    _scope->memoize_variable(*wi);
+  }
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPCommandFile::handle_define_command
 //       Access: Protected
@@ -1676,7 +1767,7 @@ handle_define_command() {
   size_t p = _scope->scan_to_whitespace(_params);
   string varname = trim_blanks(_scope->expand_string(_params.substr(0, p)));
 
-  if (PPSubroutine::get_func(varname) != (const PPSubroutine *)NULL) {
+  if (_context->get_func(varname) != (const PPSubroutine *)NULL) {
     cerr << "Warning: variable " << varname
          << " shadowed by function definition.\n";
   }
@@ -1716,7 +1807,7 @@ handle_set_command() {
   size_t p = _scope->scan_to_whitespace(_params);
   string varname = trim_blanks(_scope->expand_string(_params.substr(0, p)));
 
-  if (PPSubroutine::get_func(varname) != (const PPSubroutine *)NULL) {
+  if (_context->get_func(varname) != (const PPSubroutine *)NULL) {
     cerr << "Warning: variable " << varname
          << " shadowed by function definition.\n";
   }
@@ -1729,7 +1820,7 @@ handle_set_command() {
 
   if (!_scope->set_variable(varname, def)) {
     cerr << "Attempt to set undefined variable " << varname << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1818,7 +1909,7 @@ handle_adddict_command() {
   _scope->tokenize_params(_params.substr(p), words, true);
   if (words.size() != 2) {
     cerr << "Missing comma-delimited key,value parameters in #adddict " << varname << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1854,13 +1945,13 @@ handle_push_command() {
   if (n == param || levels < 0) {
     // Invalid integer.
     cerr << "#push with invalid level count: " << levels_str << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
   PPScope *enclosing_scope = _scope;
   if (levels > 0) {
-    enclosing_scope = _scope->get_enclosing_scope(levels - 1);
+    enclosing_scope = _context->get_enclosing_scope(levels - 1);
   }
 
   // Skip whitespace to the first variable name.
@@ -1889,6 +1980,15 @@ handle_push_command() {
 //  Description: Handles the "concatxx" command.  This creates a
 //               single C++ file which includes a const char[]
 //               containing the bytes from one or more files.
+//
+//               An optional fourth parameter selects how the bytes
+//               get there: "array" (the default) writes them out as
+//               an initializer; "incbin" writes a small assembler
+//               stub that pulls the files in with .incbin; and
+//               "embed" writes an initializer that uses the C23
+//               #embed directive.  The latter two are much faster to
+//               generate and to compile, but need a compiler that
+//               supports them.
 ////////////////////////////////////////////////////////////////////
 bool PPCommandFile::
 handle_concatcxx_command() {
@@ -1896,9 +1996,9 @@ handle_concatcxx_command() {
   vector<string> tokens;
   _scope->tokenize_params(_params, tokens, false);
 
-  if (tokens.size() != 3) {
-    cerr << "concatcxx requires three parameters.\n";
-    errors_occurred = true;
+  if (tokens.size() != 3 && tokens.size() != 4) {
+    cerr << "concatcxx requires three or four parameters.\n";
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1908,7 +2008,7 @@ handle_concatcxx_command() {
 
   if (output_filename.length() == (size_t)0) {
     cerr << "concatcxx: Output filename (parameter 0) cannot be empty.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1916,7 +2016,7 @@ handle_concatcxx_command() {
   string symbol_name = trim_blanks(_scope->expand_string(tokens[1]));
   if (symbol_name.empty()) {
     cerr << "concatcxx: Symbol name (parameter 1) cannot be empty.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -1926,67 +2026,285 @@ handle_concatcxx_command() {
 
   if (inputs.size() == (size_t)0) {
     cerr << "concatcxx: No input filenames specified (parameter 2).\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
+    return false;
+  }
+
+  // The optional fourth parameter is the form of the output.
+  string mode = "array";
+  if (tokens.size() == 4) {
+    mode = trim_blanks(_scope->expand_string(tokens[3]));
+    if (mode.empty()) {
+      mode = "array";
+    }
+  }
+  if (mode != "array" && mode != "incbin" && mode != "embed") {
+    cerr << "concatcxx: Unknown output form " << mode
+         << " (parameter 3); expected array, incbin, or embed.\n";
+    _context->set_errors_occurred();
     return false;
   }
 
-  ostringstream iss;
+  string header =
+    "/*******************************************************************\n"
+    " * Generated automatically by " PACKAGE " " PACKAGE_VERSION ".\n";
+  string footer =
+    " ***************************** DO NOT EDIT *************************/\n\n";
 
+  string input_data;
   for (size_t i = 0; i < inputs.size(); i++) {
     Filename input_filename = Filename(inputs[i]).to_os_specific();
     ifstream input_stream;
     input_filename.set_text();
+    _context->get_output_queue()->wait_for(input_filename);
     if (!input_filename.open_read(input_stream)) {
       cerr << "concatcxx: could not open input file " << input_filename.get_fullpath() << ".\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       input_stream.close();
       return false;
     }
 
-    iss << input_stream.rdbuf();
+    input_data.reserve(input_data.length() + (size_t)input_filename.get_file_size());
+    static const size_t buffer_size = 65536;
+    char buffer[buffer_size];
+    input_stream.read(buffer, buffer_size);
+    while (input_stream.gcount() > 0) {
+      input_data.append(buffer, (size_t)input_stream.gcount());
+      input_stream.read(buffer, buffer_size);
+    }
 
     input_stream.close();
   }
 
-  string input_data = iss.str();
+  // The digest of the input goes into the header, so that next time
+  // we can tell whether the output is already up-to-date by reading
+  // just the first few lines of it.  A stub records it too, although
+  // it doesn't contain the data, so that the stub changes--and
+  // whatever includes the data gets rebuilt--when the data does.  The
+  // form is part of the digest for a stub, so that it is never
+  // mistaken for an up-to-date array.
+  string digest_key = symbol_name;
+  if (mode != "array") {
+    digest_key += '\0' + mode;
+  }
+  digest_key += '\0';
+
+  PP_MD5_CTX context;
+  unsigned char digest[16];
+  MD5Init(&context);
+  MD5Update(&context, reinterpret_cast<const unsigned char *>(digest_key.data()),
+            digest_key.size());
+  MD5Update(&context, reinterpret_cast<const unsigned char *>(input_data.data()),
+            input_data.size());
+  MD5Final(digest, &context);
+
+  header += " * Input digest: ";
+  char hex[3];
+  for (int i = 0; i < 16; i++) {
+    sprintf(hex, "%02x", digest[i]);
+    header += hex;
+  }
+  header += "\n";
+
+  if (mode != "array") {
+    // The stub names the input files by full path, since it will be
+    // compiled from some other directory.
+    string cwd = ExecutionEnvironment::get_cwd();
+    vector<string> fullpaths;
+    for (size_t i = 0; i < inputs.size(); i++) {
+      Filename input_filename(inputs[i]);
+      if (input_filename.is_local()) {
+        input_filename = Filename(cwd, input_filename);
+      }
+      input_filename.standardize();
+      if (!input_filename.exists()) {
+        cerr << "concatcxx: could not find input file " << input_filename << ".\n";
+        _context->set_errors_occurred();
+        return false;
+      }
+      string fullpath = input_filename.to_os_specific();
+      if (fullpath.find('\n') != string::npos ||
+          (mode == "embed" && fullpath.find('"') != string::npos)) {
+        // There is no way to spell this name in the stub.
+        cerr << "concatcxx: cannot name input file " << input_filename
+             << " in the " << mode << " form.\n";
+        _context->set_errors_occurred();
+        return false;
+      }
+      fullpaths.push_back(fullpath);
+    }
 
-  ostringstream ss;
-  ss << "/*******************************************************************\n"
-        " * Generated automatically by " << PACKAGE << " " << PACKAGE_VERSION << ".\n"
-        " ***************************** DO NOT EDIT *************************/\n\n";
+    string stub = header + footer;
+    if (mode == "incbin") {
+      // ELF targets also get a type and size for the symbol, so that
+      // debuggers and tools like nm -S describe it properly.
+      stub +=
+        "#if defined(__APPLE__)\n"
+        "#define PP_INCBIN_SECTION \".const_data\"\n"
+        "#define PP_INCBIN_SYMBOL \"_" + symbol_name + "\"\n"
+        "#define PP_INCBIN_TYPE \"\"\n"
+        "#define PP_INCBIN_SIZE \"\"\n"
+        "#else\n"
+        "#define PP_INCBIN_SECTION \".section .rodata\"\n"
+        "#define PP_INCBIN_SYMBOL \"" + symbol_name + "\"\n"
+        "#if defined(__ELF__)\n"
+        "#define PP_INCBIN_TYPE \".type \" PP_INCBIN_SYMBOL \", %object\\n\"\n"
+        "#define PP_INCBIN_SIZE \".size \" PP_INCBIN_SYMBOL \", . - \" PP_INCBIN_SYMBOL \"\\n\"\n"
+        "#else\n"
+        "#define PP_INCBIN_TYPE \"\"\n"
+        "#define PP_INCBIN_SIZE \"\"\n"
+        "#endif\n"
+        "#endif\n\n"
+        "__asm__(PP_INCBIN_SECTION \"\\n\"\n"
+        "        \".globl \" PP_INCBIN_SYMBOL \"\\n\"\n"
+        "        PP_INCBIN_TYPE\n"
+        "        PP_INCBIN_SYMBOL \":\\n\"\n";
+      for (size_t i = 0; i < fullpaths.size(); i++) {
+        stub += "        \".incbin \\\"" + quote_asm_string(fullpaths[i]) +
+          "\\\"\\n\"\n";
+      }
+      stub +=
+        "        \".byte 0\\n\"\n"
+        "        PP_INCBIN_SIZE\n"
+        "        \".text\\n\");\n";
 
-  ss << "extern const char " << symbol_name << "[] = {\n";
+    } else {
+      stub += "extern const char " + symbol_name + "[] = {\n";
+      for (size_t i = 0; i < fullpaths.size(); i++) {
+        stub += "#embed \"" + fullpaths[i] + "\" suffix(,)\n";
+      }
+      stub += "  0,\n};\n";
+    }
 
-  size_t offset = 0;
-  for (size_t i = 0; i < input_data.size(); i++) {
-    unsigned char c = input_data[i];
+    return compare_output(stub, output_filename, true, false);
+  }
 
-    if (offset == 0) {
-      ss << " ";
+  _context->get_output_queue()->wait_for(output_filename);
+  {
+    Filename existing = output_filename;
+    existing.set_text();
+    ifstream in;
+    if (existing.open_read(in)) {
+      string line1, line2, line3;
+      getline(in, line1);
+      getline(in, line2);
+      getline(in, line3);
+      if (!in.fail() && line1 + "\n" + line2 + "\n" + line3 + "\n" == header) {
+        if (verbose) {
+          cerr << "Not regenerating " << output_filename
+               << "; input is unchanged.\n";
+        }
+        return true;
+      }
     }
+  }
+
+  string output = header + footer;
+  output += "extern const char " + symbol_name + "[] = {\n";
+  append_hex_array(output, input_data);
+  output += "};\n";
+
+  if (!compare_output(output, output_filename, true, false)) {
+    return false;
+  }
 
-    ss << " 0x" << hex << (int)c << ",";
-    offset++;
-    if (offset >= 12) {
-      ss << "\n";
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPCommandFile::append_hex_array
+//       Access: Protected, Static
+//  Description: Appends the bytes of data to the output string as the
+//               body of a C array initializer, twelve bytes to a
+//               line, followed by a terminating null byte.
+//
+//               This is called for files of many megabytes, so
+//               rather than formatting each byte, we copy its text
+//               from a table into a buffer allocated once.
+////////////////////////////////////////////////////////////////////
+void PPCommandFile::
+append_hex_array(string &output, const string &data) {
+  // Each entry is " 0x" followed by one or two hex digits and a
+  // comma; the length is stored in the last byte.  The table is
+  // built by whichever context gets here first.
+  class HexTable {
+  public:
+    HexTable() {
+      static const char digits[] = "0123456789abcdef";
+      for (int c = 0; c < 256; c++) {
+        char *p = _entries[c];
+        *p++ = ' ';
+        *p++ = '0';
+        *p++ = 'x';
+        if (c >= 16) {
+          *p++ = digits[c >> 4];
+        }
+        *p++ = digits[c & 0xf];
+        *p++ = ',';
+        _entries[c][7] = (char)(p - _entries[c]);
+      }
+    }
+    char _entries[256][8];
+  };
+  static const HexTable hex_table;
+  const char (&table)[256][8] = hex_table._entries;
+
+  // At most six characters per byte, plus a space and a newline for
+  // every twelve bytes, plus the terminator.
+  size_t start = output.length();
+  output.resize(start + data.length() * 6 + (data.length() / 12) * 2 + 8);
+  char *begin = &output[start];
+  char *p = begin;
+
+  const unsigned char *d = (const unsigned char *)data.data();
+  const unsigned char *end = d + data.length();
+  int offset = 0;
+  while (d < end) {
+    if (offset == 0) {
+      *p++ = ' ';
+    }
+    const char *entry = table[*d++];
+    memcpy(p, entry, 6);
+    p += entry[7];
+    if (++offset >= 12) {
+      *p++ = '\n';
       offset = 0;
     }
   }
 
   // Null-terminate the array.
   if (offset == 0) {
-    ss << " ";
-  }
-  ss << " 0,";
-  ss << "\n};\n";
-
-  if (!compare_output(ss.str(), output_filename, true, false)) {
-    return false;
+    *p++ = ' ';
   }
+  memcpy(p, " 0,\n", 4);
+  p += 4;
 
-  return true;
+  output.resize(start + (p - begin));
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPCommandFile::quote_asm_string
+//       Access: Protected, Static
+//  Description: Returns the indicated string with backslashes and
+//               quotation marks escaped twice: once for the
+//               assembler string it will appear in, and once more
+//               for the C string literal that holds the assembler
+//               text.  The result may be pasted between \\\" and
+//               \\\" in a #concatcxx incbin stub.
+////////////////////////////////////////////////////////////////////
+string PPCommandFile::
+quote_asm_string(const string &str) {
+  string result;
+  for (string::const_iterator si = str.begin(); si != str.end(); ++si) {
+    if ((*si) == '"' || (*si) == '\\') {
+      // \ or \" for the assembler, each of which becomes two
+      // characters in the C string.
+      result += "\\\\\\";
+    }
+    result += (*si);
+  }
+  return result;
+}
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPCommandFile::include_file
@@ -1996,30 +2314,44 @@ handle_concatcxx_command() {
 ////////////////////////////////////////////////////////////////////
 bool PPCommandFile::
 include_file(Filename filename) {
+  PPTrace::Span span("include", PPTrace::is_enabled() ?
+                      filename.get_fullpath() : string());
   filename.set_text();
+  _context->get_output_queue()->wait_for(filename);
 
   ifstream in;
   if (!filename.open_read(in)) {
     cerr << "Unable to open include file " << filename << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
   if (verbose) {
     cerr << "Reading (inc) \"" << filename << "\"\n";
   }
+  _context->record_source_file(filename);
 
   PushFilename pushed(_scope, filename);
+  string old_source_filename = _source_filename;
+  int old_line_number = _line_number;
+  _source_filename = filename;
 
+  bool okflag = true;
   string line;
-  while (getline(in, line)) {
-    if (!read_line(line)) {
-      return false;
-    }
+  int line_number = 0;
+  while (okflag && getline(in, line)) {
+    _line_number = ++line_number;
+    okflag = read_line(line);
+  }
+
+  _source_filename = old_source_filename;
+  _line_number = old_line_number;
+  if (!okflag) {
+    return false;
   }
 
   if (!in.eof()) {
     cerr << "Error reading " << filename << ".\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -2040,26 +2372,28 @@ replay_while(const string &name) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   // Now replay all of the saved lines.
   BlockNesting *saved_block = _block_nesting;
   IfNesting *saved_if = _if_nesting;
 
   while (!_scope->expand_string(name).empty()) {
-    vector<string>::const_iterator li;
-    for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-      okflag = read_line(*li);
+    if (okflag) {
+      okflag = read_lines(lines, line_numbers, _source_filename);
     }
   }
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2080,11 +2414,14 @@ replay_for(const string &name, const vector<string> &words) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   // Expand the variable name.
   string varname = _scope->expand_string(name);
@@ -2098,14 +2435,14 @@ replay_for(const string &name, const vector<string> &words) {
     range[i] = strtol(param, &n, 10);
     if (n == param) {
       cerr << "Invalid integer in #for: " << param << "\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
       return false;
     }
   }
 
   if (range[2] == 0) {
     cerr << "Step by zero in #for " << name << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -2117,17 +2454,15 @@ replay_for(const string &name, const vector<string> &words) {
   if (range[2] > 0) {
     for (index_var = range[0]; index_var <= range[1]; index_var += range[2]) {
       _scope->define_variable(varname, _scope->format_int(index_var));
-      vector<string>::const_iterator li;
-      for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-        okflag = read_line(*li);
+      if (okflag) {
+        okflag = read_lines(lines, line_numbers, _source_filename);
       }
     }
   } else {
     for (index_var = range[0]; index_var >= range[1]; index_var += range[2]) {
       _scope->define_variable(varname, _scope->format_int(index_var));
-      vector<string>::const_iterator li;
-      for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-        okflag = read_line(*li);
+      if (okflag) {
+        okflag = read_lines(lines, line_numbers, _source_filename);
       }
     }
   }
@@ -2135,7 +2470,7 @@ replay_for(const string &name, const vector<string> &words) {
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2156,11 +2491,14 @@ replay_forscopes(const string &name) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   PPNamedScopes *named_scopes = _scope->get_named_scopes();
 
@@ -2183,19 +2521,18 @@ replay_forscopes(const string &name) {
 
   PPNamedScopes::Scopes::const_iterator si;
   for (si = scopes.begin(); si != scopes.end() && okflag; ++si) {
-    PPScope::push_scope(_scope);
+    _context->push_scope(_scope);
     _scope = (*si);
 
-    vector<string>::const_iterator li;
-    for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-      okflag = read_line(*li);
+    if (okflag) {
+      okflag = read_lines(lines, line_numbers, _source_filename);
     }
-    _scope = PPScope::pop_scope();
+    _scope = _context->pop_scope();
   }
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2216,11 +2553,14 @@ replay_foreach(const string &varname, const vector<string> &words) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   // Now traverse through the saved words.
   BlockNesting *saved_block = _block_nesting;
@@ -2229,15 +2569,14 @@ replay_foreach(const string &varname, const vector<string> &words) {
   vector<string>::const_iterator wi;
   for (wi = words.begin(); wi != words.end() && okflag; ++wi) {
     _scope->define_variable(varname, (*wi));
-    vector<string>::const_iterator li;
-    for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-      okflag = read_line(*li);
+    if (okflag) {
+      okflag = read_lines(lines, line_numbers, _source_filename);
     }
   }
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2258,18 +2597,21 @@ replay_formap(const string &varname, const string &mapvar) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   // Now look up the map variable.
   PPScope::MapVariableDefinition &def = _scope->find_map_variable(mapvar);
   if (&def == &PPScope::_null_map_def) {
     cerr << "Undefined map variable: #formap " << varname << " "
          << mapvar << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -2281,20 +2623,19 @@ replay_formap(const string &varname, const string &mapvar) {
   for (di = def.begin(); di != def.end() && okflag; ++di) {
     _scope->define_variable(varname, (*di).first);
 
-    PPScope::push_scope(_scope);
+    _context->push_scope(_scope);
     _scope = (*di).second;
 
-    vector<string>::const_iterator li;
-    for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-      okflag = read_line(*li);
+    if (okflag) {
+      okflag = read_lines(lines, line_numbers, _source_filename);
     }
 
-    _scope = PPScope::pop_scope();
+    _scope = _context->pop_scope();
   }
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2315,18 +2656,21 @@ replay_fordict(const string &varname, const string &dictvar) {
 
   vector<string> lines;
   lines.swap(_saved_lines);
+  vector<int> line_numbers;
+  line_numbers.swap(_saved_line_numbers);
 
   // Remove the #end command.  This will fail if someone makes an #end
   // command that spans multiple lines.  Don't do that.
   assert(!lines.empty());
   lines.pop_back();
+  line_numbers.pop_back();
 
   // Now look up the map variable.
   PPScope::DictVariableDefinition &def = _scope->find_dict_variable(dictvar);
   if (&def == &PPScope::_null_dict_def) {
     cerr << "Undefined dict variable: #fordict " << varname << " "
          << dictvar << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -2337,15 +2681,14 @@ replay_fordict(const string &varname, const string &dictvar) {
   PPScope::DictVariableDefinition::const_iterator di;
   for (di = def.begin(); di != def.end() && okflag; ++di) {
     _scope->define_variable(varname, (*di).first);
-    vector<string>::const_iterator li;
-    for (li = lines.begin(); li != lines.end() && okflag; ++li) {
-      okflag = read_line(*li);
+    if (okflag) {
+      okflag = read_lines(lines, line_numbers, _source_filename);
     }
   }
 
   if (saved_block != _block_nesting || saved_if != _if_nesting) {
     cerr << "Misplaced #end or #endif.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     okflag = false;
   }
 
@@ -2358,17 +2701,36 @@ replay_fordict(const string &varname, const string &dictvar) {
 //  Description: After a file has been written to a (potentially
 //               large) string via an #output command, compare the
 //               results to the original file.  If they are different,
-//               remove the original file and replace it with the new
-//               contents; otherwise, leave the original alone.
+//               replace the original file with the new contents;
+//               otherwise, leave the original alone.
+//
+//               Normally, the comparison and the write are handed
+//               off to the PPOutputQueue, which does them in the
+//               background; only a dry run is done here.
 ////////////////////////////////////////////////////////////////////
 bool PPCommandFile::
 compare_output(const string &new_contents, Filename filename,
                bool notouch, bool binary) {
+  PPProfiler::Frame frame("io", "output");
+  PPTrace::Span span("output", PPTrace::is_enabled() ?
+                      filename.get_fullpath() : string());
+
   if (binary) {
     filename.set_binary();
   } else {
     filename.set_text();
   }
+
+  if (!dry_run) {
+    PPOutputQueue *queue = _context->get_output_queue();
+    string jobs_str = trim_blanks(_scope->expand_variable("OUTPUT_JOBS"));
+    if (!jobs_str.empty()) {
+      queue->set_max_jobs(atoi(jobs_str.c_str()));
+    }
+    queue->add(filename, new_contents, notouch);
+    return true;
+  }
+
   bool exists = filename.exists();
   bool differ = false;
 
@@ -2394,7 +2756,17 @@ compare_output(const string &new_contents, Filename filename,
       } else {
         differ = !(new_contents == string(orig_contents, len));
       }
+      if (differ && explain) {
+        cerr << PPOutputQueue::describe_difference
+          (filename.get_fullpath(), in, orig_contents, in.gcount(),
+           new_contents);
+      }
     }
+    delete[] orig_contents;
+    PPStats::count(PPStats::C_outputs_compared);
+
+  } else if (explain) {
+    cerr << "Explain: " << filename << " does not exist yet.\n";
   }
 
   if (differ || !exists) {
@@ -2411,7 +2783,7 @@ compare_output(const string &new_contents, Filename filename,
       ofstream out_b;
       if (!temp_filename.open_write(out_b)) {
         cerr << "Unable to open temporary file " << filename << " for writing.\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         return false;
       }
 
@@ -2420,7 +2792,7 @@ compare_output(const string &new_contents, Filename filename,
       bool diff_ok = true;
       if (!out_b) {
         cerr << "Unable to write to temporary file " << filename << "\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         diff_ok = true;
       }
       out_b.close();
@@ -2429,7 +2801,7 @@ compare_output(const string &new_contents, Filename filename,
       int sys_result = system(command.c_str());
       if (sys_result < 0) {
         cerr << "Unable to invoke diff\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         diff_ok = false;
       }
       out_b.close();
@@ -2439,45 +2811,9 @@ compare_output(const string &new_contents, Filename filename,
 
     } else
 #endif
-      if (dry_run) {
+      {
         cerr << "Would generate " << filename << "\n";
-      } else {
-        cerr << "Generating " << filename << "\n";
-
-        if (exists) {
-          if (!filename.unlink()) {
-            cerr << "Unable to remove old " << filename << "\n";
-            errors_occurred = true;
-            return false;
-          }
-        }
-
-        ofstream out_b;
-        if (!filename.open_write(out_b)) {
-          cerr << "Unable to open file " << filename << " for writing.\n";
-          errors_occurred = true;
-          return false;
-        }
-
-        out_b.write(new_contents.data(), new_contents.length());
-
-        if (!out_b) {
-          cerr << "Unable to write to file " << filename << "\n";
-          errors_occurred = true;
-          return false;
-        }
-        out_b.close();
       }
-
-  } else {
-    // Even though the file is unchanged, unless the "notouch" flag is
-    // set, we want to update the modification time.  This helps the
-    // makefiles know we did something.
-    if (!notouch && !dry_run) {
-      if (!filename.touch()) {
-        cerr << "Warning: unable to update timestamp for " << filename << "\n";
-      }
-    }
   }
 
   return true;
@@ -12,6 +12,7 @@
 #include <map>
 #include <vector>
 
+class PPContext;
 class PPScope;
 
 ///////////////////////////////////////////////////////////////////
@@ -36,6 +37,8 @@ public:
   void begin_read();
   bool read_line(string line);
   bool end_read();
+  bool read_lines(const vector<string> &lines, const vector<int> &line_numbers,
+                  const string &filename);
 
 protected:
   bool handle_command(const string &line);
@@ -66,6 +69,7 @@ protected:
   bool handle_mkdir_command();
 
   bool handle_defer_command();
+  bool handle_memo_command();
   bool handle_define_command();
   bool handle_set_command();
   bool handle_map_command();
@@ -75,6 +79,8 @@ protected:
   bool handle_push_command();
 
   bool handle_concatcxx_command();
+  static void append_hex_array(string &output, const string &data);
+  static string quote_asm_string(const string &str);
 
   bool include_file(Filename filename);
   bool replay_while(const string &name);
@@ -149,12 +155,13 @@ private:
 
   class WriteState {
   public:
-    WriteState();
+    WriteState(PPContext *context);
     WriteState(const WriteState &copy);
     bool write_line(const string &line);
     bool write_collapse_line(const string &line);
     bool write_makefile_line(const string &line);
 
+    PPContext *_context;
     ostream *_out;
     WriteFormat _format;
     bool _last_blank;
@@ -187,6 +194,7 @@ private:
     BlockNesting *_next;
   };
 
+  PPContext *_context;
   PPScope *_native_scope;
   PPScope *_scope;
   bool _got_command;
@@ -198,6 +206,11 @@ private:
   WriteState *_write_state;
 
   vector<string> _saved_lines;
+  vector<int> _saved_line_numbers;
+
+  // The file and line we are reading now, for --profile.
+  string _source_filename;
+  int _line_number;
 
   friend class PPCommandFile::IfNesting;
   friend class PPCommandFile::WriteState;
@@ -0,0 +1,340 @@
+// Filename: ppContext.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppContext.h"
+#include "ppOutputQueue.h"
+#include "ppSearchCache.h"
+#include "ppShellCache.h"
+#include "ppSubroutine.h"
+#include "sedProcess.h"
+#include "shellCommandQueue.h"
+#include "shellCoprocess.h"
+
+#include <assert.h>
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPContext::
+PPContext() {
+  _output_directory = (PPDirectory *)NULL;
+  _errors_occurred = false;
+  _memo_recorder = (PPScope::MemoRecorder *)NULL;
+  _next_generation = 0;
+  _memo_epoch = 0;
+  _frozen_serial = 0;
+  _overlay = (PPScope::Overlay *)NULL;
+  _async_commands = (ShellCommandQueue *)NULL;
+  _output_queue = (PPOutputQueue *)NULL;
+  _search_cache = (PPSearchCache *)NULL;
+  _shell_cache = (PPShellCache *)NULL;
+  _shell_coprocess = (ShellCoprocess *)NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::Destructor
+//       Access: Public
+//  Description: Deletes the subroutines and functions, and waits for
+//               any $[shell-async] commands still running and any
+//               output files still being written.  The caches are
+//               not written out here; PPMain does that when it
+//               finishes processing.  The scopes are not deleted;
+//               they belong to whoever created them.
+////////////////////////////////////////////////////////////////////
+PPContext::
+~PPContext() {
+  assert(_overlay == (PPScope::Overlay *)NULL);
+
+  Subroutines::iterator si;
+  for (si = _subroutines.begin(); si != _subroutines.end(); ++si) {
+    delete (*si).second;
+  }
+  for (si = _functions.begin(); si != _functions.end(); ++si) {
+    delete (*si).second;
+  }
+
+  SedScripts::iterator ssi;
+  for (ssi = _sed_scripts.begin(); ssi != _sed_scripts.end(); ++ssi) {
+    delete (*ssi).second;
+  }
+
+  if (_async_commands != (ShellCommandQueue *)NULL) {
+    delete _async_commands;
+  }
+
+  if (_output_queue != (PPOutputQueue *)NULL) {
+    delete _output_queue;
+  }
+  if (_search_cache != (PPSearchCache *)NULL) {
+    delete _search_cache;
+  }
+  if (_shell_cache != (PPShellCache *)NULL) {
+    delete _shell_cache;
+  }
+  if (_shell_coprocess != (ShellCoprocess *)NULL) {
+    delete _shell_coprocess;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::push_scope
+//       Access: Public
+//  Description: Pushes the indicated scope onto the top of the stack.
+//               When a variable reference is unresolved in the
+//               current scope, the scope stack is searched, in LIFO
+//               order.
+////////////////////////////////////////////////////////////////////
+void PPContext::
+push_scope(PPScope *scope) {
+  _scope_stack.push_back(scope);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::pop_scope
+//       Access: Public
+//  Description: Pops another level off the top of the stack.  See
+//               push_scope().
+////////////////////////////////////////////////////////////////////
+PPScope *PPContext::
+pop_scope() {
+  assert(!_scope_stack.empty());
+  PPScope *back = _scope_stack.back();
+  _scope_stack.pop_back();
+  return back;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_bottom_scope
+//       Access: Public
+//  Description: Returns the scope on the bottom of the stack.  This
+//               was the very first scope ever pushed, e.g. the global
+//               scope.
+////////////////////////////////////////////////////////////////////
+PPScope *PPContext::
+get_bottom_scope() const {
+  assert(!_scope_stack.empty());
+  return _scope_stack.front();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_enclosing_scope
+//       Access: Public
+//  Description: Returns the scope n below the top of the stack, or
+//               the bottom scope if the stack has exactly n or fewer
+//               scopes.
+//
+//               This will be the scope associated with the nth
+//               enclosing syntax in the source file.
+////////////////////////////////////////////////////////////////////
+PPScope *PPContext::
+get_enclosing_scope(int n) const {
+  assert(n >= 0);
+  if ((size_t)n >= _scope_stack.size()) {
+    return get_bottom_scope();
+  }
+  return _scope_stack[_scope_stack.size() - 1 - n];
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::define_sub
+//       Access: Public
+//  Description: Adds a subroutine to the list with the indicated
+//               name.  The subroutine pointer must have been recently
+//               allocated, and ownership of the pointer will be
+//               passed to the context; it may later delete it if
+//               another subroutine is defined with the same name.
+////////////////////////////////////////////////////////////////////
+void PPContext::
+define_sub(const string &name, PPSubroutine *sub) {
+  Subroutines::iterator si;
+  si = _subroutines.find(name);
+  if (si == _subroutines.end()) {
+    _subroutines.insert(Subroutines::value_type(name, sub));
+  } else {
+    delete (*si).second;
+    (*si).second = sub;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_sub
+//       Access: Public
+//  Description: Returns the previously-defined subroutine with the
+//               given name, or NULL if there is no such subroutine
+//               with that name.
+////////////////////////////////////////////////////////////////////
+const PPSubroutine *PPContext::
+get_sub(const string &name) const {
+  Subroutines::const_iterator si;
+  si = _subroutines.find(name);
+  if (si == _subroutines.end()) {
+    return NULL;
+  } else {
+    return (*si).second;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::define_func
+//       Access: Public
+//  Description: Adds a function to the list with the indicated name.
+//               This is similar to a subroutine except it is to be
+//               invoked via a variable reference, instead of by a
+//               #call function.  It cannot be shadowed by a local
+//               variable; it will always override any variable
+//               definition.
+//
+//               The subroutine pointer must have been recently
+//               allocated, and ownership of the pointer will be
+//               passed to the context; it may later delete it if
+//               another subroutine is defined with the same name.
+////////////////////////////////////////////////////////////////////
+void PPContext::
+define_func(const string &name, PPSubroutine *sub) {
+  Subroutines::iterator si;
+  si = _functions.find(name);
+  if (si == _functions.end()) {
+    _functions.insert(Subroutines::value_type(name, sub));
+  } else {
+    delete (*si).second;
+    (*si).second = sub;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_func
+//       Access: Public
+//  Description: Returns the previously-defined function with the
+//               given name, or NULL if there is no such function
+//               with that name.
+////////////////////////////////////////////////////////////////////
+const PPSubroutine *PPContext::
+get_func(const string &name) const {
+  Subroutines::const_iterator si;
+  si = _functions.find(name);
+  if (si == _functions.end()) {
+    return NULL;
+  } else {
+    return (*si).second;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::record_source_file
+//       Access: Public
+//  Description: Notes that the indicated file has been read as a
+//               script.  See get_source_files().
+////////////////////////////////////////////////////////////////////
+void PPContext::
+record_source_file(const Filename &filename) {
+  if (_source_file_set.insert(filename.get_fullpath()).second) {
+    _source_files.push_back(filename.get_fullpath());
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_output_queue
+//       Access: Public
+//  Description: Returns the queue through which this context's
+//               output files are written, creating it if necessary.
+////////////////////////////////////////////////////////////////////
+PPOutputQueue *PPContext::
+get_output_queue() {
+  if (_output_queue == (PPOutputQueue *)NULL) {
+    _output_queue = new PPOutputQueue;
+  }
+  return _output_queue;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_search_cache
+//       Access: Public
+//  Description: Returns the cache used by $[findfile] and the like,
+//               creating it if necessary.
+////////////////////////////////////////////////////////////////////
+PPSearchCache *PPContext::
+get_search_cache() {
+  if (_search_cache == (PPSearchCache *)NULL) {
+    _search_cache = new PPSearchCache;
+  }
+  return _search_cache;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_shell_cache
+//       Access: Public
+//  Description: Returns the cache of $[shell] results, creating it if
+//               necessary.
+////////////////////////////////////////////////////////////////////
+PPShellCache *PPContext::
+get_shell_cache() {
+  if (_shell_cache == (PPShellCache *)NULL) {
+    _shell_cache = new PPShellCache;
+  }
+  return _shell_cache;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::get_shell_coprocess
+//       Access: Public
+//  Description: Returns the shell to which $[shell] commands are fed
+//               when $[SHELL_COPROCESS] is defined, creating it if
+//               necessary.  The shell itself is not started until
+//               the first command is run.
+////////////////////////////////////////////////////////////////////
+ShellCoprocess *PPContext::
+get_shell_coprocess() {
+  if (_shell_coprocess == (ShellCoprocess *)NULL) {
+    _shell_coprocess = new ShellCoprocess;
+  }
+  return _shell_coprocess;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::freeze_scopes
+//       Access: Public
+//  Description: Freezes all of the scopes that exist now: the global
+//               scope, and the scopes read from Package.pp and each
+//               Sources.pp file.  While an Overlay is in effect,
+//               these scopes are no longer modified; see
+//               PPScope::Overlay.  Scopes created later are not
+//               frozen, unless this is called again.
+////////////////////////////////////////////////////////////////////
+void PPContext::
+freeze_scopes() {
+  _frozen_serial = PPScope::_next_serial;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::suspend_overlay
+//       Access: Public
+//  Description: Takes the current Overlay, if any, out of effect, so
+//               that changes are made to the frozen scopes
+//               themselves, e.g. while reading in more of the source
+//               tree.  Returns the Overlay, which must be handed
+//               back to resume_overlay() afterwards.
+////////////////////////////////////////////////////////////////////
+PPScope::Overlay *PPContext::
+suspend_overlay() {
+  PPScope::Overlay *overlay = _overlay;
+  _overlay = (PPScope::Overlay *)NULL;
+  ++_memo_epoch;
+  return overlay;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPContext::resume_overlay
+//       Access: Public
+//  Description: Puts back the Overlay taken out of effect by
+//               suspend_overlay().
+////////////////////////////////////////////////////////////////////
+void PPContext::
+resume_overlay(PPScope::Overlay *overlay) {
+  assert(_overlay == (PPScope::Overlay *)NULL);
+  _overlay = overlay;
+  ++_memo_epoch;
+}
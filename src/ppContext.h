@@ -0,0 +1,133 @@
+// Filename: ppContext.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPCONTEXT_H
+#define PPCONTEXT_H
+
+#include "ppremake.h"
+#include "ppScope.h"
+#include "filename.h"
+#include "vector_string.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+class PPDirectory;
+class PPOutputQueue;
+class PPSearchCache;
+class PPShellCache;
+class PPSubroutine;
+class SedProcess;
+class ShellCommandQueue;
+class ShellCoprocess;
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPContext
+// Description : The state of one evaluation of a source tree: the
+//               dynamic scope stack, the subroutines and functions
+//               defined with #defsub and #defun, the root of the
+//               source tree and the directory whose output is being
+//               generated, whether any errors have occurred, the
+//               search and shell caches, the queue of output files
+//               and the shell coprocess, and the bookkeeping behind
+//               #memo, the Overlays, $[shell-async] and $[sed].
+//
+//               Every PPScope belongs to one context, given when it
+//               is constructed, and a PPCommandFile works in the
+//               context of its scope.  Contexts share none of this
+//               state, so several may be evaluated at once on
+//               different threads, as long as each one is used by
+//               only one thread at a time.  The current directory,
+//               though, belongs to the whole process, so contexts
+//               that run at once must work in the same source tree.
+////////////////////////////////////////////////////////////////////
+class PPContext {
+public:
+  PPContext();
+  ~PPContext();
+
+  void push_scope(PPScope *scope);
+  PPScope *pop_scope();
+  PPScope *get_bottom_scope() const;
+  PPScope *get_enclosing_scope(int n) const;
+
+  void define_sub(const string &name, PPSubroutine *sub);
+  const PPSubroutine *get_sub(const string &name) const;
+  void define_func(const string &name, PPSubroutine *sub);
+  const PPSubroutine *get_func(const string &name) const;
+
+  INLINE void set_root(const string &root);
+  INLINE const string &get_root() const;
+
+  INLINE void set_output_directory(PPDirectory *directory);
+  INLINE PPDirectory *get_output_directory() const;
+
+  INLINE void set_errors_occurred();
+  INLINE void clear_errors_occurred();
+  INLINE bool get_errors_occurred() const;
+
+  INLINE DebugExpand &get_debug_expand();
+
+  void record_source_file(const Filename &filename);
+  INLINE const vector_string &get_source_files() const;
+
+  PPOutputQueue *get_output_queue();
+  PPSearchCache *get_search_cache();
+  PPShellCache *get_shell_cache();
+  ShellCoprocess *get_shell_coprocess();
+
+  void freeze_scopes();
+  PPScope::Overlay *suspend_overlay();
+  void resume_overlay(PPScope::Overlay *overlay);
+
+private:
+  typedef vector<PPScope *> ScopeStack;
+  ScopeStack _scope_stack;
+
+  typedef map<string, PPSubroutine *> Subroutines;
+  Subroutines _subroutines;
+  Subroutines _functions;
+
+  string _root;
+  PPDirectory *_output_directory;
+  bool _errors_occurred;
+  DebugExpand _debug_expand;
+
+  typedef set<string> SourceFileSet;
+  SourceFileSet _source_file_set;
+  vector_string _source_files;
+
+  // These are created the first time they are needed.
+  PPOutputQueue *_output_queue;
+  PPSearchCache *_search_cache;
+  PPShellCache *_shell_cache;
+  ShellCoprocess *_shell_coprocess;
+
+  // The rest is maintained by PPScope.
+  PPScope::MemoRecorder *_memo_recorder;
+
+  typedef set<string> MemoVariables;
+  MemoVariables _memo_variables;
+  typedef map<string, unsigned int> Generations;
+  Generations _generations;
+  unsigned int _next_generation;
+  unsigned int _memo_epoch;
+
+  // Scopes with a serial number up to this one are frozen.
+  int _frozen_serial;
+  PPScope::Overlay *_overlay;
+
+  ShellCommandQueue *_async_commands;
+
+  typedef map<string, SedProcess *> SedScripts;
+  SedScripts _sed_scripts;
+
+  friend class PPScope;
+};
+
+#include "ppContext.I"
+
+#endif
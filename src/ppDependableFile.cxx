@@ -4,10 +4,15 @@
 ////////////////////////////////////////////////////////////////////
 
 #include "ppDependableFile.h"
+#include "ppContext.h"
 #include "ppDirectory.h"
 #include "ppDirectoryTree.h"
 #include "filename.h"
 #include "check_include.h"
+#include "ppOutputQueue.h"
+#include "ppProfiler.h"
+#include "ppStats.h"
+#include "ppTrace.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -25,6 +30,13 @@ public:
   }
 };
 
+class SortDependableFilesByDirpath {
+public:
+  bool operator () (PPDependableFile *a, PPDependableFile *b) const {
+    return a->get_dirpath() < b->get_dirpath();
+  }
+};
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDependableFile::Ordering Operator
 //       Access: Public
@@ -50,6 +62,12 @@ PPDependableFile(PPDirectory *directory, const string &filename) :
 {
   _flags = 0;
   _mtime = 0;
+  _scc_order = 0;
+  _scc_lowlink = 0;
+
+  // Each file gets a dense index, so that sets of files may be
+  // represented compactly as sorted lists of integers.
+  _index = _directory->get_tree()->get_main_tree()->add_dependable_file(this);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -76,6 +94,11 @@ update_from_cache(const vector<string> &words) {
   if (!exists()) {
     // The file doesn't even exist; clearly the cache is bad.
     _flags |= F_bad_cache;
+    PPStats::count(PPStats::C_cache_stale);
+    if (explain) {
+      cerr << "Explain: " << get_fullpath()
+           << " is in the dependency cache, but no longer exists.\n";
+    }
 
   } else {
     // The second parameter is the cached modification time.
@@ -115,6 +138,16 @@ update_from_cache(const vector<string> &words) {
 
       _flags |= F_from_cache;
       sort(_dependencies.begin(), _dependencies.end());
+      PPStats::count(PPStats::C_files_from_cache);
+
+    } else {
+      PPStats::count(PPStats::C_cache_stale);
+      if (explain) {
+        cerr << "Explain: " << get_fullpath()
+             << " has been modified since it was cached (mtime "
+             << mtime << ", now " << get_mtime() << ").\n";
+        _flags |= F_explained;
+      }
     }
   }
 
@@ -129,7 +162,30 @@ update_from_cache(const vector<string> &words) {
 void PPDependableFile::
 clear_cache() {
   _dependencies.clear();
-  _flags &= ~(F_bad_cache | F_from_cache);
+  _extra_includes.clear();
+  _flags &= ~(F_bad_cache | F_from_cache | F_scanned);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::reset
+//       Access: Public
+//  Description: Forgets everything that has been learned about the
+//               file--whether it exists, when it was modified, and
+//               what it includes--so that it will be examined afresh,
+//               as if it had just been created.  This is called
+//               before the tree is processed again, since the file
+//               may have changed in the meantime.
+////////////////////////////////////////////////////////////////////
+void PPDependableFile::
+reset() {
+  _flags = 0;
+  _mtime = 0;
+  _circularity = string();
+  _closure.clear();
+  _scc_order = 0;
+  _scc_lowlink = 0;
+  _dependencies.clear();
+  _extra_includes.clear();
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -167,6 +223,20 @@ write_cache(ostream &out) {
   out << "\n";
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::get_index
+//       Access: Public
+//  Description: Returns the unique index number assigned to this
+//               file when it was created.  The dependable files of a
+//               source tree and its external dependable trees are
+//               numbered consecutively from 0; see
+//               PPDirectoryTree::get_dependable_file().
+////////////////////////////////////////////////////////////////////
+int PPDependableFile::
+get_index() const {
+  return _index;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDependableFile::get_directory
 //       Access: Public
@@ -194,9 +264,12 @@ get_filename() const {
 //  Description: Returns the relative pathname from the root of the
 //               source tree to this particular filename.
 ////////////////////////////////////////////////////////////////////
-string PPDependableFile::
+const string &PPDependableFile::
 get_pathname() const {
-  return _directory->get_path() + "/" + _filename;
+  if (_pathname.empty()) {
+    _pathname = _directory->get_path() + "/" + _filename;
+  }
+  return _pathname;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -204,9 +277,12 @@ get_pathname() const {
 //       Access: Public
 //  Description: Returns the full pathname to this particular filename.
 ////////////////////////////////////////////////////////////////////
-string PPDependableFile::
+const string &PPDependableFile::
 get_fullpath() const {
-  return _directory->get_fullpath() + "/" + _filename;
+  if (_fullpath.empty()) {
+    _fullpath = _directory->get_fullpath() + "/" + _filename;
+  }
+  return _fullpath;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -215,9 +291,32 @@ get_fullpath() const {
 //  Description: Returns an abbreviated pathname to this file, in the
 //               form dirname/filename.
 ////////////////////////////////////////////////////////////////////
-string PPDependableFile::
+const string &PPDependableFile::
 get_dirpath() const {
-  return _directory->get_dirname() + "/" + _filename;
+  if (_dirpath.empty()) {
+    _dirpath = _directory->get_dirname() + "/" + _filename;
+  }
+  return _dirpath;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::get_rel_filename
+//       Access: Public
+//  Description: Returns the relative pathname to this file from the
+//               indicated directory.  This is what $[dependencies]
+//               reports, for the output directory, so it is computed
+//               once for each directory that asks and then cached.
+////////////////////////////////////////////////////////////////////
+const string &PPDependableFile::
+get_rel_filename(const PPDirectory *from) const {
+  RelFilenames::iterator ri = _rel_filenames.find(from->get_index());
+  if (ri != _rel_filenames.end()) {
+    return (*ri).second;
+  }
+
+  string &result = _rel_filenames[from->get_index()];
+  result = from->get_rel_to(_directory) + "/" + _filename;
+  return result;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -278,33 +377,52 @@ get_dependency(int n) {
 ////////////////////////////////////////////////////////////////////
 void PPDependableFile::
 get_complete_dependencies(vector<PPDependableFile *> &files) {
-  set<PPDependableFile *> files_set;
-  get_complete_dependencies(files_set);
+  const vector<int> &closure = get_closure();
+  PPDirectoryTree *main_tree = _directory->get_tree()->get_main_tree();
 
-  copy(files_set.begin(), files_set.end(), back_inserter(files));
-  sort(files.begin(), files.end(), SortDependableFilesByName());
+  size_t start = files.size();
+  vector<int>::const_iterator ci;
+  for (ci = closure.begin(); ci != closure.end(); ++ci) {
+    files.push_back(main_tree->get_dependable_file(*ci));
+  }
+  sort(files.begin() + start, files.end(), SortDependableFilesByName());
 }
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDependableFile::get_complete_dependencies
 //       Access: Public
-//  Description: Recursively determines the complete set of files this
-//               file depends on.  It is the user's responsibility to
-//               empty the set before calling this function; the
-//               results will simply be added to the existing set.
+//  Description: Determines the complete set of files this file
+//               depends on.  It is the user's responsibility to empty
+//               the set before calling this function; the results
+//               will simply be added to the existing set.
 ////////////////////////////////////////////////////////////////////
 void PPDependableFile::
 get_complete_dependencies(set<PPDependableFile *> &files) {
-  update_dependencies();
-  Dependencies::const_iterator di;
-  for (di = _dependencies.begin(); di != _dependencies.end(); ++di) {
-    PPDependableFile *file = (*di)._file;
-    if (files.insert(file).second) {
-      file->get_complete_dependencies(files);
-    }
+  const vector<int> &closure = get_closure();
+  PPDirectoryTree *main_tree = _directory->get_tree()->get_main_tree();
+
+  vector<int>::const_iterator ci;
+  for (ci = closure.begin(); ci != closure.end(); ++ci) {
+    files.insert(main_tree->get_dependable_file(*ci));
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::get_closure
+//       Access: Public
+//  Description: Returns the complete set of files this file depends
+//               on, directly or indirectly, as a sorted list of file
+//               indices (see get_index()).  The list is computed along
+//               with the dependencies themselves, and cached, so that
+//               headers shared by many source files are only
+//               traversed once.
+////////////////////////////////////////////////////////////////////
+const vector<int> &PPDependableFile::
+get_closure() {
+  update_dependencies();
+  return _closure;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDependableFile::is_circularity
 //       Access: Public
@@ -355,10 +473,10 @@ was_cached() const {
 //     Function: PPDependableFile::update_dependencies
 //       Access: Private
 //  Description: Builds up the dependency list--the list of files this
-//               file depends on--if it hasn't already been built.  If
-//               a circular dependency is detected during this
-//               process, _circularity and _circularity_detected will
-//               be updated accordingly.
+//               file depends on--if it hasn't already been built,
+//               along with the dependency lists of all the files it
+//               depends on in turn.  Any circular dependencies
+//               detected during this process are recorded as well.
 ////////////////////////////////////////////////////////////////////
 void PPDependableFile::
 update_dependencies() {
@@ -367,133 +485,318 @@ update_dependencies() {
   }
 
   assert((_flags & F_updating) == 0);
-  string circularity;
-  compute_dependencies(circularity);
+  int next_order = 0;
+  Files stack;
+  r_update_dependencies(next_order, stack);
+  assert(stack.empty());
 }
 
 ////////////////////////////////////////////////////////////////////
-//     Function: PPDependableFile::compute_dependencies
+//     Function: PPDependableFile::r_update_dependencies
 //       Access: Private
-//  Description: Builds up the dependency list--the list of files this
-//               file depends on--if it hasn't already been built.
-//
-//               If a circularity is detected, e.g. two files depend
-//               on each other, a pointer to the offending file is
-//               returned and the string is updated to indicate the
-//               circularity.  Otherwise, if there is no circularity,
-//               NULL is returned.
+//  Description: The recursive implementation of
+//               update_dependencies().  This is Tarjan's
+//               strongly-connected-components algorithm over the
+//               #include graph.  Each component--a set of files that
+//               mutually include each other, or more commonly just a
+//               single file--is completed only after all of the
+//               components it depends on, so at that point we can
+//               validate its cache entries, report any circularities
+//               within it, and build its complete dependency list
+//               directly from the lists already computed for its
+//               dependencies.
 ////////////////////////////////////////////////////////////////////
-PPDependableFile *PPDependableFile::
-compute_dependencies(string &circularity) {
-  if ((_flags & F_updated) != 0) {
-    return (PPDependableFile *)NULL;
-
-  } else if ((_flags & F_updating) != 0) {
-    // Oh oh, a circular dependency!
-    circularity = get_dirpath();
-    return this;
-  }
+void PPDependableFile::
+r_update_dependencies(int &next_order, Files &stack) {
+  scan_dependencies();
 
+  _scc_order = next_order;
+  _scc_lowlink = next_order;
+  ++next_order;
   _flags |= F_updating;
+  stack.push_back(this);
 
-  if ((_flags & F_from_cache) == 0) {
-    // Now open the file and scan it for #include statements.
-    Filename filename(get_fullpath());
-    filename.set_text();
-    ifstream in;
-    if (!filename.open_read(in)) {
-      // Can't read the file, or the file doesn't exist.  Interesting.
-      if (exists()) {
-        cerr << "Warning: dependent file " << filename
-             << " exists but cannot be read.\n";
-      } else {
-        cerr << "Warning: dependent file " << filename
-             << " does not exist.\n";
-        _flags |= F_bad_cache;
-      }
+  Dependencies::const_iterator di;
+  for (di = _dependencies.begin(); di != _dependencies.end(); ++di) {
+    PPDependableFile *file = (*di)._file;
+    if ((file->_flags & (F_updated | F_updating)) == 0) {
+      file->r_update_dependencies(next_order, stack);
+      _scc_lowlink = min(_scc_lowlink, file->_scc_lowlink);
 
-    } else {
-      if (verbose) {
-        cerr << "Reading (dep) \"" << filename << "\"\n";
+    } else if ((file->_flags & F_updating) != 0) {
+      _scc_lowlink = min(_scc_lowlink, file->_scc_order);
+    }
+  }
+
+  if (_scc_lowlink != _scc_order) {
+    // We're part of a larger component, which will be completed by
+    // one of our callers.
+    return;
+  }
+
+  // This file is the root of a component; the component consists of
+  // all the files on the stack above (and including) this one.
+  Files::iterator begin = find(stack.begin(), stack.end(), this);
+  assert(begin != stack.end());
+  Files component(begin, stack.end());
+  stack.erase(begin, stack.end());
+
+  // If any file in the component, or any file it depends on, had a
+  // broken cache, then the cached dependencies within the component
+  // are suspect too.
+  bool bad_cache = false;
+  bool from_cache = false;
+  PPDependableFile *bad_file = (PPDependableFile *)NULL;
+  Files::iterator fi;
+  for (fi = component.begin(); fi != component.end(); ++fi) {
+    PPDependableFile *member = (*fi);
+    if ((member->_flags & F_bad_cache) != 0) {
+      bad_cache = true;
+      bad_file = member;
+    }
+    if ((member->_flags & F_from_cache) != 0) {
+      from_cache = true;
+    }
+    for (di = member->_dependencies.begin();
+         di != member->_dependencies.end();
+         ++di) {
+      if (((*di)._file->_flags & F_bad_cache) != 0) {
+        bad_cache = true;
+        bad_file = (*di)._file;
       }
-      PPDirectoryTree *tree = _directory->get_tree()->get_main_tree();
+    }
+  }
 
-      bool okcircular = false;
-      string line;
-      while (getline(in, line)) {
-        if (line.substr(0, 16) == "/* okcircular */") {
-          okcircular = true;
-        } else {
-          string filename = check_include(line);
-          if (!filename.empty() && filename.find('/') == string::npos) {
-            Dependency dep;
-            dep._okcircular = okcircular;
-            dep._file = tree->find_dependable_file(filename);
-            if (dep._file != (PPDependableFile *)NULL) {
-              // All right!  Here's a file we depend on.  Add it to the
-              // list.
-              _dependencies.push_back(dep);
-
-            } else {
-              // It's an include file from somewhere else, not from within
-              // our source tree.  We don't care about it, but we do need
-              // to record it so we can easily check later if the cache
-              // file has gone stale.
-              _extra_includes.push_back(filename);
-            }
-          }
-          okcircular = false;
+  if (bad_cache && from_cache) {
+    // Re-read the files to flush the cache, and then visit the
+    // component again from the top, since its shape may have changed.
+    for (fi = component.begin(); fi != component.end(); ++fi) {
+      PPDependableFile *member = (*fi);
+      if ((member->_flags & F_from_cache) != 0) {
+        if (verbose) {
+          cerr << "Dependency cache for \"" << member->get_fullpath()
+               << "\" is suspect.\n";
+        }
+        if (explain) {
+          cerr << "Explain: the cached dependencies of "
+               << member->get_fullpath() << " are suspect, because "
+               << bad_file->get_fullpath()
+               << ", which it includes directly or indirectly, has a bad"
+               << " cache entry.\n";
+          member->_flags |= F_explained;
         }
+        member->clear_cache();
+        PPStats::count(PPStats::C_cache_suspect);
       }
+      member->_flags &= ~F_updating;
     }
+
+    r_update_dependencies(next_order, stack);
+    return;
   }
 
-  // Now recursively expand all our dependent files, so we can check
-  // for circularities.
-  PPDependableFile *circ = (PPDependableFile *)NULL;
-
-  Dependencies::iterator di;
-  for (di = _dependencies.begin();
-       di != _dependencies.end() && circ == (PPDependableFile *)NULL;
-       ++di) {
-    // Skip this file if the user specifically marked it
-    // with an "okcircular" comment.
-    if (!(*di)._okcircular) {
-      circ = (*di)._file->compute_dependencies(circularity);
-      if (((*di)._file->_flags & F_bad_cache) != 0) {
-        // If our dependent file had a broken cache, our own cache is
-        // suspect.
-        _flags |= F_bad_cache;
+  vector<int> closure;
+  for (fi = component.begin(); fi != component.end(); ++fi) {
+    PPDependableFile *member = (*fi);
+    for (di = member->_dependencies.begin();
+         di != member->_dependencies.end();
+         ++di) {
+      PPDependableFile *file = (*di)._file;
+      closure.push_back(file->_index);
+      if ((file->_flags & F_updated) != 0) {
+        // This file belongs to a component we have already completed.
+        closure.insert(closure.end(), file->_closure.begin(),
+                       file->_closure.end());
       }
+    }
+  }
+
+  sort(closure.begin(), closure.end());
+  closure.erase(unique(closure.begin(), closure.end()), closure.end());
+
+  for (fi = component.begin(); fi != component.end(); ++fi) {
+    PPDependableFile *member = (*fi);
+    member->_closure = closure;
+    member->_flags = (member->_flags & ~F_updating) | F_updated;
+    if (bad_cache) {
+      member->_flags |= F_bad_cache;
+    }
+  }
 
-      if (circ != (PPDependableFile *)NULL) {
-        // Oops, a circularity.  Silly user.
-        circularity = get_dirpath() + " => " + circularity;
+  if (component.size() > 1 ||
+      binary_search(closure.begin(), closure.end(), _index)) {
+    find_circularities(component);
+  }
+}
 
-        if (circ == this) {
-          _flags |= F_circularity;
-          _circularity = circularity;
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::scan_dependencies
+//       Access: Private
+//  Description: Fills in the list of files this file directly depends
+//               on, by scanning the file for #include statements, if
+//               that list was not already read from the cache.
+////////////////////////////////////////////////////////////////////
+void PPDependableFile::
+scan_dependencies() {
+  if ((_flags & (F_scanned | F_from_cache)) != 0) {
+    return;
+  }
+  _flags |= F_scanned;
+  PPProfiler::Frame frame("scan", "dependencies");
+  PPStats::count(PPStats::C_files_scanned);
+  if (explain && (_flags & F_explained) == 0) {
+    cerr << "Explain: " << get_fullpath()
+         << " has no usable entry in the dependency cache.\n";
+  }
+  PPTrace::Span span("scan", get_fullpath());
+
+  // Now open the file and scan it for #include statements.
+  Filename filename(get_fullpath());
+  filename.set_text();
+  _directory->get_tree()->get_context()->get_output_queue()->wait_for(filename);
+  ifstream in;
+  if (!filename.open_read(in)) {
+    // Can't read the file, or the file doesn't exist.  Interesting.
+    if (exists()) {
+      cerr << "Warning: dependent file " << filename
+           << " exists but cannot be read.\n";
+    } else {
+      cerr << "Warning: dependent file " << filename
+           << " does not exist.\n";
+      _flags |= F_bad_cache;
+    }
+    return;
+  }
+
+  if (verbose) {
+    cerr << "Reading (dep) \"" << filename << "\"\n";
+  }
+  PPDirectoryTree *tree = _directory->get_tree()->get_main_tree();
+
+  bool okcircular = false;
+  string line;
+  while (getline(in, line)) {
+    if (line.substr(0, 16) == "/* okcircular */") {
+      okcircular = true;
+    } else {
+      string filename = check_include(line);
+      if (!filename.empty() && filename.find('/') == string::npos) {
+        Dependency dep;
+        dep._okcircular = okcircular;
+        dep._file = tree->find_dependable_file(filename);
+        if (dep._file != (PPDependableFile *)NULL) {
+          // All right!  Here's a file we depend on.  Add it to the
+          // list.
+          _dependencies.push_back(dep);
+
+        } else {
+          // It's an include file from somewhere else, not from within
+          // our source tree.  We don't care about it, but we do need
+          // to record it so we can easily check later if the cache
+          // file has gone stale.
+          _extra_includes.push_back(filename);
         }
       }
+      okcircular = false;
     }
   }
 
-  _flags = (_flags & ~F_updating) | F_updated;
   sort(_dependencies.begin(), _dependencies.end());
+}
 
-  if ((_flags & (F_bad_cache | F_from_cache)) == (F_bad_cache | F_from_cache)) {
-    // Our cache is suspect.  Re-read the file to flush the cache.
-    if (verbose) {
-      cerr << "Dependency cache for \"" << get_fullpath() << "\" is suspect.\n";
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::find_circularities
+//       Access: Private, Static
+//  Description: Called for each strongly-connected component of the
+//               #include graph that involves a cycle.  Files the user
+//               has marked with an "okcircular" comment are not
+//               considered part of a cycle, so this breaks the
+//               component down further into groups of files that
+//               mutually include each other without going through an
+//               okcircular #include.  Each such group is recorded
+//               once, on the file within it that sorts first.
+////////////////////////////////////////////////////////////////////
+void PPDependableFile::
+find_circularities(const Files &component) {
+  set<PPDependableFile *> members(component.begin(), component.end());
+
+  // First, determine which members each member can reach.
+  typedef map<PPDependableFile *, Reached> ReachedBy;
+  ReachedBy reached_by;
+  Files::const_iterator fi;
+  for (fi = component.begin(); fi != component.end(); ++fi) {
+    (*fi)->trace_includes(members, reached_by[*fi]);
+  }
+
+  // Now walk through the members in order by name, and collect each
+  // one that can reach itself together with all the other members in
+  // the same cycle.
+  Files sorted(component);
+  sort(sorted.begin(), sorted.end(), SortDependableFilesByDirpath());
+
+  set<PPDependableFile *> grouped;
+  for (fi = sorted.begin(); fi != sorted.end(); ++fi) {
+    PPDependableFile *file = (*fi);
+    const Reached &reached = reached_by[file];
+    if (grouped.count(file) != 0 || reached.count(file) == 0) {
+      continue;
+    }
+
+    Files::const_iterator gi;
+    for (gi = fi; gi != sorted.end(); ++gi) {
+      PPDependableFile *other = (*gi);
+      if (reached.count(other) != 0 && reached_by[other].count(file) != 0) {
+        grouped.insert(other);
+      }
     }
 
-    clear_cache();
-    _flags &= ~F_updated;
+    // Describe the shortest cycle through this file.  The reached
+    // map records, for each file, the file that includes it on the
+    // way from our starting file.
+    string circularity = file->get_dirpath();
+    PPDependableFile *prev = (*reached.find(file)).second;
+    while (prev != file) {
+      circularity = prev->get_dirpath() + " => " + circularity;
+      prev = (*reached.find(prev)).second;
+    }
+    circularity = file->get_dirpath() + " => " + circularity;
 
-    return compute_dependencies(circularity);
+    file->_flags |= F_circularity;
+    file->_circularity = circularity;
   }
+}
 
-  return circ;
+////////////////////////////////////////////////////////////////////
+//     Function: PPDependableFile::trace_includes
+//       Access: Private
+//  Description: Performs a breadth-first walk through the #include
+//               directives starting at this file, skipping over any
+//               marked okcircular and any files not within members.
+//               Each file reached is recorded in the map along with
+//               the file that included it.  This file itself appears
+//               in the map only if it includes itself, directly or
+//               indirectly.
+////////////////////////////////////////////////////////////////////
+void PPDependableFile::
+trace_includes(const set<PPDependableFile *> &members, Reached &reached) {
+  Files queue;
+  queue.push_back(this);
+  size_t qi = 0;
+  while (qi < queue.size()) {
+    PPDependableFile *file = queue[qi];
+    ++qi;
+
+    Dependencies::const_iterator di;
+    for (di = file->_dependencies.begin();
+         di != file->_dependencies.end();
+         ++di) {
+      PPDependableFile *dep = (*di)._file;
+      if (!(*di)._okcircular && members.count(dep) != 0 &&
+          reached.insert(Reached::value_type(dep, file)).second) {
+        queue.push_back(dep);
+      }
+    }
+  }
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -514,6 +817,8 @@ stat_file() {
   struct stat st;
   Filename pathname(get_fullpath());
   string ospath = pathname.to_os_specific();
+  _directory->get_tree()->get_context()->get_output_queue()->wait_for(pathname);
+  PPStats::count(PPStats::C_stats);
   if (stat(ospath.c_str(), &st) < 0) {
     // The file doesn't exist!
     return;
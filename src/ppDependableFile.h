@@ -8,6 +8,7 @@
 
 #include "ppremake.h"
 #include <set>
+#include <map>
 #include <vector>
 #include <time.h>
 
@@ -31,13 +32,17 @@ public:
   PPDependableFile(PPDirectory *directory, const string &filename);
   bool update_from_cache(const vector<string> &words);
   void clear_cache();
+  void reset();
   void write_cache(ostream &out);
 
+  int get_index() const;
+
   PPDirectory *get_directory() const;
   const string &get_filename() const;
-  string get_pathname() const;
-  string get_fullpath() const;
-  string get_dirpath() const;
+  const string &get_pathname() const;
+  const string &get_fullpath() const;
+  const string &get_dirpath() const;
+  const string &get_rel_filename(const PPDirectory *from) const;
 
   bool exists();
   time_t get_mtime();
@@ -47,6 +52,7 @@ public:
 
   void get_complete_dependencies(vector<PPDependableFile *> &files);
   void get_complete_dependencies(set<PPDependableFile *> &files);
+  const vector<int> &get_closure();
 
   bool is_circularity();
   string get_circularity();
@@ -55,12 +61,30 @@ public:
   bool was_cached() const;
 
 private:
+  typedef vector<PPDependableFile *> Files;
+  typedef map<PPDependableFile *, PPDependableFile *> Reached;
+
   void update_dependencies();
-  PPDependableFile *compute_dependencies(string &circularity);
+  void r_update_dependencies(int &next_order, Files &stack);
+  void scan_dependencies();
+  static void find_circularities(const Files &component);
+  void trace_includes(const set<PPDependableFile *> &members,
+                      Reached &reached);
   void stat_file();
 
   PPDirectory *_directory;
   string _filename;
+  int _index;
+
+  // These are computed as needed and cached.
+  mutable string _pathname;
+  mutable string _fullpath;
+  mutable string _dirpath;
+
+  // The relative pathname from each directory that has asked, keyed
+  // by the directory's index.
+  typedef map<int, string> RelFilenames;
+  mutable RelFilenames _rel_filenames;
 
   enum Flags {
     F_updating    = 0x001,
@@ -70,11 +94,21 @@ private:
     F_exists      = 0x010,
     F_from_cache  = 0x020,
     F_bad_cache   = 0x040,
+    F_scanned     = 0x080,
+    F_explained   = 0x100,
   };
   int _flags;
   string _circularity;
   time_t _mtime;
 
+  // The transitive closure of _dependencies, as a sorted list of
+  // file indices.  This is computed once per file, one
+  // strongly-connected component at a time, by
+  // r_update_dependencies().
+  vector<int> _closure;
+  int _scc_order;
+  int _scc_lowlink;
+
   class Dependency {
   public:
     PPDependableFile *_file;
@@ -6,9 +6,14 @@
 #include "ppDirectory.h"
 #include "ppDirectoryTree.h"
 #include "ppScope.h"
+#include "ppContext.h"
 #include "ppNamedScopes.h"
 #include "ppCommandFile.h"
 #include "ppDependableFile.h"
+#include "ppModelDependencyCache.h"
+#include "ppProfiler.h"
+#include "ppStats.h"
+#include "shellCommand.h"
 #include "tokenize.h"
 #include "ppremake.h"
 
@@ -38,7 +43,7 @@
 // How new must a pp.dep cache file be before we will believe it?
 static const int max_cache_minutes = 60;
 
-PPDirectory *current_output_directory = (PPDirectory *)NULL;
+atomic<int> PPDirectory::_next_index(0);
 
 // An STL object to sort directories in order by dependency and then
 // by name, used in get_child_dirnames().
@@ -66,10 +71,14 @@ PPDirectory(PPDirectoryTree *tree) {
   _depth = 0;
   _depends_index = 0;
   _computing_depends_index = false;
+  _source_read = false;
+  _depends_read = false;
   _model_dependencies_updated = false;
   _read_model_dependency_cache = false;
+  _index = _next_index++;
 
   _dirname = "top";
+  _path = ".";
   _tree->_dirnames.insert(PPDirectoryTree::Dirnames::value_type(_dirname, this));
 }
 
@@ -92,8 +101,17 @@ PPDirectory(const string &dirname, PPDirectory *parent) :
   _depth = _parent->_depth + 1;
   _depends_index = 0;
   _computing_depends_index = false;
+  _source_read = false;
+  _depends_read = false;
   _model_dependencies_updated = false;
   _read_model_dependency_cache = false;
+  _index = _next_index++;
+
+  if (_parent->_parent == (PPDirectory *)NULL) {
+    _path = _dirname;
+  } else {
+    _path = _parent->_path + "/" + _dirname;
+  }
 
   bool inserted =
     _tree->_dirnames.insert(PPDirectoryTree::Dirnames::value_type(_dirname, this)).second;
@@ -107,10 +125,17 @@ PPDirectory(const string &dirname, PPDirectory *parent) :
 //     Function: PPDirectory::Destructor
 //       Access: Public
 //  Description: When a tree root destructs, all of its children are
-//               also destroyed.
+//               also destroyed, along with the command file read from
+//               each one's Sources.pp.  The directory's scope belongs
+//               to the PPNamedScopes that made it, and its
+//               dependable files to the main tree.
 ////////////////////////////////////////////////////////////////////
 PPDirectory::
 ~PPDirectory() {
+  if (_source != (PPCommandFile *)NULL) {
+    delete _source;
+  }
+
   Children::iterator ci;
   for (ci = _children.begin(); ci != _children.end(); ++ci) {
     delete (*ci);
@@ -172,6 +197,18 @@ get_depends_index() const {
   return _depends_index;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::get_index
+//       Access: Public
+//  Description: Returns the unique index number assigned to this
+//               directory when it was created.  All directories, in
+//               all trees, are numbered consecutively from 0.
+////////////////////////////////////////////////////////////////////
+int PPDirectory::
+get_index() const {
+  return _index;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectory::get_path
 //       Access: Public
@@ -179,15 +216,9 @@ get_depends_index() const {
 //               particular directory.  This does not include the root
 //               name itself, and does not include a trailing slash.
 ////////////////////////////////////////////////////////////////////
-string PPDirectory::
+const string &PPDirectory::
 get_path() const {
-  if (_parent == (PPDirectory *)NULL) {
-    return ".";
-  }
-  if (_parent->_parent == (PPDirectory *)NULL) {
-    return _dirname;
-  }
-  return _parent->get_path() + "/" + _dirname;
+  return _path;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -196,12 +227,18 @@ get_path() const {
 //  Description: Returns the full path to this particular directory.
 //               This does not include a trailing slash.
 ////////////////////////////////////////////////////////////////////
-string PPDirectory::
+const string &PPDirectory::
 get_fullpath() const {
-  if (_parent == (PPDirectory *)NULL) {
-    return _tree->get_fullpath();
+  if (_fullpath.empty()) {
+    // We can't compute this in the constructor, since the tree's
+    // fullpath might not have been set yet.
+    if (_parent == (PPDirectory *)NULL) {
+      _fullpath = _tree->get_fullpath();
+    } else {
+      _fullpath = _tree->get_fullpath() + "/" + _path;
+    }
   }
-  return _tree->get_fullpath() + "/" + get_path();
+  return _fullpath;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -209,46 +246,75 @@ get_fullpath() const {
 //       Access: Public
 //  Description: Returns the relative path to the other directory from
 //               this one.  This does not include a trailing slash.
+//
+//               The result is cached by the other directory's index,
+//               so repeated queries for the same pair of directories
+//               return the same string.
 ////////////////////////////////////////////////////////////////////
-string PPDirectory::
+const string &PPDirectory::
 get_rel_to(const PPDirectory *other) const {
+  RelTo::iterator ri = _rel_to.find(other->_index);
+  if (ri != _rel_to.end()) {
+    return (*ri).second;
+  }
+
+  string &result = _rel_to[other->_index];
+
   const PPDirectory *a = this;
   const PPDirectory *b = other;
 
   if (a == b) {
-    return ".";
-  }
+    result = ".";
 
-  if (a->_tree != b->_tree) {
+  } else if (a->_tree != b->_tree) {
     // If they're in different trees, just return the full path to b.
-    return b->get_fullpath();
-  }
+    result = b->get_fullpath();
 
-  string prefix, postfix;
-  while (a->_depth > b->_depth) {
-    prefix += "../";
-    a = a->_parent;
-    assert(a != (PPDirectory *)NULL);
-  }
+  } else {
+    // Walk both directories up to their lowest common ancestor.  The
+    // result is one "../" for each level we walked up from this
+    // directory, followed by the path from the ancestor down to the
+    // other directory, which is just the tail of its path.
+    int up = 0;
+    while (a->_depth > b->_depth) {
+      a = a->_parent;
+      ++up;
+    }
+    while (b->_depth > a->_depth) {
+      b = b->_parent;
+    }
+    while (a != b) {
+      a = a->_parent;
+      b = b->_parent;
+      ++up;
+      assert(a != (PPDirectory *)NULL);
+      assert(b != (PPDirectory *)NULL);
+    }
 
-  while (b->_depth > a->_depth) {
-    postfix = b->_dirname + "/" + postfix;
-    b = b->_parent;
-    assert(b != (PPDirectory *)NULL);
-  }
+    const PPDirectory *ancestor = a;
+    string postfix;
+    if (ancestor == other) {
+      // No postfix; the other directory is above this one.
+    } else if (ancestor->_parent == (PPDirectory *)NULL) {
+      postfix = other->_path;
+    } else {
+      postfix = other->_path.substr(ancestor->_path.length() + 1);
+    }
 
-  while (a != b) {
-    prefix += "../";
-    postfix = b->_dirname + "/" + postfix;
-    a = a->_parent;
-    b = b->_parent;
-    assert(a != (PPDirectory *)NULL);
-    assert(b != (PPDirectory *)NULL);
+    result.reserve(up * 3 + postfix.length());
+    for (int i = 0; i < up; ++i) {
+      result += "../";
+    }
+    if (postfix.empty()) {
+      // Remove the trailing slash.
+      result.erase(result.length() - 1);
+    } else {
+      result += postfix;
+    }
   }
 
-  string result = prefix + postfix;
   assert(!result.empty());
-  return result.substr(0, result.length() - 1);
+  return result;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -374,7 +440,7 @@ get_dependable_file(const string &filename, bool is_header) {
         cerr << "Error: header file " << dependable->get_fullpath()
              << " may be confused with " << other->get_fullpath()
              << ".\n";
-        errors_occurred = true;
+        _tree->get_context()->set_errors_occurred();
 
       } else if (other->get_directory()->get_tree() != _tree) {
         // This file is a source file in this tree, while the other
@@ -387,7 +453,7 @@ get_dependable_file(const string &filename, bool is_header) {
         cerr << "Error: source file " << dependable->get_pathname()
              << " may be confused with " << other->get_pathname()
              << ".\n";
-        errors_occurred = true;
+        _tree->get_context()->set_errors_occurred();
       }
     }
   }
@@ -458,6 +524,7 @@ r_scan(const string &prefix) {
 
   // Collect all the filenames in the directory in this vector first.
   vector<string> filenames;
+  PPStats::count(PPStats::C_dirs_listed);
   if (!root_name.scan_directory(filenames)) {
     cerr << "Unable to scan directory " << root_name << "\n";
     return false;
@@ -472,6 +539,7 @@ r_scan(const string &prefix) {
       // within it?
       string next_prefix = prefix + filename + "/";
       Filename source_filename = next_prefix + SOURCE_FILENAME;
+      PPStats::count(PPStats::C_stats);
       if (source_filename.exists()) {
         PPDirectory *subtree = new PPDirectory(filename, this);
 
@@ -499,6 +567,7 @@ scan_extra_depends(const string &cache_filename) {
   Filename root_name = get_fullpath();
 
   vector<string> filenames;
+  PPStats::count(PPStats::C_dirs_listed);
   if (!root_name.scan_directory(filenames)) {
     cerr << "Unable to scan directory " << root_name << "\n";
     return false;
@@ -530,6 +599,37 @@ scan_extra_depends(const string &cache_filename) {
 ////////////////////////////////////////////////////////////////////
 bool PPDirectory::
 read_source_file(const string &prefix, PPNamedScopes *named_scopes) {
+  if (!load_source_file(prefix, named_scopes)) {
+    return false;
+  }
+
+  Children::iterator ci;
+  for (ci = _children.begin(); ci != _children.end(); ++ci) {
+    if (!(*ci)->read_source_file(prefix + (*ci)->get_dirname() + "/",
+                                  named_scopes)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::load_source_file
+//       Access: Private
+//  Description: Reads in the source file for this directory only, if
+//               it is defined and has not already been read.  The
+//               prefix is the path to this directory from the root
+//               of the tree, with a trailing slash (or empty for the
+//               root itself).
+////////////////////////////////////////////////////////////////////
+bool PPDirectory::
+load_source_file(const string &prefix, PPNamedScopes *named_scopes) {
+  if (_source_read) {
+    return true;
+  }
+  _source_read = true;
+
   Filename source_filename = prefix + SOURCE_FILENAME;
   source_filename.set_text();
 
@@ -538,6 +638,9 @@ read_source_file(const string &prefix, PPNamedScopes *named_scopes) {
     if (verbose) {
       cerr << "Reading (dir) \"" << source_filename << "\"\n";
     }
+    _tree->get_context()->record_source_file(source_filename);
+    PPStats::count(PPStats::C_source_files);
+    PPProfiler::Frame frame("dir", get_path());
 
     named_scopes->set_current(_dirname);
     _scope = named_scopes->make_scope("");
@@ -557,10 +660,24 @@ read_source_file(const string &prefix, PPNamedScopes *named_scopes) {
     }
   }
 
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::read_depends_file
+//       Access: Private
+//  Description: Recursively reads in the dependency definition file
+//               for each source file.
+////////////////////////////////////////////////////////////////////
+bool PPDirectory::
+read_depends_file(PPNamedScopes *named_scopes) {
+  if (!load_depends_file(named_scopes)) {
+    return false;
+  }
+
   Children::iterator ci;
   for (ci = _children.begin(); ci != _children.end(); ++ci) {
-    if (!(*ci)->read_source_file(prefix + (*ci)->get_dirname() + "/",
-                                  named_scopes)) {
+    if (!(*ci)->read_depends_file(named_scopes)) {
       return false;
     }
   }
@@ -569,13 +686,19 @@ read_source_file(const string &prefix, PPNamedScopes *named_scopes) {
 }
 
 ////////////////////////////////////////////////////////////////////
-//     Function: PPDirectory::read_depends_file
+//     Function: PPDirectory::load_depends_file
 //       Access: Private
-//  Description: Recursively reads in the dependency definition file
-//               for each source file.
+//  Description: Reads in the dependency definition file for this
+//               directory only, if it has a source file and the
+//               dependency file has not already been read.
 ////////////////////////////////////////////////////////////////////
 bool PPDirectory::
-read_depends_file(PPNamedScopes *named_scopes) {
+load_depends_file(PPNamedScopes *named_scopes) {
+  if (_depends_read) {
+    return true;
+  }
+  _depends_read = true;
+
   if (_scope != (PPScope *)NULL) {
     // Read the depends file, so we can determine the relationship
     // between this source file and all of the other source files.
@@ -587,7 +710,7 @@ read_depends_file(PPNamedScopes *named_scopes) {
     }
 
     named_scopes->set_current(_dirname);
-    current_output_directory = this;
+    _tree->get_context()->set_output_directory(this);
     PPCommandFile depends(_scope);
     if (!depends.read_file(depends_filename)) {
       cerr << "Error reading dependency definition file "
@@ -626,13 +749,6 @@ read_depends_file(PPNamedScopes *named_scopes) {
     }
   }
 
-  Children::iterator ci;
-  for (ci = _children.begin(); ci != _children.end(); ++ci) {
-    if (!(*ci)->read_depends_file(named_scopes)) {
-      return false;
-    }
-  }
-
   return true;
 }
 
@@ -663,12 +779,24 @@ resolve_dependencies() {
   // Now that we've resolved all of our children's dependencies,
   // redefine our SUBDIRS and SUBTREE variables to put things in the
   // right order.
+  update_subdirs();
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::update_subdirs
+//       Access: Private
+//  Description: Redefines the SUBDIRS and SUBTREE variables for this
+//               directory, once the dependency order of its children
+//               is known.
+////////////////////////////////////////////////////////////////////
+void PPDirectory::
+update_subdirs() {
   if (_scope != (PPScope *)NULL) {
     _scope->define_variable("SUBDIRS", get_child_dirnames());
     _scope->define_variable("SUBTREE", get_complete_subtree());
   }
-
-  return true;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -724,6 +852,16 @@ compute_depends_index() {
 ////////////////////////////////////////////////////////////////////
 void PPDirectory::
 read_file_dependencies(const string &cache_filename) {
+  if (_tree->_lazy && !_source_read) {
+    // In a lazy run, a directory we haven't read doesn't need its
+    // cache either.
+    Children::iterator ci;
+    for (ci = _children.begin(); ci != _children.end(); ++ci) {
+      (*ci)->read_file_dependencies(cache_filename);
+    }
+    return;
+  }
+
   // Open up the dependency cache file in the directory.
   Filename cache_pathname(get_fullpath(), cache_filename);
   cache_pathname.set_text();
@@ -746,6 +884,7 @@ read_file_dependencies(const string &cache_filename) {
   struct stat this_buf;
   bool this_exists = false;
 
+  PPStats::count(PPStats::C_stats);
   if (stat(os_specific.c_str(), &this_buf) == 0) {
     this_exists = true;
   }
@@ -756,12 +895,22 @@ read_file_dependencies(const string &cache_filename) {
     if (verbose) {
       cerr << "No cache file: \"" << cache_pathname << "\"\n";
     }
+    if (explain) {
+      cerr << "Explain: there is no dependency cache " << cache_pathname
+           << ".\n";
+    }
 
   } else if (this_buf.st_mtime < now - 60 * max_cache_minutes) {
     // It exists, but it's too old.
     if (verbose) {
       cerr << "Cache file too old: \"" << cache_pathname << "\"\n";
     }
+    if (explain) {
+      cerr << "Explain: the dependency cache " << cache_pathname << " is "
+           << (now - this_buf.st_mtime) / 60
+           << " minutes old, older than the limit of " << max_cache_minutes
+           << "; ignoring it.\n";
+    }
 
   } else {
     // It exists and is new enough; use it.
@@ -802,6 +951,10 @@ read_file_dependencies(const string &cache_filename) {
         if (verbose) {
           cerr << "Cache \"" << cache_pathname << "\" is stale.\n";
         }
+        if (explain) {
+          cerr << "Explain: discarding the rest of the dependency cache "
+               << cache_pathname << ".\n";
+        }
         Dependables::iterator di;
         for (di = _dependables.begin(); di != _dependables.end(); ++di) {
           (*di).second->clear_cache();
@@ -816,6 +969,31 @@ read_file_dependencies(const string &cache_filename) {
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::reset_file_dependencies
+//       Access: Private
+//  Description: Recursively forgets what has been learned about the
+//               source files and model files in each directory, so
+//               that they will be examined afresh, and the dependency
+//               caches read again, when the tree is next processed.
+////////////////////////////////////////////////////////////////////
+void PPDirectory::
+reset_file_dependencies() {
+  Dependables::iterator di;
+  for (di = _dependables.begin(); di != _dependables.end(); ++di) {
+    (*di).second->reset();
+  }
+
+  _dependable_models.clear();
+  _model_dependencies_updated = false;
+  _read_model_dependency_cache = false;
+
+  Children::iterator ci;
+  for (ci = _children.begin(); ci != _children.end(); ++ci) {
+    (*ci)->reset_file_dependencies();
+  }
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectory::update_file_dependencies
 //       Access: Private
@@ -825,7 +1003,11 @@ read_file_dependencies(const string &cache_filename) {
 ////////////////////////////////////////////////////////////////////
 void PPDirectory::
 update_file_dependencies(const string &cache_filename) {
-  if (dry_run) {
+  if (_tree->_lazy && !_source_read) {
+    // In a lazy run, leave the cache of a directory we never read
+    // alone; we learned nothing new about it.
+
+  } else if (dry_run) {
     // If this is just a dry run, just report circularities.
     Dependables::const_iterator di;
     for (di = _dependables.begin(); di != _dependables.end(); ++di) {
@@ -966,47 +1148,177 @@ show_directories(const PPDirectory::Depends &dep) const {
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectory::get_depended_models
 //       Access: Public
-//  Description:
+//  Description: Returns the list of model files that the indicated
+//               model file (relative to this directory) depends on.
+//               This is read from the model dependency cache if it is
+//               still current, or determined by running
+//               $[MODEL_DEPENDS_COMMAND] on the file if not.
 ////////////////////////////////////////////////////////////////////
 const vector_string &PPDirectory::
 get_depended_models(const string &str_filename) {
   read_model_dependency_cache();
 
   Filename filename(str_filename);
-  Filename fullpath(get_fullpath(), str_filename);
+  if (is_model_dependency_stale(filename)) {
+    vector_string filenames;
+    filenames.push_back(str_filename);
+    refresh_depended_models(filenames);
+  }
 
   DependableModels::const_iterator it = _dependable_models.find(filename);
-  if (it != _dependable_models.end()) {
-    const PPDependableModelFile &dmfile = (*it).second;
-    if (dmfile._timestamp >= fullpath.get_timestamp()) {
-      // Our dependency cache is still valid, return that.
-      return dmfile._dependencies;
+  if (it == _dependable_models.end()) {
+    // The command failed, so we have nothing to report.
+    static const vector_string no_dependencies;
+    return no_dependencies;
+  }
+  return (*it).second._dependencies;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::refresh_depended_models
+//       Access: Public
+//  Description: Ensures the model dependencies are current for all of
+//               the indicated model files (relative to this
+//               directory).  Those files that are not in the model
+//               dependency cache, or have been modified since they
+//               were cached, are collected together and handed to
+//               $[MODEL_DEPENDS_COMMAND] in batches of up to
+//               $[MODEL_DEPENDS_BATCH_SIZE] files per process, with up
+//               to $[MODEL_DEPENDS_JOBS] processes running at once.
+//
+//               If the batch size is 1 (the default), the command is
+//               run with a single filename and its entire output is
+//               taken as that file's list of dependencies.  If it is
+//               larger, the command may be run with several
+//               filenames, and it must write "filename:" before the
+//               list of dependencies for each one.
+//
+//               If the command fails for a batch, a warning is
+//               printed and those files are left out of the cache,
+//               so that they are tried again on the next run (but
+//               not again in this one).
+////////////////////////////////////////////////////////////////////
+void PPDirectory::
+refresh_depended_models(const vector_string &filenames) {
+  read_model_dependency_cache();
+
+  // First, collect the stale files, in order, without duplicates.
+  vector_string stale;
+  set<string> seen;
+  vector_string::const_iterator fi;
+  for (fi = filenames.begin(); fi != filenames.end(); ++fi) {
+    Filename filename(*fi);
+    string reason;
+    if (seen.insert(filename).second &&
+        _failed_models.count(filename) == 0 &&
+        is_model_dependency_stale(filename, explain ? &reason : NULL)) {
+      cerr << "Refreshing model dependencies for " << filename << "\n";
+      if (explain) {
+        cerr << "Explain: " << reason << "\n";
+      }
+      stale.push_back(filename);
     }
   }
 
-  cerr << "Refreshing model dependencies for " << filename << "\n";
+  if (stale.empty()) {
+    return;
+  }
+
+  string tool = trim_blanks(_scope->expand_variable("MODEL_DEPENDS_COMMAND"));
+  if (tool.empty()) {
+    tool = "asset-list-depends";
+  }
 
-  // If we got here, we either don't have a cache entry for this file,
-  // or the file was modified since the last time we determined
-  // dependencies for this file.
+  int batch_size = atoi(_scope->expand_variable("MODEL_DEPENDS_BATCH_SIZE").c_str());
+  if (batch_size < 1) {
+    batch_size = 1;
+  }
 
-  // TODO: Make the program run to report the dependencies configurable.
-  // Maybe make the user define a function that takes in the source filename, allowing
-  // the user to return whatever they want.
-  string depends = _scope->expand_string("$[shell asset-list-depends " + filename.get_fullpath() + "]");
-  if (verbose) {
-    cerr << filename.get_fullpath() << " dependencies: " << depends << "\n";
+  int max_jobs = atoi(_scope->expand_variable("MODEL_DEPENDS_JOBS").c_str());
+  if (max_jobs < 1) {
+    max_jobs = ShellCommand::get_default_jobs();
   }
 
-  PPDependableModelFile dmfile;
-  dmfile._filename = filename;
-  dmfile._timestamp = fullpath.get_timestamp();
-  tokenize_whitespace(depends, dmfile._dependencies);
-  _dependable_models[filename] = move(dmfile);
+  // Build up the list of commands, one for each batch of files.
+  vector<ShellCommand *> commands;
+  size_t si;
+  for (si = 0; si < stale.size(); si += batch_size) {
+    string command = tool;
+    size_t end = min(si + batch_size, stale.size());
+    for (size_t i = si; i < end; ++i) {
+      command += " " + ShellCommand::quote(stale[i]);
+    }
+    commands.push_back(new ShellCommand(command, get_fullpath()));
+  }
+
+  // If any of the commands couldn't be run, its exit status says so;
+  // that is reported along with the others below.
+  ShellCommand::run_all(commands, max_jobs);
+
+  // Now record the results.  We walk through the batches in order,
+  // so the results don't depend on the order the commands finished.
+  for (si = 0; si < stale.size(); si += batch_size) {
+    ShellCommand *command = commands[si / batch_size];
+    if (command->get_exit_status() != 0) {
+      // Don't record whatever it managed to print; the files are
+      // still stale, and will be tried again next time.
+      cerr << "Warning: model dependency command failed: "
+           << command->get_command() << "\n";
+      size_t end = min(si + batch_size, stale.size());
+      _failed_models.insert(stale.begin() + si, stale.begin() + end);
+      delete command;
+      continue;
+    }
 
-  _model_dependencies_updated = true;
+    vector_string words;
+    tokenize_whitespace(command->get_output(), words);
+
+    size_t end = min(si + batch_size, stale.size());
+    map<string, vector_string> depends;
+    if (end - si == 1 &&
+        (words.empty() || words[0] != stale[si] + ":")) {
+      // Only one file in this batch, and the command didn't label
+      // its output; it all belongs to that file.
+      depends[stale[si]] = words;
+
+    } else {
+      // Each file's dependencies are introduced by "filename:".
+      vector_string *current = (vector_string *)NULL;
+      vector_string::const_iterator wi;
+      for (wi = words.begin(); wi != words.end(); ++wi) {
+        const string &word = (*wi);
+        if (!word.empty() && word[word.length() - 1] == ':' &&
+            find(stale.begin() + si, stale.begin() + end,
+                 word.substr(0, word.length() - 1)) != stale.begin() + end) {
+          current = &depends[word.substr(0, word.length() - 1)];
+        } else if (current != (vector_string *)NULL) {
+          current->push_back(word);
+        } else {
+          cerr << "Unexpected output from " << command->get_command()
+               << ": " << word << "\n";
+        }
+      }
+    }
 
-  return _dependable_models[filename]._dependencies;
+    for (size_t i = si; i < end; ++i) {
+      Filename filename(stale[i]);
+      Filename fullpath(get_fullpath(), filename);
+
+      PPDependableModelFile dmfile;
+      dmfile._filename = filename;
+      dmfile._timestamp = fullpath.get_timestamp();
+      dmfile._mtime = dmfile._timestamp;
+      dmfile._dependencies = depends[stale[i]];
+      if (verbose) {
+        cerr << filename.get_fullpath() << " dependencies: "
+             << repaste(dmfile._dependencies, " ") << "\n";
+      }
+      _dependable_models[filename] = move(dmfile);
+    }
+    _model_dependencies_updated = true;
+
+    delete command;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -1020,6 +1332,17 @@ write_model_dependency_cache() {
     return;
   }
 
+  string tree_cache_filename =
+    trim_blanks(_scope->expand_variable("MODEL_DEPENDENCY_TREE_CACHE_FILENAME"));
+  if (!tree_cache_filename.empty()) {
+    // Record our changes in the tree-wide cache instead; the tree
+    // will write it out once all directories have been visited.
+    PPModelDependencyCache *cache =
+      _tree->get_model_dependency_cache(tree_cache_filename);
+    cache->set_models(get_path(), _dependable_models);
+    return;
+  }
+
   Filename cache_filename(get_fullpath(), _scope->expand_variable("MODEL_DEPENDENCY_CACHE_FILENAME"));
   if (cache_filename.empty()) {
     return;
@@ -1057,6 +1380,49 @@ r_write_model_dependency_cache() {
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::is_model_dependency_stale
+//       Access: Private
+//  Description: Returns true if the indicated model file has no entry
+//               in the model dependency cache, or if it has been
+//               modified since its entry was recorded.
+//
+//               If reason is not NULL and the file is stale, a
+//               sentence saying why is stored there, for --explain.
+////////////////////////////////////////////////////////////////////
+bool PPDirectory::
+is_model_dependency_stale(const Filename &filename, string *reason) const {
+  DependableModels::const_iterator it = _dependable_models.find(filename);
+  if (it == _dependable_models.end()) {
+    if (reason != (string *)NULL) {
+      *reason = filename.get_fullpath() +
+        " is not in the model dependency cache.";
+    }
+    return true;
+  }
+
+  const PPDependableModelFile &dmfile = (*it).second;
+  time_t mtime = dmfile._mtime;
+  if (mtime == 0) {
+    // We don't already know the file's modification time.
+    Filename fullpath(get_fullpath(), filename);
+    mtime = fullpath.get_timestamp();
+  }
+
+  if (dmfile._timestamp >= mtime) {
+    return false;
+  }
+
+  if (reason != (string *)NULL) {
+    ostringstream strm;
+    strm << filename << " was modified " << (mtime - dmfile._timestamp)
+         << " seconds after its dependencies were cached (mtime "
+         << mtime << ", cached " << dmfile._timestamp << ").";
+    *reason = strm.str();
+  }
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectory::read_model_dependency_cache
 //       Access: Public
@@ -1069,17 +1435,51 @@ read_model_dependency_cache() {
   }
 
   _read_model_dependency_cache = true;
+
+  string tree_cache_filename =
+    trim_blanks(_scope->expand_variable("MODEL_DEPENDENCY_TREE_CACHE_FILENAME"));
+  if (!tree_cache_filename.empty()) {
+    // All directories share a single cache file.
+    PPModelDependencyCache *cache =
+      _tree->get_model_dependency_cache(tree_cache_filename);
+    cache->get_models(get_path(), get_fullpath(), _dependable_models);
+
+  } else if (!read_model_dependency_cache_file()) {
+    return;
+  }
+
+  // Now that we know which files we're interested in, refresh all of
+  // the out-of-date entries at once, rather than one at a time as
+  // they are asked for.
+  vector_string filenames;
+  DependableModels::const_iterator it;
+  for (it = _dependable_models.begin(); it != _dependable_models.end(); ++it) {
+    filenames.push_back((*it).first);
+  }
+  refresh_depended_models(filenames);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectory::read_model_dependency_cache_file
+//       Access: Private
+//  Description: Reads the per-directory model dependency cache file,
+//               named by $[MODEL_DEPENDENCY_CACHE_FILENAME].  Returns
+//               true if the file was read (or is simply absent),
+//               false if something went wrong.
+////////////////////////////////////////////////////////////////////
+bool PPDirectory::
+read_model_dependency_cache_file() {
   Filename cache_filename(get_fullpath(), _scope->expand_variable("MODEL_DEPENDENCY_CACHE_FILENAME"));
   if (cache_filename.empty()) {
     cerr << "MODEL_DEPENDENCY_CACHE_FILENAME was not specified!\n";
-    errors_occurred = true;
-    return;
+    _tree->get_context()->set_errors_occurred();
+    return false;
   }
   cache_filename.set_text();
 
   if (!cache_filename.is_regular_file()) {
     // Don't have a cache file here.
-    return;
+    return true;
   }
 
   std::ifstream buf;
@@ -1117,8 +1517,8 @@ read_model_dependency_cache() {
         // strtoll failed--not an integer.
         cerr << "Error when reading model dependency cache: " << filename
              << " has invalid timestamp " << words[1] << "\n";
-        errors_occurred = true;
-        return;
+        _tree->get_context()->set_errors_occurred();
+        return false;
       }
 
       PPDependableModelFile dmfile;
@@ -1136,5 +1536,8 @@ read_model_dependency_cache() {
   } else {
     cerr << "Failed to open model dependency cache file " << cache_filename
          << " for reading.\n";
+    return false;
   }
+
+  return true;
 }
@@ -10,6 +10,7 @@
 #include "filename.h"
 #include "vector_string.h"
 
+#include <atomic>
 #include <vector>
 #include <map>
 #include <set>
@@ -22,8 +23,13 @@ class PPDependableFile;
 
 class PPDependableModelFile {
 public:
+  PPDependableModelFile() : _timestamp(0), _mtime(0) {}
+
   Filename _filename;
   time_t _timestamp;
+  // The file's modification time as of this session, if it is
+  // already known, or 0 if it has not yet been checked.
+  time_t _mtime;
   vector_string _dependencies;
 };
 
@@ -46,9 +52,10 @@ public:
 
   const string &get_dirname() const;
   int get_depends_index() const;
-  string get_path() const;
-  string get_fullpath() const;
-  string get_rel_to(const PPDirectory *other) const;
+  int get_index() const;
+  const string &get_path() const;
+  const string &get_fullpath() const;
+  const string &get_rel_to(const PPDirectory *other) const;
 
   PPCommandFile *get_source() const;
 
@@ -65,6 +72,7 @@ public:
   void report_reverse_depends() const;
 
   const vector_string &get_depended_models(const string &filename);
+  void refresh_depended_models(const vector_string &filenames);
   void read_model_dependency_cache();
   void write_model_dependency_cache();
 
@@ -76,15 +84,22 @@ private:
   bool r_scan(const string &prefix);
   bool scan_extra_depends(const string &cache_filename);
   bool read_source_file(const string &prefix, PPNamedScopes *named_scopes);
+  bool load_source_file(const string &prefix, PPNamedScopes *named_scopes);
   bool read_depends_file(PPNamedScopes *named_scopes);
+  bool load_depends_file(PPNamedScopes *named_scopes);
   bool resolve_dependencies();
+  void update_subdirs();
   bool compute_depends_index();
   void read_file_dependencies(const string &cache_filename);
+  void reset_file_dependencies();
   void update_file_dependencies(const string &cache_filename);
 
   void get_complete_i_depend_on(Depends &dep) const;
   void get_complete_depends_on_me(Depends &dep) const;
   void show_directories(const Depends &dep) const;
+  bool is_model_dependency_stale(const Filename &filename,
+                                 string *reason = NULL) const;
+  bool read_model_dependency_cache_file();
 
   string _dirname;
   PPScope *_scope;
@@ -94,6 +109,22 @@ private:
   typedef vector<PPDirectory *> Children;
   Children _children;
   int _depth;
+  int _index;
+
+  // These record whether Sources.pp and Depends.pp have been read for
+  // this directory yet, which in a lazy run may not be all of them.
+  bool _source_read;
+  bool _depends_read;
+
+  // These are computed as needed and cached, since they are queried
+  // frequently (for instance, on every reference to $[RELDIR]).
+  string _path;
+  mutable string _fullpath;
+  typedef map<int, string> RelTo;
+  mutable RelTo _rel_to;
+
+  // Shared by every tree, in every context.
+  static atomic<int> _next_index;
 
   Depends _i_depend_on;
   Depends _depends_on_me;
@@ -105,13 +136,12 @@ private:
 
   typedef map<string, PPDependableModelFile> DependableModels;
   DependableModels _dependable_models;
+  set<string> _failed_models;
   bool _model_dependencies_updated;
   bool _read_model_dependency_cache;
 
   friend class PPDirectoryTree;
 };
 
-extern PPDirectory *current_output_directory;
-
 #endif
 
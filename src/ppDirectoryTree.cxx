@@ -4,19 +4,63 @@
 ////////////////////////////////////////////////////////////////////
 
 #include "ppDirectoryTree.h"
+#include "ppContext.h"
 #include "ppDirectory.h"
 #include "ppDependableFile.h"
+#include "ppModelDependencyCache.h"
+#include "ppNamedScopes.h"
+#include "ppScope.h"
+#include "ppTrace.h"
 #include "tokenize.h"
 
 #include <algorithm>
+#include <assert.h>
+
+// An object that temporarily replaces the stack of dynamic scopes
+// (all but the global scope at the bottom) with the indicated scope,
+// and puts the original stack back when it destructs.  This is used
+// to read a source file on demand in the same context it would have
+// been read in a full run.  If scope is NULL, nothing is changed.
+class ReplaceScopeStack {
+public:
+  ReplaceScopeStack(PPContext *context, PPScope *scope) :
+    _context(context)
+  {
+    _replaced = (scope != (PPScope *)NULL);
+    if (_replaced) {
+      while (_context->get_enclosing_scope(0) !=
+             _context->get_bottom_scope()) {
+        _saved.push_back(_context->pop_scope());
+      }
+      _context->push_scope(scope);
+    }
+  }
+  ~ReplaceScopeStack() {
+    if (_replaced) {
+      _context->pop_scope();
+      while (!_saved.empty()) {
+        _context->push_scope(_saved.back());
+        _saved.pop_back();
+      }
+    }
+  }
+
+private:
+  PPContext *_context;
+  bool _replaced;
+  vector<PPScope *> _saved;
+};
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectoryTree::Constructor
 //       Access: Public
-//  Description:
+//  Description: The tree's source files will be read and processed
+//               in the indicated context.
 ////////////////////////////////////////////////////////////////////
 PPDirectoryTree::
-PPDirectoryTree(PPDirectoryTree *main_tree) {
+PPDirectoryTree(PPContext *context, PPDirectoryTree *main_tree) :
+  _context(context)
+{
   if (main_tree == NULL) {
     _main_tree = this;
   } else {
@@ -24,6 +68,13 @@ PPDirectoryTree(PPDirectoryTree *main_tree) {
   }
 
   _root = new PPDirectory(this);
+  _model_cache = (PPModelDependencyCache *)NULL;
+  _read_file_dependencies = false;
+  _lazy = false;
+  _depends_scanned = false;
+  _named_scopes = (PPNamedScopes *)NULL;
+  _source_scope = (PPScope *)NULL;
+  _depends_scope = (PPScope *)NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -34,11 +85,31 @@ PPDirectoryTree(PPDirectoryTree *main_tree) {
 PPDirectoryTree::
 ~PPDirectoryTree() {
   delete _root;
+  delete _model_cache;
 
   RelatedTrees::iterator ri;
   for (ri = _related_trees.begin(); ri != _related_trees.end(); ++ri) {
     delete (*ri);
   }
+
+  DependableFiles::iterator fi;
+  for (fi = _dependable_files.begin(); fi != _dependable_files.end(); ++fi) {
+    delete (*fi);
+  }
+
+  if (_source_scope != (PPScope *)NULL) {
+    delete _source_scope;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::get_context
+//       Access: Public
+//  Description: Returns the context in which the tree is processed.
+////////////////////////////////////////////////////////////////////
+PPContext *PPDirectoryTree::
+get_context() const {
+  return _context;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -73,10 +144,17 @@ set_fullpath(const string &fullpath) {
 ////////////////////////////////////////////////////////////////////
 bool PPDirectoryTree::
 scan_source(PPNamedScopes *named_scopes) {
+  PPTrace::Span span("phase", "scan_source");
   if (!_root->r_scan("")) {
     return false;
   }
 
+  if (_lazy) {
+    // The source files will be read by load_directory() as they are
+    // needed.
+    return true;
+  }
+
   if (!_root->read_source_file("", named_scopes)) {
     return false;
   }
@@ -92,6 +170,21 @@ scan_source(PPNamedScopes *named_scopes) {
 ////////////////////////////////////////////////////////////////////
 bool PPDirectoryTree::
 scan_depends(PPNamedScopes *named_scopes) {
+  PPTrace::Span span("phase", "scan_depends");
+  if (_lazy) {
+    // Only the directories loaded so far; any loaded later get their
+    // depends files read at the same time.
+    _depends_scanned = true;
+    vector<PPDirectory *> dirs;
+    Dirnames::const_iterator di;
+    for (di = _dirnames.begin(); di != _dirnames.end(); ++di) {
+      if ((*di).second->_source_read) {
+        dirs.push_back((*di).second);
+      }
+    }
+    return load_depends(dirs);
+  }
+
   if (!_root->read_depends_file(named_scopes)) {
     return false;
   }
@@ -117,6 +210,7 @@ scan_depends(PPNamedScopes *named_scopes) {
 bool PPDirectoryTree::
 scan_extra_depends(const string &dependable_header_dirs,
                    const string &cache_filename) {
+  PPTrace::Span span("phase", "scan_extra_depends");
   bool okflag = true;
 
   vector<string> dirnames;
@@ -137,7 +231,7 @@ scan_extra_depends(const string &dependable_header_dirs,
 
     // Now we need to make up a different tree for each external
     // dirname.
-    PPDirectoryTree *tree = new PPDirectoryTree(this);
+    PPDirectoryTree *tree = new PPDirectoryTree(_context, this);
     tree->set_fullpath(dirname);
     _related_trees.push_back(tree);
 
@@ -149,6 +243,153 @@ scan_extra_depends(const string &dependable_header_dirs,
   return okflag;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::set_lazy
+//       Access: Public
+//  Description: Puts the tree in lazy mode, which must be done before
+//               scan_source().  In this mode, scan_source() finds the
+//               directories but reads none of their source files;
+//               instead, each directory's Sources.pp (and its whole
+//               subtree) is read by load_directory() when it is first
+//               needed, along with its Depends.pp and every directory
+//               named in its DEPEND_DIRS.
+//
+//               The named scopes are told to call back into
+//               load_scopes() whenever a scope query names a
+//               directory, so that "*/" queries still see the whole
+//               tree.
+////////////////////////////////////////////////////////////////////
+void PPDirectoryTree::
+set_lazy(PPNamedScopes *named_scopes) {
+  _lazy = true;
+  _named_scopes = named_scopes;
+  _named_scopes->set_lazy_tree(this);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::set_lazy_scopes
+//       Access: Public
+//  Description: Specifies the scopes that a Sources.pp file or a
+//               Depends.pp file read from now on should be read
+//               within, in place of whatever is on the scope stack at
+//               the time it is needed.  In a full run, the Sources.pp
+//               files are all read before Global.pp, and the
+//               Depends.pp files are all read after it, so
+//               source_scope should be a copy of the definitions
+//               scope made before Global.pp is read, and
+//               depends_scope the definitions scope itself.
+//
+//               The tree takes ownership of source_scope, and
+//               deletes it when the tree destructs.
+////////////////////////////////////////////////////////////////////
+void PPDirectoryTree::
+set_lazy_scopes(PPScope *source_scope, PPScope *depends_scope) {
+  _source_scope = source_scope;
+  _depends_scope = depends_scope;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::is_lazy
+//       Access: Public
+//  Description: Returns true if set_lazy() has been called.
+////////////////////////////////////////////////////////////////////
+bool PPDirectoryTree::
+is_lazy() const {
+  return _lazy;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::load_directory
+//       Access: Public
+//  Description: In lazy mode, reads the Sources.pp files for the
+//               indicated directory and all of the directories below
+//               it, if they have not already been read.  If the
+//               depends files have already been scanned, also reads
+//               the Depends.pp files for these directories, and loads
+//               all of the directories they depend on in turn.
+//               Returns true on success, false on failure.
+////////////////////////////////////////////////////////////////////
+bool PPDirectoryTree::
+load_directory(PPDirectory *dir) {
+  if (dir->_source_read) {
+    return true;
+  }
+  PPTrace::Span span("phase", PPTrace::is_enabled() ?
+                      "load " + dir->get_path() : string());
+
+  string current = _named_scopes->get_current();
+  PPDirectory *output_directory = _context->get_output_directory();
+
+  // If a template asked for this directory, its own changes to the
+  // frozen scopes must not leak into what we read now.
+  PPScope::Overlay *overlay = _context->suspend_overlay();
+
+  vector<PPDirectory *> loaded;
+  bool okflag = true;
+  {
+    ReplaceScopeStack replace(_context, _source_scope);
+
+    // Read the subtree breadth-first, parents before children.
+    vector<PPDirectory *> pending(1, dir);
+    for (size_t i = 0; okflag && i < pending.size(); ++i) {
+      PPDirectory *next = pending[i];
+      if (!next->_source_read) {
+        string prefix;
+        if (next != _root) {
+          prefix = next->get_path() + "/";
+        }
+        okflag = next->load_source_file(prefix, _named_scopes);
+        loaded.push_back(next);
+      }
+      pending.insert(pending.end(), next->_children.begin(),
+                     next->_children.end());
+    }
+  }
+
+  if (okflag && _depends_scanned) {
+    okflag = load_depends(loaded);
+  }
+
+  _context->resume_overlay(overlay);
+  if (overlay != (PPScope::Overlay *)NULL) {
+    // The directories we just read become part of the snapshot too.
+    _context->freeze_scopes();
+  }
+
+  _named_scopes->set_current(current);
+  _context->set_output_directory(output_directory);
+  return okflag;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::load_scopes
+//       Access: Public
+//  Description: Called by PPNamedScopes in lazy mode before it looks
+//               up the scopes for the indicated dirname, which may be
+//               "*" to mean every directory.  Loads whatever
+//               directories are needed to answer the query.  Errors
+//               are reported to the context; the return
+//               value is false if there was an error.
+////////////////////////////////////////////////////////////////////
+bool PPDirectoryTree::
+load_scopes(const string &dirname) {
+  PPDirectory *dir;
+  if (dirname == SCOPE_DIRNAME_WILDCARD) {
+    dir = _root;
+  } else {
+    dir = find_dirname(dirname);
+    if (dir == (PPDirectory *)NULL) {
+      return true;
+    }
+  }
+
+  if (!load_directory(dir)) {
+    _context->set_errors_occurred();
+    return false;
+  }
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectoryTree::count_source_files
 //       Access: Public
@@ -213,6 +454,48 @@ find_dirname(const string &dirname) const {
   return (PPDirectory *)NULL;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::add_dependable_file
+//       Access: Public
+//  Description: Records a newly-created dependable file of this tree
+//               or one of its related trees, which must be the main
+//               tree.  The tree takes ownership of the file, and
+//               returns the index number assigned to it.
+////////////////////////////////////////////////////////////////////
+int PPDirectoryTree::
+add_dependable_file(PPDependableFile *file) {
+  assert(_main_tree == this);
+  _dependable_files.push_back(file);
+  return (int)_dependable_files.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::get_num_dependable_files
+//       Access: Public
+//  Description: Returns the number of dependable files that have been
+//               created so far in the main tree and its related
+//               trees.  This must be called on the main tree.
+////////////////////////////////////////////////////////////////////
+int PPDirectoryTree::
+get_num_dependable_files() const {
+  assert(_main_tree == this);
+  return _dependable_files.size();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::get_dependable_file
+//       Access: Public
+//  Description: Returns the dependable file with the indicated index
+//               number, as returned by PPDependableFile::get_index().
+//               This must be called on the main tree.
+////////////////////////////////////////////////////////////////////
+PPDependableFile *PPDirectoryTree::
+get_dependable_file(int index) const {
+  assert(_main_tree == this);
+  assert(index >= 0 && index < (int)_dependable_files.size());
+  return _dependable_files[index];
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectoryTree::find_dependable_file
 //       Access: Public
@@ -285,9 +568,23 @@ get_dependable_file_by_dirpath(const string &dirpath, bool is_header) {
 //  Description: Before processing the source files, makes a pass and
 //               reads in all of the dependency cache files so we'll
 //               have a heads-up on which files depend on the others.
+//
+//               If the tree has been processed before, everything
+//               learned about its files then is first forgotten,
+//               since they may have changed since.
 ////////////////////////////////////////////////////////////////////
 void PPDirectoryTree::
 read_file_dependencies(const string &cache_filename) {
+  PPTrace::Span span("phase", "read_file_dependencies");
+  if (_read_file_dependencies) {
+    _root->reset_file_dependencies();
+    if (_model_cache != (PPModelDependencyCache *)NULL) {
+      delete _model_cache;
+      _model_cache = (PPModelDependencyCache *)NULL;
+    }
+  }
+  _read_file_dependencies = true;
+
   _root->read_file_dependencies(cache_filename);
 
   RelatedTrees::iterator ri;
@@ -306,6 +603,7 @@ read_file_dependencies(const string &cache_filename) {
 ////////////////////////////////////////////////////////////////////
 void PPDirectoryTree::
 update_file_dependencies(const string &cache_filename) {
+  PPTrace::Span span("phase", "update_file_dependencies");
   _root->update_file_dependencies(cache_filename);
 
   RelatedTrees::iterator ri;
@@ -314,12 +612,98 @@ update_file_dependencies(const string &cache_filename) {
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::load_depends
+//       Access: Private
+//  Description: In lazy mode, reads the Depends.pp files for the
+//               indicated directories, loads the directories they
+//               depend on, and puts the new directories into
+//               dependency order.  Returns true on success, false on
+//               failure.
+////////////////////////////////////////////////////////////////////
+bool PPDirectoryTree::
+load_depends(const vector<PPDirectory *> &dirs) {
+  vector<PPDirectory *>::const_iterator di;
+  {
+    ReplaceScopeStack replace(_context, _depends_scope);
+    for (di = dirs.begin(); di != dirs.end(); ++di) {
+      if (!(*di)->load_depends_file(_named_scopes)) {
+        return false;
+      }
+    }
+  }
+
+  // Now make sure everything these depend on is loaded too, before we
+  // try to put them in order.
+  for (di = dirs.begin(); di != dirs.end(); ++di) {
+    PPDirectory::Depends::const_iterator ii;
+    for (ii = (*di)->_i_depend_on.begin();
+         ii != (*di)->_i_depend_on.end();
+         ++ii) {
+      if (!load_directory(*ii)) {
+        return false;
+      }
+    }
+  }
+
+  for (di = dirs.begin(); di != dirs.end(); ++di) {
+    if (!(*di)->compute_depends_index()) {
+      return false;
+    }
+  }
+  for (di = dirs.begin(); di != dirs.end(); ++di) {
+    (*di)->update_subdirs();
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPDirectoryTree::get_model_dependency_cache
+//       Access: Public
+//  Description: Returns the tree-wide model dependency cache, reading
+//               it from the indicated file (relative to the root of
+//               the tree) the first time this is called.  A file that
+//               can't be read is treated as no cache at all, and is
+//               rebuilt.
+////////////////////////////////////////////////////////////////////
+PPModelDependencyCache *PPDirectoryTree::
+get_model_dependency_cache(const string &filename) {
+  if (_main_tree != this) {
+    return _main_tree->get_model_dependency_cache(filename);
+  }
+
+  if (_model_cache == (PPModelDependencyCache *)NULL) {
+    Filename cache_filename(filename);
+    if (!cache_filename.is_fully_qualified()) {
+      cache_filename = Filename(_fullpath, filename);
+    }
+    _model_cache = new PPModelDependencyCache(_context, cache_filename);
+    if (!_model_cache->read()) {
+      cerr << "Warning: discarding model dependency cache "
+           << cache_filename << "; it will be rebuilt.\n";
+      _model_cache->clear();
+    }
+  }
+
+  return _model_cache;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPDirectoryTree::write_model_dependencies
 //       Access: Public
-//  Description:
+//  Description: Writes out the model dependency caches for all
+//               directories that have changed, and then the
+//               tree-wide cache, if one is in use.
 ////////////////////////////////////////////////////////////////////
 void PPDirectoryTree::
 write_model_dependencies() {
+  PPTrace::Span span("phase", "write_model_dependencies");
   _root->r_write_model_dependency_cache();
+
+  if (_model_cache != (PPModelDependencyCache *)NULL) {
+    if (!_model_cache->write()) {
+      _context->set_errors_occurred();
+    }
+  }
 }
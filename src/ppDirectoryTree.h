@@ -11,9 +11,12 @@
 #include <map>
 #include <vector>
 
+class PPContext;
 class PPNamedScopes;
+class PPScope;
 class PPDirectory;
 class PPDependableFile;
+class PPModelDependencyCache;
 
 ///////////////////////////////////////////////////////////////////
 //       Class : PPDirectoryTree
@@ -24,9 +27,10 @@ class PPDependableFile;
 ////////////////////////////////////////////////////////////////////
 class PPDirectoryTree {
 public:
-  PPDirectoryTree(PPDirectoryTree *main_tree = NULL);
+  PPDirectoryTree(PPContext *context, PPDirectoryTree *main_tree = NULL);
   ~PPDirectoryTree();
 
+  PPContext *get_context() const;
   PPDirectoryTree *get_main_tree();
 
   void set_fullpath(const string &fullpath);
@@ -35,6 +39,12 @@ public:
   bool scan_extra_depends(const string &dependable_header_dirs,
                           const string &cache_filename);
 
+  void set_lazy(PPNamedScopes *named_scopes);
+  void set_lazy_scopes(PPScope *source_scope, PPScope *depends_scope);
+  bool is_lazy() const;
+  bool load_directory(PPDirectory *dir);
+  bool load_scopes(const string &dirname);
+
   int count_source_files() const;
   PPDirectory *get_root() const;
   const string &get_fullpath() const;
@@ -43,6 +53,9 @@ public:
 
   PPDirectory *find_dirname(const string &dirname) const;
 
+  int add_dependable_file(PPDependableFile *file);
+  int get_num_dependable_files() const;
+  PPDependableFile *get_dependable_file(int index) const;
   PPDependableFile *find_dependable_file(const string &filename) const;
   PPDependableFile *get_dependable_file_by_dirpath(const string &dirpath,
                                                    bool is_header);
@@ -50,9 +63,13 @@ public:
   void read_file_dependencies(const string &cache_filename);
   void update_file_dependencies(const string &cache_filename);
 
+  PPModelDependencyCache *get_model_dependency_cache(const string &filename);
   void write_model_dependencies();
 
 private:
+  bool load_depends(const vector<PPDirectory *> &dirs);
+
+  PPContext *_context;
   PPDirectoryTree *_main_tree;
   PPDirectory *_root;
   string _fullpath;
@@ -63,9 +80,28 @@ private:
   typedef map<string, PPDependableFile *> Dependables;
   Dependables _dependables;
 
+  // Every dependable file of this tree and its related trees, by
+  // index.  Only the main tree keeps this, and it owns the files.
+  typedef vector<PPDependableFile *> DependableFiles;
+  DependableFiles _dependable_files;
+
   typedef vector<PPDirectoryTree *> RelatedTrees;
   RelatedTrees _related_trees;
 
+  PPModelDependencyCache *_model_cache;
+
+  // True once read_file_dependencies() has been called, after which
+  // the tree's files must be reset before they are read again.
+  bool _read_file_dependencies;
+
+  // These support set_lazy(), which reads each directory's Sources.pp
+  // only when it is first needed.
+  bool _lazy;
+  bool _depends_scanned;
+  PPNamedScopes *_named_scopes;
+  PPScope *_source_scope;
+  PPScope *_depends_scope;
+
   friend class PPDirectory;
 };
 
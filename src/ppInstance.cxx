@@ -0,0 +1,276 @@
+// Filename: ppInstance.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppremake.h"
+#include "ppInstance.h"
+#include "ppMain.h"
+#include "ppScope.h"
+#include "ppContext.h"
+#include "filename.h"
+
+#include <assert.h>
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPInstance::
+PPInstance() {
+  _context = (PPContext *)NULL;
+  _global_scope = (PPScope *)NULL;
+  _main = (PPMain *)NULL;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::Destructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPInstance::
+~PPInstance() {
+  unload();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::define_variable
+//       Access: Public
+//  Description: Defines a variable in the global scope, in addition
+//               to (or in place of) the ones ppremake defines itself,
+//               e.g. PLATFORM or PPREMAKE_CONFIG, which ppremake
+//               sets with -p and -c.  This takes effect the next
+//               time the tree is loaded.
+////////////////////////////////////////////////////////////////////
+void PPInstance::
+define_variable(const string &varname, const string &definition) {
+  _definitions[varname] = definition;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::load
+//       Access: Public
+//  Description: Reads the source tree that contains the indicated
+//               directory, discarding any tree loaded previously.
+//               Returns true on success, or false if the tree could
+//               not be read, in which case nothing is left loaded.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+load(const string &dirname) {
+  unload();
+
+  string platform = PLATFORM;
+  const char *platform_env = getenv("PPREMAKE_PLATFORM");
+  if (platform_env != (const char *)NULL) {
+    platform = platform_env;
+  }
+
+  _context = new PPContext;
+  _global_scope = new PPScope(_context, (PPNamedScopes *)NULL);
+  PPMain::define_builtin_variables(_global_scope, platform);
+
+  Definitions::const_iterator di;
+  for (di = _definitions.begin(); di != _definitions.end(); ++di) {
+    _global_scope->define_variable((*di).first, (*di).second);
+  }
+
+  _main = new PPMain(_global_scope);
+  _main->set_isolate_directories();
+  if (!_main->read_source(dirname) || _context->get_errors_occurred()) {
+    unload();
+    return false;
+  }
+
+  _root = _main->get_root();
+  record_timestamps();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::unload
+//       Access: Public
+//  Description: Discards the loaded tree, if any.
+////////////////////////////////////////////////////////////////////
+void PPInstance::
+unload() {
+  if (_main != (PPMain *)NULL) {
+    delete _main;
+    _main = (PPMain *)NULL;
+  }
+  if (_global_scope != (PPScope *)NULL) {
+    delete _global_scope;
+    _global_scope = (PPScope *)NULL;
+  }
+  if (_context != (PPContext *)NULL) {
+    delete _context;
+    _context = (PPContext *)NULL;
+  }
+  _timestamps.clear();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::is_loaded
+//       Access: Public
+//  Description: Returns true if a tree is loaded.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+is_loaded() const {
+  return (_main != (PPMain *)NULL);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::get_root
+//       Access: Public
+//  Description: Returns the full path to the root of the tree most
+//               recently loaded, or the empty string if none has
+//               been.
+////////////////////////////////////////////////////////////////////
+const string &PPInstance::
+get_root() const {
+  return _root;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::is_stale
+//       Access: Public
+//  Description: Returns true if no tree is loaded, or if any of the
+//               files that were read in loading it--Package.pp, the
+//               Sources.pp files, Global.pp, and whatever they
+//               included--has since been modified or removed.
+//
+//               Templates are read afresh each time a directory is
+//               processed, so a change to them alone does not make
+//               the tree stale.  Neither does a new directory; call
+//               load() to pick one up.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+is_stale() const {
+  if (_main == (PPMain *)NULL) {
+    return true;
+  }
+
+  Timestamps::const_iterator ti;
+  for (ti = _timestamps.begin(); ti != _timestamps.end(); ++ti) {
+    if (Filename((*ti).first).get_timestamp() != (*ti).second) {
+      if (verbose) {
+        cerr << (*ti).first << " has changed.\n";
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::refresh
+//       Access: Public
+//  Description: Loads the tree again if it is stale; see is_stale().
+//               If no tree has been loaded yet, loads the one
+//               containing the current directory.  Returns true if
+//               the tree is loaded afterwards.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+refresh() {
+  if (!is_stale()) {
+    return true;
+  }
+  return load(_root.empty() ? string(".") : _root);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::get_dirnames
+//       Access: Public
+//  Description: Fills the vector with the names of the directories
+//               of the loaded tree that may be processed.
+////////////////////////////////////////////////////////////////////
+void PPInstance::
+get_dirnames(vector<string> &dirnames) const {
+  assert(_main != (PPMain *)NULL);
+  _main->get_dirnames(dirnames);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::expand_string
+//       Access: Public
+//  Description: Returns the expansion of the indicated string in the
+//               global scope of the loaded tree, where the variables
+//               defined by Package.pp and Global.pp are visible.
+//               Anything the expansion changes is discarded.
+////////////////////////////////////////////////////////////////////
+string PPInstance::
+expand_string(const string &str) {
+  assert(_main != (PPMain *)NULL);
+  string result;
+  _main->expand_string(string(), str, result);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::expand_string
+//       Access: Public
+//  Description: Expands the indicated string in the scope of the
+//               named directory's Sources.pp, as its templates would
+//               first see it, and stores the expansion in result.
+//               Other directories' scopes may be queried with the
+//               usual $[VAR(dirname/scope)] syntax.  Returns false if
+//               there is no such directory.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+expand_string(const string &dirname, const string &str, string &result) {
+  assert(_main != (PPMain *)NULL);
+  return _main->expand_string(dirname, str, result);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::process_all
+//       Access: Public
+//  Description: Generates the output files for every directory of the
+//               loaded tree, just as ppremake does when it is given
+//               no directory names.  Returns true on success, or
+//               false if any error was reported.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+process_all() {
+  assert(_main != (PPMain *)NULL);
+  _context->clear_errors_occurred();
+  bool okflag = _main->process_all();
+  return okflag && !_context->get_errors_occurred();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::process
+//       Access: Public
+//  Description: Generates the output files for the named directory
+//               of the loaded tree.  Returns true on success, or
+//               false if any error was reported.
+////////////////////////////////////////////////////////////////////
+bool PPInstance::
+process(const string &dirname) {
+  assert(_main != (PPMain *)NULL);
+  _context->clear_errors_occurred();
+  bool okflag = _main->process(dirname);
+  return okflag && !_context->get_errors_occurred();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPInstance::record_timestamps
+//       Access: Private
+//  Description: Notes the modification time of each of the files read
+//               in loading the tree, for is_stale().
+////////////////////////////////////////////////////////////////////
+void PPInstance::
+record_timestamps() {
+  _timestamps.clear();
+
+  const vector_string &files = _context->get_source_files();
+  vector_string::const_iterator fi;
+  for (fi = files.begin(); fi != files.end(); ++fi) {
+    Filename filename(*fi);
+    if (filename.is_local()) {
+      filename = Filename(_root, filename);
+    }
+    _timestamps[filename.get_fullpath()] = filename.get_timestamp();
+  }
+}
@@ -0,0 +1,84 @@
+// Filename: ppInstance.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPINSTANCE_H
+#define PPINSTANCE_H
+
+// This header is installed along with libppremake, so unlike the rest
+// of ppremake it does not include ppremake.h (and thereby config.h),
+// and it names the std types explicitly.
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+
+class PPContext;
+class PPScope;
+class PPMain;
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPInstance
+// Description : The interface to ppremake for a program that links
+//               with libppremake, instead of running the ppremake
+//               executable.  An instance reads a source tree once--
+//               Package.pp, each Sources.pp, and Global.pp--and may
+//               then process its directories, evaluate expressions
+//               in its scopes, and process them again, as often as
+//               the program likes.
+//
+//               Each directory's templates are run against a
+//               snapshot of the scopes as they stood after loading,
+//               as if $[ISOLATE_DIRECTORIES] were defined, so that
+//               processing a directory again gives the same result.
+//               When any of the files read in loading the tree have
+//               changed, refresh() loads it again.
+//
+//               Each instance has its own PPContext, and so its own
+//               caches and output queue; but loading a tree changes
+//               the current directory of the process to the root of
+//               the tree, so instances loaded at the same time must
+//               all be for the same tree.
+////////////////////////////////////////////////////////////////////
+class PPInstance {
+public:
+  PPInstance();
+  ~PPInstance();
+
+  void define_variable(const std::string &varname,
+                       const std::string &definition);
+
+  bool load(const std::string &dirname = ".");
+  void unload();
+  bool is_loaded() const;
+  const std::string &get_root() const;
+
+  bool is_stale() const;
+  bool refresh();
+
+  void get_dirnames(std::vector<std::string> &dirnames) const;
+  std::string expand_string(const std::string &str);
+  bool expand_string(const std::string &dirname, const std::string &str,
+                     std::string &result);
+
+  bool process_all();
+  bool process(const std::string &dirname);
+
+private:
+  void record_timestamps();
+
+  typedef std::map<std::string, std::string> Definitions;
+  Definitions _definitions;
+
+  std::string _root;
+  PPContext *_context;
+  PPScope *_global_scope;
+  PPMain *_main;
+
+  // The modification times of the files read in loading the tree.
+  typedef std::map<std::string, time_t> Timestamps;
+  Timestamps _timestamps;
+};
+
+#endif
@@ -5,8 +5,15 @@
 
 #include "ppMain.h"
 #include "ppScope.h"
+#include "ppContext.h"
 #include "ppCommandFile.h"
 #include "ppDirectory.h"
+#include "ppOutputQueue.h"
+#include "ppProfiler.h"
+#include "ppSearchCache.h"
+#include "ppShellCache.h"
+#include "ppTrace.h"
+#include "executionEnvironment.h"
 #include "tokenize.h"
 
 #ifdef HAVE_UNISTD_H
@@ -14,32 +21,46 @@
 #endif
 
 #include <assert.h>
-#include <errno.h>
 #include <stdio.h> // for perror
+#include <memory>
 
 #ifdef WIN32_VC
-#include <direct.h>  // Windows requires this for getcwd()
-#define getcwd _getcwd
+#include <direct.h>  // Windows requires this for chdir()
 #endif  // WIN32_VC
 
-Filename PPMain::_root;
+
+// The options declared in ppremake.h.  They are defined here, rather
+// than alongside main(), so that they are part of libppremake.
+bool unix_platform = false;
+bool windows_platform = false;
+bool dry_run = false;
+bool verbose_dry_run = false;
+int verbose = 0;
+int debug_expansions = 0;
+bool explain = false;
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPMain::Constructor
 //       Access: Public
-//  Description:
+//  Description: The source tree is evaluated in the context of the
+//               indicated global scope.
 ////////////////////////////////////////////////////////////////////
 PPMain::
-PPMain(PPScope *global_scope) {
+PPMain(PPScope *global_scope) :
+  _context(global_scope->get_context()),
+  _tree(_context),
+  _named_scopes(_context)
+{
   _global_scope = global_scope;
-  PPScope::push_scope(_global_scope);
+  _context->push_scope(_global_scope);
 
   _def_scope = (PPScope *)NULL;
   _defs = (PPCommandFile *)NULL;
+  _isolate_directories = false;
 
   // save current working directory name, so that "ppremake ." can map
   // to the current directory.
-  Filename dirpath = get_cwd();
+  Filename dirpath = ExecutionEnvironment::get_cwd();
   _original_working_dir = dirpath.get_basename();
 }
 
@@ -58,6 +79,63 @@ PPMain::
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::define_builtin_variables
+//       Access: Public, Static
+//  Description: Defines the variables that ppremake provides to every
+//               source tree, such as $[PLATFORM] and $[TAB], on the
+//               indicated global scope.
+////////////////////////////////////////////////////////////////////
+void PPMain::
+define_builtin_variables(PPScope *global_scope, const string &platform) {
+  global_scope->define_variable("PPREMAKE", PACKAGE);
+  global_scope->define_variable("PPREMAKE_VERSION", VERSION);
+  global_scope->define_variable("PLATFORM", platform);
+  global_scope->define_variable("PACKAGE_FILENAME", PACKAGE_FILENAME);
+  global_scope->define_variable("SOURCE_FILENAME", SOURCE_FILENAME);
+  global_scope->define_variable("INSTALL_DIR", INSTALL_DIR);
+
+  // Also, it's convenient to have a way to represent the literal tab
+  // character, without actually putting a literal tab character in
+  // the source file.  Similarly with some other special characters.
+  global_scope->define_variable("TAB", "\t");
+  global_scope->define_variable("SPACE", " ");
+  global_scope->define_variable("DOLLAR", "$");
+  global_scope->define_variable("HASH", "#");
+  global_scope->define_variable("DOUBLESLASH", "//");
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::set_lazy
+//       Access: Public
+//  Description: Requests that read_source() read only the source
+//               files for the indicated directories (and the
+//               directories below them), along with the directories
+//               they depend on, rather than the whole tree.  Any
+//               other directories are read later, if a scope query
+//               turns out to need them.  This must be called before
+//               read_source().
+////////////////////////////////////////////////////////////////////
+void PPMain::
+set_lazy(const vector_string &dirnames) {
+  _lazy_dirnames = dirnames;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::set_isolate_directories
+//       Access: Public
+//  Description: Requests that each directory's templates be run
+//               against a snapshot of the scopes, as if
+//               $[ISOLATE_DIRECTORIES] were defined, so that a
+//               directory may be processed more than once with the
+//               same result.  This must be called before
+//               read_source().
+////////////////////////////////////////////////////////////////////
+void PPMain::
+set_isolate_directories() {
+  _isolate_directories = true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPMain::read_source
 //       Access: Public
@@ -115,18 +193,22 @@ read_source(const string &root) {
     return false;
   }
 
-  _root = get_cwd();
-  _tree.set_fullpath(_root);
-  cerr << "Root is " << _root << "\n";
+  string fullpath = ExecutionEnvironment::get_cwd();
+  _context->set_root(fullpath);
+  _tree.set_fullpath(fullpath);
+  cerr << "Root is " << fullpath << "\n";
 
-  _def_scope = new PPScope(&_named_scopes);
+  _def_scope = new PPScope(_context, &_named_scopes);
   _def_scope->define_variable("PACKAGEFILE", package_file);
-  _def_scope->define_variable("TOPDIR", _root);
+  _def_scope->define_variable("TOPDIR", fullpath);
   _def_scope->define_variable("DEPENDABLE_HEADER_DIRS", "");
   _defs = new PPCommandFile(_def_scope);
 
-  if (!_defs->read_file(PACKAGE_FILENAME)) {
-    return false;
+  {
+    PPTrace::Span span("phase", PACKAGE_FILENAME);
+    if (!_defs->read_file(PACKAGE_FILENAME)) {
+      return false;
+    }
   }
 
   // Now check the *_PLATFORM variables that System.pp was supposed to
@@ -138,15 +220,38 @@ read_source(const string &root) {
     windows_platform = true;
   }
 
-  PPScope::push_scope(_def_scope);
+  _context->push_scope(_def_scope);
+
+  if (!_lazy_dirnames.empty()) {
+    _tree.set_lazy(&_named_scopes);
+  }
 
   if (!_tree.scan_source(&_named_scopes)) {
     return false;
   }
 
+  if (!_lazy_dirnames.empty()) {
+    vector_string::const_iterator di;
+    for (di = _lazy_dirnames.begin(); di != _lazy_dirnames.end(); ++di) {
+      string dirname = (*di);
+      if (dirname == ".") {
+        dirname = _original_working_dir;
+      }
+      // An unknown dirname is reported later, by process().
+      PPDirectory *dir = _tree.find_dirname(dirname);
+      if (dir != (PPDirectory *)NULL && !_tree.load_directory(dir)) {
+        return false;
+      }
+    }
+
+    // Any source files read from now on must not see what Global.pp
+    // defines, just as they wouldn't have in a full run.
+    _tree.set_lazy_scopes(new PPScope(*_def_scope), _def_scope);
+  }
+
   _def_scope->define_variable("TREE", _tree.get_complete_tree());
 
-  if (_tree.count_source_files() == 0) {
+  if (_tree.count_source_files() == 0 && !_tree.is_lazy()) {
     cerr << "Could not find any source definition files named " << SOURCE_FILENAME
      << ".\n\n"
      << "A file by this name should be present in each directory of the source\n"
@@ -176,6 +281,15 @@ read_source(const string &root) {
     return false;
   }
 
+  // If $[ISOLATE_DIRECTORIES] is defined, the scopes are frozen as
+  // they now stand, and each directory's templates are run against
+  // this snapshot; whatever they change is private to the directory.
+  if (_isolate_directories ||
+      !trim_blanks(_def_scope->expand_variable("ISOLATE_DIRECTORIES")).empty()) {
+    _isolate_directories = true;
+    _context->freeze_scopes();
+  }
+
   return true;
 }
 
@@ -196,6 +310,7 @@ process_all() {
   }
 
   if (!r_process_all(_tree.get_root())) {
+    _context->get_output_queue()->flush();
     return false;
   }
 
@@ -203,18 +318,30 @@ process_all() {
   // after all the template scripts have been executed.
   string post_filename = _def_scope->expand_variable("POST_TEMPLATE_FILE");
   if (!post_filename.empty()) {
+    unique_ptr<PPScope::Overlay> overlay;
+    if (_isolate_directories) {
+      overlay.reset(new PPScope::Overlay(_context));
+    }
     PPCommandFile post_templ(_def_scope);
     if (!post_templ.read_file(post_filename)) {
       cerr << "Error reading post-template file " << post_filename << "\n";
+      _context->get_output_queue()->flush();
       return false;
     }
   }
 
+  // Wait for the generated files to be written out.
+  if (!_context->get_output_queue()->flush()) {
+    return false;
+  }
+
   if (!cache_filename.empty()) {
     _tree.update_file_dependencies(cache_filename);
   }
 
   _tree.write_model_dependencies();
+  _context->get_search_cache()->write();
+  _context->get_shell_cache()->write();
 
   return true;
 }
@@ -251,7 +378,13 @@ process(string dirname) {
     return false;
   }
 
-  if (!p_process(dir)) {
+  bool okflag = p_process(dir);
+
+  // Wait for the generated files to be written out.
+  if (!_context->get_output_queue()->flush()) {
+    okflag = false;
+  }
+  if (!okflag) {
     return false;
   }
 
@@ -259,6 +392,9 @@ process(string dirname) {
     _tree.update_file_dependencies(cache_filename);
   }
 
+  _context->get_search_cache()->write();
+  _context->get_shell_cache()->write();
+
   return true;
 }
 
@@ -296,29 +432,85 @@ report_reverse_depends(const string &dirname) const {
   dir->report_reverse_depends();
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::get_dirnames
+//       Access: Public
+//  Description: Fills the vector with the names of the directories
+//               that have a source file, i.e. the names that may be
+//               given to process().
+////////////////////////////////////////////////////////////////////
+void PPMain::
+get_dirnames(vector_string &dirnames) const {
+  dirnames.clear();
+  r_get_dirnames(_tree.get_root(), dirnames);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::expand_string
+//       Access: Public
+//  Description: Expands the indicated string in the scope of the
+//               named directory's source file, as that directory's
+//               templates would begin by seeing it, and stores the
+//               expansion in result.  If dirname is empty, the string
+//               is expanded in the scope of Package.pp and Global.pp
+//               instead.  Returns false if there is no such
+//               directory.
+//
+//               If the directories are isolated, whatever the
+//               expansion changes is discarded afterwards.
+////////////////////////////////////////////////////////////////////
+bool PPMain::
+expand_string(const string &dirname, const string &str, string &result) {
+  assert(_def_scope != (PPScope *)NULL);
+  PPScope *scope = _def_scope;
+
+  if (!dirname.empty()) {
+    string name = dirname;
+    if (name == ".") {
+      name = _original_working_dir;
+    }
+    PPDirectory *dir = _tree.find_dirname(name);
+    if (dir == (PPDirectory *)NULL || dir->get_source() == (PPCommandFile *)NULL) {
+      cerr << "Unknown directory: " << dirname << "\n";
+      return false;
+    }
+    _context->set_output_directory(dir);
+    _named_scopes.set_current(dir->get_dirname());
+    scope = dir->get_source()->get_scope();
+  }
+
+  unique_ptr<PPScope::Overlay> overlay;
+  if (_isolate_directories) {
+    overlay.reset(new PPScope::Overlay(_context));
+  }
+
+  result = scope->expand_string(str);
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPMain::get_root
-//       Access: Public, Static
+//       Access: Public
 //  Description: Returns the full path to the root directory of the
 //               source hierarchy; this is the directory in which the
 //               runs most of the time.
 ////////////////////////////////////////////////////////////////////
 string PPMain::
-get_root() {
-  return _root.get_fullpath();
+get_root() const {
+  return _context->get_root();
 }
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPMain::chdir_root
-//       Access: Public, Static
+//       Access: Public
 //  Description: Changes the current directory to the root directory
 //               of the source hierarchy.  This should be executed
 //               after a temporary change to another directory, to
 //               restore the current directory to a known state.
 ////////////////////////////////////////////////////////////////////
 void PPMain::
-chdir_root() {
-  if (chdir(_root.c_str()) < 0) {
+chdir_root() const {
+  if (chdir(_context->get_root().c_str()) < 0) {
     perror("chdir");
     // This is a real error!  We can't get back to our starting
     // directory!
@@ -350,6 +542,23 @@ r_process_all(PPDirectory *dir) {
   return true;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPMain::r_get_dirnames
+//       Access: Private
+//  Description: The recursive implementation of get_dirnames().
+////////////////////////////////////////////////////////////////////
+void PPMain::
+r_get_dirnames(PPDirectory *dir, vector_string &dirnames) const {
+  if (dir->get_source() != (PPCommandFile *)NULL) {
+    dirnames.push_back(dir->get_dirname());
+  }
+
+  int num_children = dir->get_num_children();
+  for (int i = 0; i < num_children; i++) {
+    r_get_dirnames(dir->get_child(i), dirnames);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPMain::p_process
 //       Access: Private
@@ -357,13 +566,20 @@ r_process_all(PPDirectory *dir) {
 ////////////////////////////////////////////////////////////////////
 bool PPMain::
 p_process(PPDirectory *dir) {
-  current_output_directory = dir;
+  PPProfiler::Frame frame("dir", dir->get_path());
+  PPTrace::Span span("dir", dir->get_path());
+  _context->set_output_directory(dir);
   _named_scopes.set_current(dir->get_dirname());
   PPCommandFile *source = dir->get_source();
   assert(source != (PPCommandFile *)NULL);
 
   PPScope *scope = source->get_scope();
 
+  unique_ptr<PPScope::Overlay> overlay;
+  if (_isolate_directories) {
+    overlay.reset(new PPScope::Overlay(_context));
+  }
+
   string template_filename = scope->expand_variable("TEMPLATE_FILE");
   if (template_filename.empty()) {
     cerr << "No definition given for $[TEMPLATE_FILE], cannot process.\n";
@@ -387,6 +603,7 @@ p_process(PPDirectory *dir) {
 ////////////////////////////////////////////////////////////////////
 bool PPMain::
 read_global_file() {
+  PPTrace::Span span("phase", "Global.pp");
   assert(_def_scope != (PPScope *)NULL);
 
   string global_filename = _def_scope->expand_variable("GLOBAL_FILE");
@@ -404,32 +621,3 @@ read_global_file() {
 
   return true;
 }
-
-////////////////////////////////////////////////////////////////////
-//     Function: PPMain::get_cwd
-//       Access: Private, Static
-//  Description: Calls the system getcwd(), automatically allocating a
-//               large enough string.
-////////////////////////////////////////////////////////////////////
-Filename PPMain::
-get_cwd() {
-  static size_t bufsize = 1024;
-  static char *buffer = NULL;
-
-  if (buffer == (char *)NULL) {
-    buffer = new char[bufsize];
-  }
-
-  while (getcwd(buffer, bufsize) == (char *)NULL) {
-    if (errno != ERANGE) {
-      perror("getcwd");
-      return string();
-    }
-    delete[] buffer;
-    bufsize = bufsize * 2;
-    buffer = new char[bufsize];
-    assert(buffer != (char *)NULL);
-  }
-
-  return Filename::from_os_specific(buffer);
-}
@@ -10,7 +10,9 @@
 #include "ppDirectoryTree.h"
 #include "ppNamedScopes.h"
 #include "filename.h"
+#include "vector_string.h"
 
+class PPContext;
 class PPScope;
 class PPCommandFile;
 
@@ -25,6 +27,11 @@ public:
   PPMain(PPScope *global_scope);
   ~PPMain();
 
+  static void define_builtin_variables(PPScope *global_scope,
+                                       const string &platform);
+
+  void set_lazy(const vector_string &dirnames);
+  void set_isolate_directories();
   bool read_source(const string &root);
 
   bool process_all();
@@ -33,16 +40,21 @@ public:
   void report_depends(const string &dirname) const;
   void report_reverse_depends(const string &dirname) const;
 
-  static string get_root();
-  static void chdir_root();
+  void get_dirnames(vector_string &dirnames) const;
+  bool expand_string(const string &dirname, const string &str,
+                     string &result);
+
+  string get_root() const;
+  void chdir_root() const;
 
 private:
   bool r_process_all(PPDirectory *dir);
+  void r_get_dirnames(PPDirectory *dir, vector_string &dirnames) const;
   bool p_process(PPDirectory *dir);
   bool read_global_file();
-  static Filename get_cwd();
 
 
+  PPContext *_context;
   PPScope *_global_scope;
   PPScope *_def_scope;
   PPCommandFile *_defs;
@@ -51,8 +63,9 @@ private:
   PPNamedScopes _named_scopes;
   PPScope *_parent_scope;
 
-  static Filename _root;
   string _original_working_dir;
+  vector_string _lazy_dirnames;
+  bool _isolate_directories;
 };
 
 #endif
@@ -0,0 +1,692 @@
+// Filename: ppModelDependencyCache.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppModelDependencyCache.h"
+#include "ppContext.h"
+#include "ppOutputQueue.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+// The file begins with this magic number, followed by the version
+// number, so we can recognize our own files.
+static const char cache_magic[4] = { 'p', 'p', 'm', 'd' };
+static const unsigned int cache_version = 1;
+
+// Each record in the file begins with one of these bytes.
+enum RecordType {
+  RT_string = 'S',
+  RT_entry  = 'E',
+  RT_delete = 'D',
+};
+
+// Once the file contains more than this many replaced records, and
+// more replaced records than live ones, we rewrite it from scratch.
+static const int min_compact_records = 1000;
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::Constructor
+//       Access: Public
+//  Description: The context is the one whose output queue is
+//               consulted before the model files are stat'ed.
+////////////////////////////////////////////////////////////////////
+PPModelDependencyCache::
+PPModelDependencyCache(PPContext *context, const Filename &filename) :
+  _context(context),
+  _filename(filename)
+{
+  _filename.set_binary();
+  _num_records = 0;
+  _needs_rewrite = false;
+  _file_size = 0;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::get_filename
+//       Access: Public
+//  Description: Returns the name of the cache file.
+////////////////////////////////////////////////////////////////////
+const Filename &PPModelDependencyCache::
+get_filename() const {
+  return _filename;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::read
+//       Access: Public
+//  Description: Reads the cache file, if it exists.  Returns true if
+//               the file was read successfully or does not exist,
+//               false if it exists but is unreadable.
+////////////////////////////////////////////////////////////////////
+bool PPModelDependencyCache::
+read() {
+  string os_specific = _filename.to_os_specific();
+  bool okflag = true;
+
+#if defined(HAVE_SYS_MMAN_H) && !defined(WIN32_VC)
+  int fd = open(os_specific.c_str(), O_RDONLY);
+  if (fd < 0) {
+    // No cache file yet.
+    _needs_rewrite = true;
+    return true;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    close(fd);
+    _needs_rewrite = true;
+    return true;
+  }
+
+  size_t size = (size_t)st.st_size;
+  _file_size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    _needs_rewrite = true;
+    return false;
+  }
+
+  okflag = parse((const unsigned char *)data, size);
+  munmap(data, size);
+
+#else  // HAVE_SYS_MMAN_H
+  ifstream in;
+  if (!_filename.exists() || !_filename.open_read(in)) {
+    _needs_rewrite = true;
+    return true;
+  }
+
+  string data;
+  static const size_t buffer_size = 65536;
+  char buffer[buffer_size];
+  in.read(buffer, buffer_size);
+  while (in.gcount() > 0) {
+    data.append(buffer, (size_t)in.gcount());
+    in.read(buffer, buffer_size);
+  }
+
+  _file_size = (off_t)data.size();
+  okflag = parse((const unsigned char *)data.data(), data.size());
+#endif  // HAVE_SYS_MMAN_H
+
+  if (verbose) {
+    cerr << "Read model dependency cache " << _filename << "\n";
+  }
+
+  return okflag;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::write
+//       Access: Public
+//  Description: Writes any changes made since the cache was read out
+//               to the cache file, either by appending them to the
+//               end of the file, or, if it has accumulated too many
+//               replaced records, by rewriting the whole thing.
+//               Returns true on success, false on failure.
+//
+//               The file is locked while we work on it, as in
+//               Filename::atomic_compare_and_exchange_contents().  If
+//               another ppremake has appended to or replaced the file
+//               since we read it, our string indices no longer match
+//               the ones in the file, so we rewrite it with what we
+//               know instead of appending.
+////////////////////////////////////////////////////////////////////
+bool PPModelDependencyCache::
+write() {
+  int num_live = 0;
+  Directories::const_iterator di;
+  for (di = _directories.begin(); di != _directories.end(); ++di) {
+    num_live += (int)(*di).second.size();
+  }
+
+  bool rewrite = _needs_rewrite ||
+    (_num_records > min_compact_records && _num_records > num_live * 2);
+  if (!rewrite && _pending.empty()) {
+    return true;
+  }
+
+#ifdef WIN32_VC
+  // Without lockf(), we can't safely append alongside another
+  // ppremake, so we always replace the file.
+  return compact();
+
+#else  // WIN32_VC
+  string os_specific = _filename.to_os_specific();
+  int fd = open(os_specific.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd < 0) {
+    perror(os_specific.c_str());
+    return false;
+  }
+
+  lockf(fd, F_LOCK, 0);
+
+  if (!rewrite) {
+    struct stat fd_st, path_st;
+    if (fstat(fd, &fd_st) < 0 ||
+        stat(os_specific.c_str(), &path_st) < 0 ||
+        fd_st.st_dev != path_st.st_dev || fd_st.st_ino != path_st.st_ino ||
+        fd_st.st_size != _file_size) {
+      if (verbose) {
+        cerr << "Model dependency cache " << _filename
+             << " was changed by another process.\n";
+      }
+      rewrite = true;
+    }
+  }
+
+  bool okflag = true;
+  if (rewrite) {
+    // We still hold the lock on the old file while the new one is
+    // moved into place, so no one can append to the old one after
+    // checking it.
+    okflag = compact();
+
+  } else {
+    if (verbose) {
+      cerr << "Appending to model dependency cache " << _filename << "\n";
+    }
+
+    const char *p = _pending.data();
+    size_t remaining = _pending.size();
+    while (remaining > 0) {
+      ssize_t bytes_written = ::write(fd, p, remaining);
+      if (bytes_written < 0) {
+        perror(os_specific.c_str());
+        okflag = false;
+        break;
+      }
+      p += bytes_written;
+      remaining -= bytes_written;
+    }
+
+    if (okflag) {
+      _file_size += (off_t)_pending.size();
+      _pending = string();
+    } else {
+      // Whatever made it into the file is now a damaged record.
+      _needs_rewrite = true;
+    }
+  }
+
+  // Closing the file releases the lock.
+  close(fd);
+  return okflag;
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::clear
+//       Access: Public
+//  Description: Forgets everything read from the cache file, and
+//               marks the file to be rewritten from scratch the next
+//               time write() is called.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+clear() {
+  _strings.clear();
+  _string_index.clear();
+  _directories.clear();
+  _num_records = 0;
+  _pending = string();
+  _needs_rewrite = true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::get_models
+//       Access: Public
+//  Description: Fills the map with the cached dependencies of all the
+//               models within the indicated directory (named by its
+//               path relative to the root of the tree).  The
+//               existence and modification time of each model file is
+//               checked in one pass over the directory, and stored in
+//               the _mtime member of each entry; files that no longer
+//               exist are removed from the cache.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+get_models(const string &dirpath, const string &dir_fullpath,
+           PPModelDependencyCache::Models &models) {
+  StringIndex::const_iterator si = _string_index.find(dirpath);
+  if (si == _string_index.end()) {
+    return;
+  }
+  Index dir_index = (*si).second;
+  Directories::iterator di = _directories.find(dir_index);
+  if (di == _directories.end()) {
+    return;
+  }
+  Entries &entries = (*di).second;
+
+  vector<string> filenames;
+  filenames.reserve(entries.size());
+  Entries::const_iterator ei;
+  for (ei = entries.begin(); ei != entries.end(); ++ei) {
+    filenames.push_back(_strings[(*ei).first]);
+  }
+
+  vector<time_t> mtimes;
+  stat_files(dir_fullpath, filenames, mtimes);
+
+  size_t i = 0;
+  ei = entries.begin();
+  while (ei != entries.end()) {
+    const string &filename = filenames[i];
+    if (mtimes[i] == 0) {
+      // This file no longer exists; remove it from the cache.
+      if (verbose) {
+        cerr << "Removing old file " << filename
+             << " from model dependency cache\n";
+      }
+      write_delete(dir_index, (*ei).first, _pending);
+      entries.erase(ei++);
+
+    } else {
+      const Entry &entry = (*ei).second;
+      PPDependableModelFile &dmfile = models[filename];
+      dmfile._filename = filename;
+      dmfile._timestamp = entry._timestamp;
+      dmfile._mtime = mtimes[i];
+      dmfile._dependencies.clear();
+      dmfile._dependencies.reserve(entry._dependencies.size());
+      vector<Index>::const_iterator depi;
+      for (depi = entry._dependencies.begin();
+           depi != entry._dependencies.end();
+           ++depi) {
+        dmfile._dependencies.push_back(_strings[*depi]);
+      }
+      ++ei;
+    }
+    ++i;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::set_models
+//       Access: Public
+//  Description: Replaces the cached dependencies for the indicated
+//               directory with the contents of the map.  Only those
+//               entries that have actually changed are recorded to be
+//               written to the file.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+set_models(const string &dirpath, const PPModelDependencyCache::Models &models) {
+  Index dir_index = intern(dirpath, _pending);
+  Entries &entries = _directories[dir_index];
+
+  set<Index> present;
+  Models::const_iterator mi;
+  for (mi = models.begin(); mi != models.end(); ++mi) {
+    const PPDependableModelFile &dmfile = (*mi).second;
+    Index file_index = intern((*mi).first, _pending);
+    present.insert(file_index);
+
+    Entry new_entry;
+    new_entry._timestamp = dmfile._timestamp;
+    vector_string::const_iterator depi;
+    for (depi = dmfile._dependencies.begin();
+         depi != dmfile._dependencies.end();
+         ++depi) {
+      new_entry._dependencies.push_back(intern(*depi, _pending));
+    }
+
+    Entries::iterator ei = entries.find(file_index);
+    if (ei != entries.end() &&
+        (*ei).second._timestamp == new_entry._timestamp &&
+        (*ei).second._dependencies == new_entry._dependencies) {
+      // No change.
+      continue;
+    }
+
+    entries[file_index] = move(new_entry);
+    write_entry(dir_index, file_index, _pending);
+  }
+
+  // Remove any entries that are no longer present.
+  Entries::iterator ei = entries.begin();
+  while (ei != entries.end()) {
+    if (present.count((*ei).first) == 0) {
+      write_delete(dir_index, (*ei).first, _pending);
+      entries.erase(ei++);
+    } else {
+      ++ei;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::parse
+//       Access: Private
+//  Description: Decodes the contents of the cache file.  If the file
+//               is damaged or truncated, whatever could be decoded
+//               before the damage is kept, and the file is marked to
+//               be rewritten.  Returns false if the file was not a
+//               valid cache file at all.
+////////////////////////////////////////////////////////////////////
+bool PPModelDependencyCache::
+parse(const unsigned char *data, size_t size) {
+  const unsigned char *p = data;
+  const unsigned char *end = data + size;
+
+  if (size < 8 || memcmp(p, cache_magic, 4) != 0) {
+    cerr << _filename << " is not a model dependency cache file.\n";
+    _needs_rewrite = true;
+    return false;
+  }
+  p += 4;
+
+  unsigned int version =
+    (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+    ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+  p += 4;
+  if (version != cache_version) {
+    if (verbose) {
+      cerr << "Ignoring model dependency cache " << _filename
+           << " from a different version of ppremake.\n";
+    }
+    _needs_rewrite = true;
+    return true;
+  }
+
+  // A few helpers to decode the fields of each record, while
+  // checking that we don't run off the end.
+  bool ok = true;
+  auto get_uint32 = [&]() -> unsigned int {
+    if (end - p < 4) {
+      ok = false;
+      return 0;
+    }
+    unsigned int value =
+      (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+      ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+    p += 4;
+    return value;
+  };
+  auto get_index = [&]() -> Index {
+    Index index = get_uint32();
+    if (index >= _strings.size()) {
+      ok = false;
+    }
+    return index;
+  };
+
+  while (ok && p < end) {
+    unsigned char type = *p;
+    ++p;
+
+    switch (type) {
+    case RT_string:
+      {
+        unsigned int length = get_uint32();
+        if (!ok || (size_t)(end - p) < length) {
+          ok = false;
+          break;
+        }
+        string str((const char *)p, length);
+        p += length;
+        _string_index[str] = (Index)_strings.size();
+        _strings.push_back(move(str));
+      }
+      break;
+
+    case RT_entry:
+      {
+        Index dir_index = get_index();
+        Index file_index = get_index();
+        unsigned int lo = get_uint32();
+        unsigned int hi = get_uint32();
+        unsigned int num_deps = get_uint32();
+        if (!ok || (size_t)(end - p) / 4 < num_deps) {
+          ok = false;
+          break;
+        }
+
+        Entry entry;
+        entry._timestamp = (time_t)(((long long)hi << 32) | lo);
+        entry._dependencies.reserve(num_deps);
+        for (unsigned int i = 0; i < num_deps && ok; ++i) {
+          entry._dependencies.push_back(get_index());
+        }
+        if (ok) {
+          _directories[dir_index][file_index] = move(entry);
+          ++_num_records;
+        }
+      }
+      break;
+
+    case RT_delete:
+      {
+        Index dir_index = get_index();
+        Index file_index = get_index();
+        if (ok) {
+          _directories[dir_index].erase(file_index);
+          ++_num_records;
+        }
+      }
+      break;
+
+    default:
+      ok = false;
+    }
+  }
+
+  if (!ok) {
+    // Probably we were interrupted while appending to the file last
+    // time.  Keep what we have, but don't append to the damaged file.
+    cerr << "Model dependency cache " << _filename
+         << " is damaged; it will be rewritten.\n";
+    _needs_rewrite = true;
+  }
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::intern
+//       Access: Private
+//  Description: Returns the index number of the indicated string in
+//               the string table, adding it (and recording a new
+//               string record in the indicated buffer) if it is not
+//               already there.
+////////////////////////////////////////////////////////////////////
+PPModelDependencyCache::Index PPModelDependencyCache::
+intern(const string &str, string &records) {
+  StringIndex::const_iterator si = _string_index.find(str);
+  if (si != _string_index.end()) {
+    return (*si).second;
+  }
+
+  Index index = (Index)_strings.size();
+  _strings.push_back(str);
+  _string_index[str] = index;
+
+  records += (char)RT_string;
+  write_uint32(records, (unsigned int)str.length());
+  records += str;
+  return index;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::write_entry
+//       Access: Private
+//  Description: Records the current dependencies of the indicated
+//               model in the indicated buffer.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+write_entry(Index dirpath, Index filename, string &records) const {
+  const Entry &entry = (*(*_directories.find(dirpath)).second.find(filename)).second;
+
+  records += (char)RT_entry;
+  write_uint32(records, dirpath);
+  write_uint32(records, filename);
+  write_int64(records, (long long)entry._timestamp);
+  write_uint32(records, (unsigned int)entry._dependencies.size());
+  vector<Index>::const_iterator depi;
+  for (depi = entry._dependencies.begin();
+       depi != entry._dependencies.end();
+       ++depi) {
+    write_uint32(records, *depi);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::write_delete
+//       Access: Private
+//  Description: Records that the indicated model has been removed
+//               from the cache.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+write_delete(Index dirpath, Index filename, string &records) const {
+  records += (char)RT_delete;
+  write_uint32(records, dirpath);
+  write_uint32(records, filename);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::compact
+//       Access: Private
+//  Description: Rewrites the entire cache file from scratch, keeping
+//               only the current entry for each model and only the
+//               strings still in use.  The file is replaced
+//               atomically, so an interrupted write won't damage the
+//               existing file, and another ppremake reading it at the
+//               same time sees either the old file or the new one.
+////////////////////////////////////////////////////////////////////
+bool PPModelDependencyCache::
+compact() {
+  // Build a new string table along with the new file.
+  PPModelDependencyCache fresh(_context, _filename);
+  string records(cache_magic, 4);
+  write_uint32(records, cache_version);
+
+  Directories::const_iterator di;
+  for (di = _directories.begin(); di != _directories.end(); ++di) {
+    const Entries &entries = (*di).second;
+    if (entries.empty()) {
+      continue;
+    }
+    Index dir_index = fresh.intern(_strings[(*di).first], records);
+    Entries::const_iterator ei;
+    for (ei = entries.begin(); ei != entries.end(); ++ei) {
+      const Entry &entry = (*ei).second;
+      Index file_index = fresh.intern(_strings[(*ei).first], records);
+
+      Entry new_entry;
+      new_entry._timestamp = entry._timestamp;
+      vector<Index>::const_iterator depi;
+      for (depi = entry._dependencies.begin();
+           depi != entry._dependencies.end();
+           ++depi) {
+        new_entry._dependencies.push_back(fresh.intern(_strings[*depi], records));
+      }
+      fresh._directories[dir_index][file_index] = move(new_entry);
+      fresh.write_entry(dir_index, file_index, records);
+      ++fresh._num_records;
+    }
+  }
+
+  if (verbose) {
+    cerr << "Writing model dependency cache " << _filename << "\n";
+  }
+
+  if (!_filename.atomic_write_contents(records)) {
+    cerr << "Cannot write model dependency cache " << _filename << "\n";
+    return false;
+  }
+
+  _strings.swap(fresh._strings);
+  _string_index.swap(fresh._string_index);
+  _directories.swap(fresh._directories);
+  _num_records = fresh._num_records;
+  _pending = string();
+  _needs_rewrite = false;
+  _file_size = (off_t)records.size();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::write_uint32
+//       Access: Private, Static
+//  Description: Appends a 32-bit integer to the buffer, in
+//               little-endian order.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+write_uint32(string &records, unsigned int value) {
+  records += (char)(value & 0xff);
+  records += (char)((value >> 8) & 0xff);
+  records += (char)((value >> 16) & 0xff);
+  records += (char)((value >> 24) & 0xff);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::write_int64
+//       Access: Private, Static
+//  Description: Appends a 64-bit integer to the buffer, as two 32-bit
+//               halves, low half first.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+write_int64(string &records, long long value) {
+  unsigned long long u = (unsigned long long)value;
+  write_uint32(records, (unsigned int)(u & 0xffffffff));
+  write_uint32(records, (unsigned int)(u >> 32));
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPModelDependencyCache::stat_files
+//       Access: Private
+//  Description: Determines the modification time of each of the
+//               named files within the indicated directory, filling
+//               mtimes with one entry per filename.  A file that does
+//               not exist, or is not a regular file, gets an mtime of
+//               0.  Where the system supports it, the directory is
+//               opened only once, and each file is looked up relative
+//               to it.
+////////////////////////////////////////////////////////////////////
+void PPModelDependencyCache::
+stat_files(const string &dir_fullpath, const vector<string> &filenames,
+           vector<time_t> &mtimes) const {
+  mtimes.assign(filenames.size(), 0);
+  _context->get_output_queue()->wait_for_directory(Filename(dir_fullpath));
+
+#ifdef HAVE_FSTATAT
+  int dirfd = open(Filename(dir_fullpath).to_os_specific().c_str(),
+                   O_RDONLY | O_DIRECTORY);
+  if (dirfd < 0) {
+    // The whole directory is gone.
+    return;
+  }
+
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    struct stat st;
+    if (fstatat(dirfd, filenames[i].c_str(), &st, 0) == 0 &&
+        S_ISREG(st.st_mode)) {
+      mtimes[i] = st.st_mtime;
+    }
+  }
+  close(dirfd);
+
+#else  // HAVE_FSTATAT
+  for (size_t i = 0; i < filenames.size(); ++i) {
+    Filename fullpath(dir_fullpath, filenames[i]);
+    if (fullpath.is_regular_file()) {
+      mtimes[i] = fullpath.get_timestamp();
+    }
+  }
+#endif  // HAVE_FSTATAT
+}
@@ -0,0 +1,95 @@
+// Filename: ppModelDependencyCache.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPMODELDEPENDENCYCACHE_H
+#define PPMODELDEPENDENCYCACHE_H
+
+#include "ppremake.h"
+#include "ppDirectory.h"
+#include "filename.h"
+
+#include <map>
+#include <vector>
+
+class PPContext;
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPModelDependencyCache
+// Description : A single cache of model dependencies for all of the
+//               directories in a source tree, stored in one binary
+//               file.  This is used in place of the per-directory
+//               MODEL_DEPENDENCY_CACHE_FILENAME files when
+//               $[MODEL_DEPENDENCY_TREE_CACHE_FILENAME] is defined.
+//
+//               The file is a log of records: each distinct string
+//               (directory name, filename, or dependency) is stored
+//               only once, and subsequently referenced by index; and
+//               each time a model's dependencies change, a new record
+//               is simply appended to the end of the file, replacing
+//               any previous record for that model.  The file is
+//               rewritten from scratch only when it has accumulated
+//               too many replaced records, or when another ppremake
+//               has changed it since we read it.
+////////////////////////////////////////////////////////////////////
+class PPModelDependencyCache {
+public:
+  typedef map<string, PPDependableModelFile> Models;
+
+  PPModelDependencyCache(PPContext *context, const Filename &filename);
+
+  const Filename &get_filename() const;
+
+  bool read();
+  bool write();
+  void clear();
+
+  void get_models(const string &dirpath, const string &dir_fullpath,
+                  Models &models);
+  void set_models(const string &dirpath, const Models &models);
+
+private:
+  typedef unsigned int Index;
+
+  bool parse(const unsigned char *data, size_t size);
+  Index intern(const string &str, string &records);
+  void write_entry(Index dirpath, Index filename, string &records) const;
+  void write_delete(Index dirpath, Index filename, string &records) const;
+  bool compact();
+
+  static void write_uint32(string &records, unsigned int value);
+  static void write_int64(string &records, long long value);
+  void stat_files(const string &dir_fullpath,
+                  const vector<string> &filenames,
+                  vector<time_t> &mtimes) const;
+
+  class Entry {
+  public:
+    time_t _timestamp;
+    vector<Index> _dependencies;
+  };
+  typedef map<Index, Entry> Entries;
+  typedef map<Index, Entries> Directories;
+
+  PPContext *_context;
+  Filename _filename;
+
+  typedef vector<string> Strings;
+  Strings _strings;
+  typedef map<string, Index> StringIndex;
+  StringIndex _string_index;
+
+  Directories _directories;
+
+  // The number of entry records in the file (including those that
+  // have since been replaced), and the records yet to be appended.
+  int _num_records;
+  string _pending;
+  bool _needs_rewrite;
+
+  // The size of the file as we last read or wrote it.
+  off_t _file_size;
+};
+
+#endif
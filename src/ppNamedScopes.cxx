@@ -6,6 +6,7 @@
 #include "ppNamedScopes.h"
 #include "ppScope.h"
 #include "ppDirectory.h"
+#include "ppDirectoryTree.h"
 
 #include <assert.h>
 #include <algorithm>
@@ -46,19 +47,33 @@ public:
 ////////////////////////////////////////////////////////////////////
 //     Function: PPNamedScopes::Constructor
 //       Access: Public
-//  Description:
+//  Description: The scopes made by make_scope() will belong to the
+//               indicated context.
 ////////////////////////////////////////////////////////////////////
 PPNamedScopes::
-PPNamedScopes() {
+PPNamedScopes(PPContext *context) :
+  _context(context)
+{
+  _lazy_tree = (PPDirectoryTree *)NULL;
 }
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPNamedScopes::Destructor
 //       Access: Public
-//  Description:
+//  Description: Deletes all of the scopes made by make_scope().
 ////////////////////////////////////////////////////////////////////
 PPNamedScopes::
 ~PPNamedScopes() {
+  Directories::iterator di;
+  for (di = _directories.begin(); di != _directories.end(); ++di) {
+    Named::iterator ni;
+    for (ni = (*di).second.begin(); ni != (*di).second.end(); ++ni) {
+      Scopes::iterator si;
+      for (si = (*ni).second.begin(); si != (*ni).second.end(); ++si) {
+        delete (*si);
+      }
+    }
+  }
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -69,7 +84,7 @@ PPNamedScopes::
 ////////////////////////////////////////////////////////////////////
 PPScope *PPNamedScopes::
 make_scope(const string &name) {
-  PPScope *scope = new PPScope(this);
+  PPScope *scope = new PPScope(_context, this);
   // Store the scope name in a variable on the scope, so the name can be
   // queried by .pp scripts (for instance, during a #forscopes).
   scope->define_variable("SCOPE", name);
@@ -89,13 +104,17 @@ make_scope(const string &name) {
 //               directory names.  If omitted, the current directory
 //               name is implied.
 //
+//               If a lazy tree has been set, this first asks it to
+//               load the directories the query names, which may mean
+//               reading more source files.
+//
 //               It is the responsibility of the user to ensure that
 //               scopes is empty before calling this function; this
 //               will append to the existing vector without first
 //               clearing it.
 ////////////////////////////////////////////////////////////////////
 void PPNamedScopes::
-get_scopes(const string &name, Scopes &scopes) const {
+get_scopes(const string &name, Scopes &scopes) {
   string dirname = _current;
   string scopename = name;
 
@@ -108,6 +127,10 @@ get_scopes(const string &name, Scopes &scopes) const {
     }
   }
 
+  if (_lazy_tree != (PPDirectoryTree *)NULL) {
+    _lazy_tree->load_scopes(dirname);
+  }
+
   Directories::const_iterator di;
 
   if (dirname == SCOPE_DIRNAME_WILDCARD) {
@@ -146,6 +169,30 @@ set_current(const string &dirname) {
   _current = dirname;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPNamedScopes::get_current
+//       Access: Public
+//  Description: Returns the currently-active directory, as set by
+//               set_current().
+////////////////////////////////////////////////////////////////////
+const string &PPNamedScopes::
+get_current() const {
+  return _current;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPNamedScopes::set_lazy_tree
+//       Access: Public
+//  Description: Indicates the directory tree that should be asked to
+//               load any directories named by get_scopes() before
+//               they are looked up.  See
+//               PPDirectoryTree::set_lazy().
+////////////////////////////////////////////////////////////////////
+void PPNamedScopes::
+set_lazy_tree(PPDirectoryTree *tree) {
+  _lazy_tree = tree;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPNamedScopes::p_get_scopes
 //       Access: Private
@@ -11,7 +11,9 @@
 #include <map>
 #include <vector>
 
+class PPContext;
 class PPScope;
+class PPDirectoryTree;
 
 ///////////////////////////////////////////////////////////////////
 //       Class : PPNamedScopes
@@ -22,16 +24,19 @@ class PPScope;
 ////////////////////////////////////////////////////////////////////
 class PPNamedScopes {
 public:
-  PPNamedScopes();
+  PPNamedScopes(PPContext *context);
   ~PPNamedScopes();
 
   typedef vector<PPScope *> Scopes;
 
   PPScope *make_scope(const string &name);
-  void get_scopes(const string &name, Scopes &scopes) const;
+  void get_scopes(const string &name, Scopes &scopes);
   static void sort_by_dependency(Scopes &scopes);
 
   void set_current(const string &dirname);
+  const string &get_current() const;
+
+  void set_lazy_tree(PPDirectoryTree *tree);
 
 private:  
   typedef map<string, Scopes> Named;
@@ -39,9 +44,12 @@ private:
   void p_get_scopes(const Named &named, const string &name,
                     Scopes &scopes) const;
 
+  PPContext *_context;
+
   typedef map<string, Named> Directories;
   Directories _directories;
   string _current;
+  PPDirectoryTree *_lazy_tree;
 };
 
 #endif
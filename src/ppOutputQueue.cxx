@@ -0,0 +1,419 @@
+// Filename: ppOutputQueue.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppOutputQueue.h"
+#include "executionEnvironment.h"
+#include "globPattern.h"
+#include "ppProfiler.h"
+#include "ppStats.h"
+#include "ppTrace.h"
+#include "shellCommand.h"
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::set_max_jobs
+//       Access: Public
+//  Description: Changes the number of I/O threads that may be used to
+//               commit files.  If this is 0, files are committed
+//               immediately by add().  This only limits the threads
+//               started from now on; it does not stop any that are
+//               already running.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+set_max_jobs(int max_jobs) {
+  _max_jobs = (max_jobs > 0) ? max_jobs : 0;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::add
+//       Access: Public
+//  Description: Queues up the indicated contents to be committed to
+//               the indicated file: the file is replaced if its
+//               contents differ, and otherwise it is touched (unless
+//               notouch is true) or left alone.
+//
+//               If the same file is already waiting to be committed,
+//               this waits for that to finish first, so that the
+//               last contents generated always win.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+add(const Filename &filename, const string &contents, bool notouch) {
+  Job *job = new Job;
+  job->_name = filename.get_fullpath();
+  job->_filename = filename;
+  if (filename.is_local()) {
+    // We may have changed directories by the time the job runs.
+    job->_filename = Filename(ExecutionEnvironment::get_cwd(), filename);
+  }
+  if (filename.is_binary()) {
+    job->_filename.set_binary();
+  } else {
+    job->_filename.set_text();
+  }
+  job->_contents = contents;
+  job->_notouch = notouch;
+  job->_pending_name = get_pending_name(filename);
+
+  if (_max_jobs == 0) {
+    if (!commit(*job)) {
+      _failed = true;
+    }
+    delete job;
+    return;
+  }
+
+  unique_lock<mutex> guard(_lock);
+  while (_jobs.size() >= max_queued ||
+         _pending.find(job->_pending_name) != _pending.end()) {
+    _done_cvar.wait(guard);
+  }
+
+  _pending.insert(job->_pending_name);
+  _jobs.push_back(job);
+  if ((int)_threads.size() < _max_jobs) {
+    _threads.push_back(thread(&PPOutputQueue::thread_main, this));
+  }
+  _job_cvar.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::wait_for
+//       Access: Public
+//  Description: If the indicated file is waiting to be committed,
+//               waits until it has been.  This should be called
+//               before reading, or asking the filesystem about, any
+//               file that we might have generated earlier in the same
+//               session.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+wait_for(const Filename &filename) {
+  unique_lock<mutex> guard(_lock);
+  if (_pending.empty()) {
+    return;
+  }
+
+  string fullpath = get_pending_name(filename);
+  while (_pending.find(fullpath) != _pending.end()) {
+    _done_cvar.wait(guard);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::wait_for_directory
+//       Access: Public
+//  Description: Waits until none of the files waiting to be committed
+//               are in the indicated directory.  This should be
+//               called before listing the directory.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+wait_for_directory(const Filename &dirname) {
+  unique_lock<mutex> guard(_lock);
+  if (_pending.empty()) {
+    return;
+  }
+
+  string prefix = get_pending_name(dirname);
+  if (prefix.empty() || prefix[prefix.length() - 1] != '/') {
+    prefix += '/';
+  }
+
+  // The pending names are sorted, so those in the directory (or its
+  // subdirectories) follow the prefix immediately.
+  for (;;) {
+    bool found = false;
+    Pending::const_iterator pi = _pending.lower_bound(prefix);
+    for (; pi != _pending.end() &&
+           (*pi).compare(0, prefix.length(), prefix) == 0; ++pi) {
+      if ((*pi).find('/', prefix.length()) == string::npos) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      return;
+    }
+    _done_cvar.wait(guard);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::wait_for_matches
+//       Access: Public
+//  Description: Waits until none of the files waiting to be committed
+//               match the indicated glob pattern, which is taken
+//               relative to the current directory.  This should be
+//               called before expanding the pattern.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+wait_for_matches(const string &pattern) {
+  unique_lock<mutex> guard(_lock);
+  if (_pending.empty()) {
+    return;
+  }
+
+  GlobPattern glob(get_pending_name(Filename(pattern)));
+  for (;;) {
+    bool found = false;
+    Pending::const_iterator pi;
+    for (pi = _pending.begin(); pi != _pending.end() && !found; ++pi) {
+      found = glob.matches(*pi);
+    }
+    if (!found) {
+      return;
+    }
+    _done_cvar.wait(guard);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::flush
+//       Access: Public
+//  Description: Waits for all of the queued files to be committed,
+//               and stops the I/O threads.  Returns true if all of
+//               the files since the last call to flush() were
+//               committed successfully, or false if any of them
+//               failed.
+////////////////////////////////////////////////////////////////////
+bool PPOutputQueue::
+flush() {
+  PPProfiler::Frame frame("io", "flush");
+  PPTrace::Span span("output", "flush");
+  {
+    unique_lock<mutex> guard(_lock);
+    _shutdown = true;
+    _job_cvar.notify_all();
+  }
+
+  vector<thread>::iterator ti;
+  for (ti = _threads.begin(); ti != _threads.end(); ++ti) {
+    (*ti).join();
+  }
+  _threads.clear();
+  _shutdown = false;
+
+  bool okflag = !_failed;
+  _failed = false;
+  return okflag;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::describe_difference
+//       Access: Public, Static
+//  Description: Returns a message for --explain that says where the
+//               new contents of the named file first differ from its
+//               original contents, quoting the line in both versions.
+//
+//               orig_contents holds the first orig_len bytes already
+//               read from in; whatever remains of the original file
+//               is read from in as well, so the message describes
+//               the whole file.
+////////////////////////////////////////////////////////////////////
+string PPOutputQueue::
+describe_difference(const string &name, istream &in,
+                    const char *orig_contents, size_t orig_len,
+                    const string &new_contents) {
+  string orig_string(orig_contents, orig_len);
+  char buffer[4096];
+  in.read(buffer, sizeof(buffer));
+  while (in.gcount() > 0) {
+    orig_string.append(buffer, in.gcount());
+    in.read(buffer, sizeof(buffer));
+  }
+  orig_contents = orig_string.data();
+  orig_len = orig_string.length();
+
+  size_t new_len = new_contents.length();
+  size_t p = 0;
+  while (p < orig_len && p < new_len && orig_contents[p] == new_contents[p]) {
+    ++p;
+  }
+
+  // Find the line containing the first difference.
+  int line_number = 1;
+  size_t line_start = 0;
+  for (size_t i = 0; i < p; ++i) {
+    if (new_contents[i] == '\n') {
+      ++line_number;
+      line_start = i + 1;
+    }
+  }
+
+  ostringstream message;
+  message << "Explain: " << name << " differs at line " << line_number
+          << ", byte " << p << " (was " << orig_len << " bytes, now "
+          << new_len << ").\n";
+
+  // Quote the line, or as much of it as is reasonable, as it was and
+  // as it is now.
+  static const size_t max_quote = 72;
+  string orig_line(orig_contents + line_start, orig_len - line_start);
+  string new_line = new_contents.substr(line_start);
+  orig_line = orig_line.substr(0, orig_line.find('\n'));
+  new_line = new_line.substr(0, new_line.find('\n'));
+
+  message << "  was: ";
+  if (line_start >= orig_len) {
+    message << "(end of file)";
+  } else {
+    message << orig_line.substr(0, max_quote);
+  }
+  message << "\n  now: ";
+  if (line_start >= new_len) {
+    message << "(end of file)";
+  } else {
+    message << new_line.substr(0, max_quote);
+  }
+  message << "\n";
+
+  return message.str();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPOutputQueue::
+PPOutputQueue() {
+  _max_jobs = ShellCommand::get_default_jobs();
+  _shutdown = false;
+  _failed = false;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::Destructor
+//       Access: Public
+//  Description: Commits any files still queued and stops the I/O
+//               threads.
+////////////////////////////////////////////////////////////////////
+PPOutputQueue::
+~PPOutputQueue() {
+  flush();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::thread_main
+//       Access: Private
+//  Description: The body of each I/O thread: commits queued files
+//               until the queue is empty and flush() has been
+//               called.
+////////////////////////////////////////////////////////////////////
+void PPOutputQueue::
+thread_main() {
+  unique_lock<mutex> guard(_lock);
+  for (;;) {
+    while (_jobs.empty() && !_shutdown) {
+      _job_cvar.wait(guard);
+    }
+    if (_jobs.empty()) {
+      return;
+    }
+
+    Job *job = _jobs.front();
+    _jobs.pop_front();
+
+    guard.unlock();
+    bool okflag = commit(*job);
+    guard.lock();
+
+    if (!okflag) {
+      _failed = true;
+    }
+    _pending.erase(job->_pending_name);
+    delete job;
+    _done_cvar.notify_all();
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::get_pending_name
+//       Access: Private
+//  Description: Returns the name under which the indicated file would
+//               be recorded in _pending: its full path, relative to
+//               the current directory if it is local, with any "."
+//               and ".." components removed.
+////////////////////////////////////////////////////////////////////
+string PPOutputQueue::
+get_pending_name(const Filename &filename) const {
+  Filename fullpath = filename;
+  if (fullpath.is_local()) {
+    fullpath = Filename(ExecutionEnvironment::get_cwd(), filename);
+  }
+  fullpath.standardize();
+  return fullpath.get_fullpath();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPOutputQueue::commit
+//       Access: Private
+//  Description: Compares the job's contents to the file already on
+//               disk, and replaces the file if they differ.  Returns
+//               true on success, false on failure.
+//
+//               This may be called from any of the I/O threads, so
+//               each message is composed first and written in one
+//               piece.
+////////////////////////////////////////////////////////////////////
+bool PPOutputQueue::
+commit(const Job &job) {
+  PPTrace::Span span("output", job._name);
+  const Filename &filename = job._filename;
+  const string &name = job._name;
+  const string &new_contents = job._contents;
+
+  bool exists = filename.exists();
+  bool differ = false;
+
+  if (exists) {
+    size_t len = new_contents.length();
+    size_t want_bytes = len + 1;
+
+    ifstream in;
+    if (!filename.open_read(in)) {
+      cerr << "Cannot read existing " + name +
+        ", regenerating.\n";
+      differ = true;
+    } else {
+      if (verbose) {
+        cerr << "Reading (cmp) \"" + name + "\"\n";
+      }
+      char *orig_contents = new char[want_bytes];
+      in.read(orig_contents, want_bytes);
+
+      if ((size_t)in.gcount() != len) {
+        // The wrong number of bytes.
+        differ = true;
+
+      } else {
+        differ = (memcmp(orig_contents, new_contents.data(), len) != 0);
+      }
+      if (differ && explain) {
+        cerr << describe_difference(name, in, orig_contents, in.gcount(),
+                                    new_contents);
+      }
+      delete[] orig_contents;
+    }
+    PPStats::count(PPStats::C_outputs_compared);
+
+  } else if (explain) {
+    cerr << "Explain: " + name + " does not exist yet.\n";
+  }
+
+  if (differ || !exists) {
+    cerr << "Generating " + name + "\n";
+    PPStats::count(PPStats::C_outputs_written);
+    return filename.atomic_write_contents(new_contents);
+  }
+
+  // Even though the file is unchanged, unless the "notouch" flag is
+  // set, we want to update the modification time.  This helps the
+  // makefiles know we did something.
+  if (!job._notouch) {
+    if (!filename.touch()) {
+      cerr << "Warning: unable to update timestamp for " + name + "\n";
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,95 @@
+// Filename: ppOutputQueue.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPOUTPUTQUEUE_H
+#define PPOUTPUTQUEUE_H
+
+#include "ppremake.h"
+#include "filename.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPOutputQueue
+// Description : The commit stage for the files generated by #output
+//               (and #concatcxx).  Each generated file is handed off
+//               here as soon as it is complete, and a handful of I/O
+//               threads compare it to the file already on disk and
+//               replace it if it differs, while the main thread
+//               carries on interpreting the templates.
+//
+//               A file is always replaced by writing a temporary file
+//               and renaming it into place, so an interrupted run
+//               never leaves a half-written makefile behind.
+//
+//               The number of I/O threads is given by
+//               $[OUTPUT_JOBS]; if this is 0, each file is committed
+//               immediately, in the main thread.
+//
+//               Whatever asks the filesystem about a file that might
+//               still be waiting to be committed--$[wildcard] and the
+//               like, the dependency scan, #include--waits here
+//               first, so that ppremake always sees the files it has
+//               generated.
+////////////////////////////////////////////////////////////////////
+class PPOutputQueue {
+public:
+  PPOutputQueue();
+  ~PPOutputQueue();
+
+  void set_max_jobs(int max_jobs);
+
+  void add(const Filename &filename, const string &contents, bool notouch);
+  void wait_for(const Filename &filename);
+  void wait_for_directory(const Filename &dirname);
+  void wait_for_matches(const string &pattern);
+  bool flush();
+
+  static string describe_difference(const string &name, istream &in,
+                                    const char *orig_contents,
+                                    size_t orig_len,
+                                    const string &new_contents);
+
+private:
+  class Job {
+  public:
+    string _name;
+    Filename _filename;
+    string _contents;
+    bool _notouch;
+    string _pending_name;
+  };
+
+  void thread_main();
+  bool commit(const Job &job);
+  string get_pending_name(const Filename &filename) const;
+
+  // The most jobs we allow to be queued up (and held in memory)
+  // before add() waits for the I/O threads to catch up.
+  enum { max_queued = 64 };
+
+  mutex _lock;
+  condition_variable _job_cvar;
+  condition_variable _done_cvar;
+
+  typedef deque<Job *> Jobs;
+  Jobs _jobs;
+
+  // The full paths of the files that are queued or being written.
+  typedef set<string> Pending;
+  Pending _pending;
+
+  vector<thread> _threads;
+  int _max_jobs;
+  bool _shutdown;
+  bool _failed;
+};
+
+#endif
@@ -0,0 +1,238 @@
+// Filename: ppProfiler.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppProfiler.h"
+#include "filename.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <stdio.h>
+
+PPProfiler *PPProfiler::_global_ptr = (PPProfiler *)NULL;
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::Stats::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPProfiler::Stats::
+Stats() {
+  _count = 0;
+  _depth = 0;
+  _inclusive = 0.0;
+  _exclusive = 0.0;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::enable
+//       Access: Public, Static
+//  Description: Turns on profiling for the rest of the session.  The
+//               report will be written to basename.txt, and the
+//               collapsed stacks to basename.folded, by
+//               write_report().
+////////////////////////////////////////////////////////////////////
+void PPProfiler::
+enable(const string &basename) {
+  if (_global_ptr == (PPProfiler *)NULL) {
+    _global_ptr = new PPProfiler(basename);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::write_report
+//       Access: Public, Static
+//  Description: Writes out the results gathered so far, if profiling
+//               is enabled.  Returns true on success (or if there is
+//               nothing to do), false on failure.
+////////////////////////////////////////////////////////////////////
+bool PPProfiler::
+write_report() {
+  if (!is_enabled()) {
+    return true;
+  }
+  PPProfiler *prof = _global_ptr;
+  double total = prof->get_time() - prof->_start;
+
+  vector<const Stats *> sorted;
+  map<string, Stats> categories;
+  StatsMap::const_iterator si;
+  for (si = prof->_stats.begin(); si != prof->_stats.end(); ++si) {
+    const Stats &stats = (*si).second;
+    sorted.push_back(&stats);
+
+    Stats &cat = categories[stats._category];
+    cat._count += stats._count;
+    cat._exclusive += stats._exclusive;
+  }
+  // Most exclusive time first.
+  sort(sorted.begin(), sorted.end(), [](const Stats *a, const Stats *b) {
+    return a->_exclusive > b->_exclusive;
+  });
+
+  Filename report_filename = Filename::text_filename(prof->_basename + ".txt");
+  ofstream out;
+  if (!report_filename.open_write(out)) {
+    cerr << "Unable to write profile report " << report_filename << "\n";
+    return false;
+  }
+
+  char buffer[128];
+  sprintf(buffer, "%.3f", total);
+  out << "ppremake profile: " << buffer << " s total\n\n"
+      << "Times are wall-clock milliseconds.  Self time excludes the time\n"
+      << "spent in nested entries; total time includes it.\n\n";
+
+  out << "By category:\n\n"
+      << "     self ms      calls  category\n";
+  map<string, Stats>::const_iterator ci;
+  for (ci = categories.begin(); ci != categories.end(); ++ci) {
+    sprintf(buffer, "%12.1f %10d  ", (*ci).second._exclusive * 1000.0,
+            (*ci).second._count);
+    out << buffer << (*ci).first << "\n";
+  }
+
+  out << "\nBy entry:\n\n"
+      << "     self ms    total ms      calls  category  name\n";
+  vector<const Stats *>::const_iterator vi;
+  for (vi = sorted.begin(); vi != sorted.end(); ++vi) {
+    const Stats *stats = (*vi);
+    sprintf(buffer, "%12.1f%12.1f %10d  ", stats->_exclusive * 1000.0,
+            stats->_inclusive * 1000.0, stats->_count);
+    out << buffer << stats->_category << "  " << stats->_name << "\n";
+  }
+
+  if (!out) {
+    cerr << "Unable to write profile report " << report_filename << "\n";
+    return false;
+  }
+  out.close();
+
+  Filename folded_filename = Filename::text_filename(prof->_basename + ".folded");
+  if (!folded_filename.open_write(out)) {
+    cerr << "Unable to write profile stacks " << folded_filename << "\n";
+    return false;
+  }
+
+  // The flame graph tools want integer sample counts; we use
+  // microseconds.
+  Paths::const_iterator pi;
+  for (pi = prof->_paths.begin(); pi != prof->_paths.end(); ++pi) {
+    long long usec = (long long)((*pi).second * 1000000.0 + 0.5);
+    if (usec > 0) {
+      out << "ppremake" << (*pi).first << " " << usec << "\n";
+    }
+  }
+
+  if (!out) {
+    cerr << "Unable to write profile stacks " << folded_filename << "\n";
+    return false;
+  }
+
+  cerr << "Wrote profile to " << report_filename << " and "
+       << folded_filename << "\n";
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::Constructor
+//       Access: Private
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPProfiler::
+PPProfiler(const string &basename) :
+  _basename(basename)
+{
+  _start = get_time();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::push
+//       Access: Private
+//  Description: Begins a new frame, nested within the current one.
+////////////////////////////////////////////////////////////////////
+void PPProfiler::
+push(const char *category, const string &name, int line_number) {
+  string key = category;
+  key += ' ';
+  key += name;
+  if (line_number != 0) {
+    char buffer[32];
+    sprintf(buffer, ":%d", line_number);
+    key += buffer;
+  }
+
+  Stats &stats = _stats[key];
+  if (stats._count == 0) {
+    stats._category = category;
+    stats._name = key.substr(stats._category.length() + 1);
+  }
+  stats._count++;
+  stats._depth++;
+
+  StackEntry entry;
+  entry._stats = &stats;
+  entry._child_time = 0.0;
+  entry._path_length = _path.length();
+  _stack.push_back(entry);
+
+  // Semicolons separate the frames in the collapsed stack format, and
+  // the last space separates the count, so neither may appear in a
+  // frame name.
+  _path += ';';
+  size_t p = _path.length();
+  _path += key;
+  for (; p < _path.length(); ++p) {
+    if (_path[p] == ';' || _path[p] == ' ' || _path[p] == '\n') {
+      _path[p] = '_';
+    }
+  }
+
+  // Read the clock last, so the bookkeeping above isn't counted.
+  _stack.back()._start = get_time();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::pop
+//       Access: Private
+//  Description: Ends the current frame, and charges its time.
+////////////////////////////////////////////////////////////////////
+void PPProfiler::
+pop() {
+  double now = get_time();
+  assert(!_stack.empty());
+  StackEntry &entry = _stack.back();
+
+  double elapsed = now - entry._start;
+  double exclusive = elapsed - entry._child_time;
+  Stats &stats = *entry._stats;
+  stats._exclusive += exclusive;
+
+  // A frame that is nested within itself (a recursive function) only
+  // counts its outermost call toward its inclusive time.
+  stats._depth--;
+  if (stats._depth == 0) {
+    stats._inclusive += elapsed;
+  }
+
+  _paths[_path] += exclusive;
+  _path.erase(entry._path_length);
+  _stack.pop_back();
+
+  if (!_stack.empty()) {
+    _stack.back()._child_time += elapsed;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPProfiler::get_time
+//       Access: Private
+//  Description: Returns the current wall-clock time in seconds, from
+//               some arbitrary starting point.
+////////////////////////////////////////////////////////////////////
+double PPProfiler::
+get_time() const {
+  return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
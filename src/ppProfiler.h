@@ -0,0 +1,97 @@
+// Filename: ppProfiler.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPPROFILER_H
+#define PPPROFILER_H
+
+#include "ppremake.h"
+
+#include <map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPProfiler
+// Description : Measures where the time goes while the source and
+//               template files are interpreted, for --profile.
+//
+//               Interesting pieces of work are bracketed by a Frame
+//               object, which names the kind of work (its category:
+//               a source line, a subroutine, a built-in function, a
+//               directory, a shell command, and so on) and the
+//               particular instance of it.  For each distinct frame,
+//               we count the calls and total the wall-clock time
+//               spent within it (inclusive) and within it but not in
+//               any nested frame (exclusive).  We also total the
+//               exclusive time by the full stack of frames, which is
+//               written out in the "collapsed stack" format read by
+//               the usual flame graph tools.
+//
+//               When profiling is not enabled, a Frame costs no more
+//               than a test of a pointer.  There is one stack of
+//               frames for the whole process, so profiling must not
+//               be enabled while more than one PPContext is being
+//               evaluated at once.
+////////////////////////////////////////////////////////////////////
+class PPProfiler {
+public:
+  static void enable(const string &basename);
+  INLINE static bool is_enabled();
+  static bool write_report();
+
+  class Frame {
+  public:
+    INLINE Frame(const char *category, const string &name);
+    INLINE Frame(const char *category, const string &name, int line_number);
+    INLINE ~Frame();
+
+  private:
+    bool _active;
+  };
+
+private:
+  PPProfiler(const string &basename);
+
+  void push(const char *category, const string &name, int line_number);
+  void pop();
+  double get_time() const;
+
+  class Stats {
+  public:
+    Stats();
+
+    string _category;
+    string _name;
+    int _count;
+    int _depth;
+    double _inclusive;
+    double _exclusive;
+  };
+  typedef map<string, Stats> StatsMap;
+  StatsMap _stats;
+
+  class StackEntry {
+  public:
+    Stats *_stats;
+    double _start;
+    double _child_time;
+    size_t _path_length;
+  };
+  typedef vector<StackEntry> Stack;
+  Stack _stack;
+
+  // The keys of the frames on the stack, separated by semicolons.
+  string _path;
+  typedef map<string, double> Paths;
+  Paths _paths;
+
+  string _basename;
+  double _start;
+
+  static PPProfiler *_global_ptr;
+};
+
+#include "ppProfiler.I"
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "ppremake.h"
 #include "ppScope.h"
+#include "ppContext.h"
 #include "ppNamedScopes.h"
 #include "ppFilenamePattern.h"
 #include "ppDirectory.h"
@@ -12,11 +13,21 @@
 #include "ppCommandFile.h"
 #include "ppDependableFile.h"
 #include "ppMain.h"
+#include "ppProfiler.h"
+#include "ppOutputQueue.h"
+#include "ppSearchCache.h"
+#include "ppShellCache.h"
+#include "ppStats.h"
+#include "ppTrace.h"
 #include "tokenize.h"
 #include "filename.h"
 #include "dSearchPath.h"
 #include "globPattern.h"
 #include "md5.h"
+#include "sedProcess.h"
+#include "shellCommand.h"
+#include "shellCommandQueue.h"
+#include "shellCoprocess.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -32,6 +43,7 @@
 
 #include <stdlib.h>
 #include <algorithm>
+#include <iterator>
 #include <ctype.h>
 #include <sys/stat.h>
 #include <stdio.h>  // for perror() and sprintf().
@@ -39,8 +51,8 @@
 #include <signal.h>
 #include <assert.h>
 
-#include <array>
 #include <memory>
+#include <set>
 #include <string>
 
 #ifdef WIN32_VC
@@ -52,7 +64,31 @@ static const string variable_patsubst(VARIABLE_PATSUBST);
 PPScope::MapVariableDefinition PPScope::_null_map_def;
 PPScope::DictVariableDefinition PPScope::_null_dict_def;
 
-PPScope::ScopeStack PPScope::_scope_stack;
+atomic<int> PPScope::_next_serial(0);
+
+// Used by expand_dependencies() to sort filenames without copying
+// them.
+class SortStringPointers {
+public:
+  bool operator () (const string *a, const string *b) const {
+    return *a < *b;
+  }
+};
+
+////////////////////////////////////////////////////////////////////
+//       Class : PPScope::Layer
+// Description : The changes made within an Overlay to one frozen
+//               scope.  A variable defined here shadows the one in
+//               the scope itself; a map or dict variable is copied
+//               here in its entirety before it is changed.
+////////////////////////////////////////////////////////////////////
+class PPScope::Layer {
+public:
+  Variables _variables;
+  MapVariables _map_variables;
+  DictVariables _dict_variables;
+  Memos _memos;
+};
 
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::Constructor
@@ -60,11 +96,45 @@ PPScope::ScopeStack PPScope::_scope_stack;
 //  Description:
 ////////////////////////////////////////////////////////////////////
 PPScope::
-PPScope(PPNamedScopes *named_scopes) :
+PPScope(PPContext *context, PPNamedScopes *named_scopes) :
+  _context(context),
   _named_scopes(named_scopes)
 {
   _directory = (PPDirectory *)NULL;
   _parent_scope = (PPScope *)NULL;
+  _serial = ++_next_serial;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::Copy Constructor
+//       Access: Public
+//  Description: Makes a new scope with the same variable definitions
+//               and parent as the other one, as they stand now.
+//               Later changes to either scope do not affect the
+//               other.
+////////////////////////////////////////////////////////////////////
+PPScope::
+PPScope(const PPScope &copy) :
+  _context(copy._context),
+  _named_scopes(copy._named_scopes),
+  _directory(copy._directory),
+  _variables(copy._variables),
+  _map_variables(copy._map_variables),
+  _dict_variables(copy._dict_variables),
+  _parent_scope(copy._parent_scope)
+{
+  _serial = ++_next_serial;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::get_context
+//       Access: Public
+//  Description: Returns the context in which this scope is
+//               evaluated.
+////////////////////////////////////////////////////////////////////
+PPContext *PPScope::
+get_context() const {
+  return _context;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -90,6 +160,10 @@ get_named_scopes() {
 void PPScope::
 set_parent(PPScope *parent) {
   _parent_scope = parent;
+
+  // This changes where variables are found, so no memo can be
+  // trusted.
+  ++_context->_memo_epoch;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -114,7 +188,13 @@ get_parent() {
 ////////////////////////////////////////////////////////////////////
 void PPScope::
 define_variable(const string &varname, const string &definition) {
-  _variables[varname] = definition;
+  Layer *layer = get_layer(true);
+  if (layer != (Layer *)NULL) {
+    layer->_variables[varname] = definition;
+  } else {
+    _variables[varname] = definition;
+  }
+  invalidate_memos(varname);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -133,7 +213,7 @@ set_variable(const string &varname, const string &definition) {
 
   // Check the scopes on the stack for the variable definition.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
     if ((*si)->p_set_variable(varname, definition)) {
       return true;
     }
@@ -145,8 +225,8 @@ set_variable(const string &varname, const string &definition) {
     // It is defined in the environment; thus, it is implicitly
     // defined here at the global scope: the bottom of the stack.
     PPScope *bottom = this;
-    if (!_scope_stack.empty()) {
-      bottom = _scope_stack.front();
+    if (!_context->_scope_stack.empty()) {
+      bottom = _context->_scope_stack.front();
     }
     bottom->define_variable(varname, definition);
     return true;
@@ -193,7 +273,9 @@ define_map_variable(const string &varname, const string &definition) {
 void PPScope::
 define_map_variable(const string &varname, const string &key_varname,
                     const string &scope_names) {
-  MapVariableDefinition &def = _map_variables[varname];
+  Layer *layer = get_layer(true);
+  MapVariableDefinition &def = (layer != (Layer *)NULL) ?
+    layer->_map_variables[varname] : _map_variables[varname];
   def.clear();
   define_variable(varname, "");
 
@@ -254,7 +336,7 @@ define_map_variable(const string &varname, const string &key_varname,
 void PPScope::
 add_to_map_variable(const string &varname, const string &key,
                     PPScope *scope) {
-  MapVariableDefinition &def = find_map_variable(varname);
+  MapVariableDefinition &def = find_map_variable(varname, true);
   if (&def == &_null_map_def) {
     cerr << "Warning:  undefined map variable: " << varname << "\n";
     return;
@@ -281,7 +363,9 @@ add_to_map_variable(const string &varname, const string &key,
 ///////////////////////////////////////////////////////////////////
 void PPScope::
 define_dict_variable(const string &varname) {
-  DictVariableDefinition &def = _dict_variables[varname];
+  Layer *layer = get_layer(true);
+  DictVariableDefinition &def = (layer != (Layer *)NULL) ?
+    layer->_dict_variables[varname] : _dict_variables[varname];
   def.clear();
   define_variable(varname, "");
 }
@@ -295,7 +379,7 @@ define_dict_variable(const string &varname) {
 void PPScope::
 add_to_dict_variable(const string &varname, const string &key,
                      const string &value) {
-  DictVariableDefinition &def = find_dict_variable(varname);
+  DictVariableDefinition &def = find_dict_variable(varname, true);
   if (&def == &_null_dict_def) {
     cerr << "Warning:  Undefined dictionary variable: " << varname << "\n";
     return;
@@ -371,22 +455,28 @@ define_formals(const string &subroutine_name,
 string PPScope::
 get_variable(const string &varname) {
   // Is it a user-defined function?
-  const PPSubroutine *sub = PPSubroutine::get_func(varname);
+  const PPSubroutine *sub = _context->get_func(varname);
   if (sub != (const PPSubroutine *)NULL) {
     return expand_function(varname, sub, string());
   }
 
   //  cerr << "getvar arg is: '" << varname << "'" << endl;
 
+  if (_context->_memo_recorder != (MemoRecorder *)NULL) {
+    memo_read(varname);
+  }
+
   string result;
   if (p_get_variable(varname, result)) {
+    PPStats::count_lookup(0);
     return result;
   }
 
   // Check the scopes on the stack for the variable definition.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
     if ((*si)->p_get_variable(varname, result)) {
+      PPStats::count_lookup((si - _context->_scope_stack.rbegin()) + 1);
       return result;
     }
   }
@@ -394,10 +484,12 @@ get_variable(const string &varname) {
   // If the variable isn't defined, we check the environment.
   const char *env = getenv(varname.c_str());
   if (env != (const char *)NULL) {
+    PPStats::count(PPStats::C_env_lookups);
     return env;
   }
 
   // It's not defined anywhere, so it's implicitly empty.
+  PPStats::count(PPStats::C_undefined_lookups);
   return string();
 }
 
@@ -414,7 +506,7 @@ expand_defined(const string &params) {
 
   if (tokens.size() != 1) {
     cerr << "error: defined requires one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -423,7 +515,7 @@ expand_defined(const string &params) {
   string truestr = "1";
 
   // Is it a user-defined function?
-  const PPSubroutine *sub = PPSubroutine::get_func(varname);
+  const PPSubroutine *sub = _context->get_func(varname);
 
   string nullstr;
 
@@ -441,7 +533,7 @@ expand_defined(const string &params) {
 
   // Check the scopes on the stack for the variable definition.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
     if ((*si)->p_get_variable(varname, result)) {
       return truestr;
     }
@@ -477,16 +569,17 @@ expand_variable(const string &varname) {
 //               not.
 ////////////////////////////////////////////////////////////////////
 PPScope::MapVariableDefinition &PPScope::
-find_map_variable(const string &varname) {
-  MapVariableDefinition &def = p_find_map_variable(varname);
+find_map_variable(const string &varname, bool for_write) {
+  MapVariableDefinition &def = p_find_map_variable(varname, for_write);
   if (&def != &_null_map_def) {
     return def;
   }
 
   // No such map variable.  Check the stack.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
-    MapVariableDefinition &def = (*si)->p_find_map_variable(varname);
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
+    MapVariableDefinition &def =
+      (*si)->p_find_map_variable(varname, for_write);
     if (&def != &_null_map_def) {
       return def;
     }
@@ -505,16 +598,17 @@ find_map_variable(const string &varname) {
 //               not.
 ////////////////////////////////////////////////////////////////////
 PPScope::DictVariableDefinition &PPScope::
-find_dict_variable(const string &varname) {
-  DictVariableDefinition &def = p_find_dict_variable(varname);
+find_dict_variable(const string &varname, bool for_write) {
+  DictVariableDefinition &def = p_find_dict_variable(varname, for_write);
   if (&def != &_null_dict_def) {
     return def;
   }
 
   // No such map variable.  Check the stack.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
-    DictVariableDefinition &def = (*si)->p_find_dict_variable(varname);
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
+    DictVariableDefinition &def =
+      (*si)->p_find_dict_variable(varname, for_write);
     if (&def != &_null_dict_def) {
       return def;
     }
@@ -539,7 +633,7 @@ get_directory() {
 
   // Check the stack.
   ScopeStack::reverse_iterator si;
-  for (si = _scope_stack.rbegin(); si != _scope_stack.rend(); ++si) {
+  for (si = _context->_scope_stack.rbegin(); si != _context->_scope_stack.rend(); ++si) {
     if ((*si)->_directory != (PPDirectory *)NULL) {
       return (*si)->_directory;
     }
@@ -578,7 +672,7 @@ expand_string(const string &str) {
   if (debug_expansions > 0 && str != result) {
     // Look for the str in our table--how many times has this
     // particular string been expanded?
-    ExpandResultCount &result_count = debug_expand[str];
+    ExpandResultCount &result_count = _context->get_debug_expand()[str];
 
     // Then, how many times has it expanded to this same result?
     // First, assuming this is the first time it has expanded to this
@@ -634,65 +728,6 @@ expand_self_reference(const string &str, const string &varname) {
 }
 
 
-////////////////////////////////////////////////////////////////////
-//     Function: PPScope::push_scope
-//       Access: Public, Static
-//  Description: Pushes the indicated scope onto the top of the stack.
-//               When a variable reference is unresolved in the
-//               current scope, the scope stack is searched, in LIFO
-//               order.
-////////////////////////////////////////////////////////////////////
-void PPScope::
-push_scope(PPScope *scope) {
-  _scope_stack.push_back(scope);
-}
-
-////////////////////////////////////////////////////////////////////
-//     Function: PPScope::pop_scope
-//       Access: Public, Static
-//  Description: Pops another level off the top of the stack.  See
-//               push_scope().
-////////////////////////////////////////////////////////////////////
-PPScope *PPScope::
-pop_scope() {
-  assert(!_scope_stack.empty());
-  PPScope *back = _scope_stack.back();
-  _scope_stack.pop_back();
-  return back;
-}
-
-////////////////////////////////////////////////////////////////////
-//     Function: PPScope::get_bottom_scope
-//       Access: Public, Static
-//  Description: Returns the scope on the bottom of the stack.  This
-//               was the very first scope ever pushed, e.g. the global
-//               scope.
-////////////////////////////////////////////////////////////////////
-PPScope *PPScope::
-get_bottom_scope() {
-  assert(!_scope_stack.empty());
-  return _scope_stack.front();
-}
-
-////////////////////////////////////////////////////////////////////
-//     Function: PPScope::get_enclosing_scope
-//       Access: Public, Static
-//  Description: Returns the scope n below the top of the stack, or
-//               the bottom scope if the stack has exactly n or fewer
-//               scopes.
-//
-//               This will be the scope associated with the nth
-//               enclosing syntax in the source file.
-////////////////////////////////////////////////////////////////////
-PPScope *PPScope::
-get_enclosing_scope(int n) {
-  assert(n >= 0);
-  if (n >= _scope_stack.size()) {
-    return get_bottom_scope();
-  }
-  return _scope_stack[_scope_stack.size() - 1 - n];
-}
-
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::tokenize_params
 //       Access: Public
@@ -766,7 +801,7 @@ tokenize_numeric_pair(const string &str, double &a, double &b) {
   if (words.size() != 2) {
     cerr << words.size() << " parameters supplied when two were expected:\n"
          << str << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return false;
   }
 
@@ -870,6 +905,88 @@ format_int(int num) {
   return buffer;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::memoize_variable
+//       Access: Public
+//  Description: Marks the named variable, presumably one defined with
+//               #defer, to have its expansions remembered.  Each
+//               scope in which the variable is expanded remembers the
+//               result, along with the variables that were read to
+//               produce it, and reuses it until one of those is
+//               redefined.  This is for the #memo command.
+////////////////////////////////////////////////////////////////////
+void PPScope::
+memoize_variable(const string &varname) {
+  _context->_memo_variables.insert(varname);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::invalidate_memos
+//       Access: Public
+//  Description: Indicates that the named variable (or the function of
+//               that name) has been given a new definition, in any
+//               scope, so that any memo that read it must be
+//               recomputed.
+////////////////////////////////////////////////////////////////////
+void PPScope::
+invalidate_memos(const string &varname) {
+  if (_context->_memo_variables.empty()) {
+    // Nothing is memoized, so there's nothing to keep track of.
+    return;
+  }
+
+  unsigned int &generation = _context->_generations[varname];
+  generation = ++_context->_next_generation;
+
+  MemoRecorder *rec;
+  for (rec = _context->_memo_recorder; rec != (MemoRecorder *)NULL; rec = rec->_next) {
+    pair<MemoRecorder::Names::iterator, bool> r =
+      rec->_names.insert(MemoRecorder::Names::value_type(&generation, false));
+    if (!r.second && (*r.first).second) {
+      // The memo being computed read this variable before redefining
+      // it, so its result depends on a value that is now gone.
+      rec->_cacheable = false;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::Overlay::Constructor
+//       Access: Public
+//  Description: Puts the overlay into effect in the indicated
+//               context, until it is destructed.  Overlays do not
+//               nest.
+////////////////////////////////////////////////////////////////////
+PPScope::Overlay::
+Overlay(PPContext *context) :
+  _context(context)
+{
+  assert(_context->_overlay == (Overlay *)NULL);
+  _context->_overlay = this;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::Overlay::Destructor
+//       Access: Public
+//  Description: Discards all of the changes made to the frozen
+//               scopes while the overlay was in effect.
+////////////////////////////////////////////////////////////////////
+PPScope::Overlay::
+~Overlay() {
+  assert(_context->_overlay == this);
+  _context->_overlay = (Overlay *)NULL;
+
+  Layers::iterator li;
+  for (li = _layers.begin(); li != _layers.end(); ++li) {
+    delete (*li).second;
+  }
+  _layers.clear();
+
+  // The variables we changed have reverted to their frozen values,
+  // which the memo generations don't capture.
+  ++_context->_memo_epoch;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::p_set_variable
 //       Access: Private
@@ -880,9 +997,25 @@ format_int(int num) {
 bool PPScope::
 p_set_variable(const string &varname, const string &definition) {
   Variables::iterator vi;
+  Layer *layer = get_layer(false);
+  if (layer != (Layer *)NULL) {
+    vi = layer->_variables.find(varname);
+    if (vi != layer->_variables.end()) {
+      (*vi).second = definition;
+      invalidate_memos(varname);
+      return true;
+    }
+  }
+
   vi = _variables.find(varname);
   if (vi != _variables.end()) {
-    (*vi).second = definition;
+    layer = get_layer(true);
+    if (layer != (Layer *)NULL) {
+      layer->_variables[varname] = definition;
+    } else {
+      (*vi).second = definition;
+    }
+    invalidate_memos(varname);
     return true;
   }
 
@@ -904,6 +1037,15 @@ p_set_variable(const string &varname, const string &definition) {
 bool PPScope::
 p_get_variable(const string &varname, string &result) {
   Variables::const_iterator vi;
+  Layer *layer = get_layer(false);
+  if (layer != (Layer *)NULL) {
+    vi = layer->_variables.find(varname);
+    if (vi != layer->_variables.end()) {
+      result = (*vi).second;
+      return true;
+    }
+  }
+
   vi = _variables.find(varname);
   if (vi != _variables.end()) {
     result = (*vi).second;
@@ -912,11 +1054,11 @@ p_get_variable(const string &varname, string &result) {
 
   if (varname == "RELDIR" &&
       _directory != (PPDirectory *)NULL &&
-      current_output_directory != (PPDirectory *)NULL) {
+      _context->get_output_directory() != (PPDirectory *)NULL) {
     // $[RELDIR] is a special variable name that evaluates to the
     // relative directory of the current scope to the current output
     // directory.
-    result = current_output_directory->get_rel_to(_directory);
+    result = _context->get_output_directory()->get_rel_to(_directory);
     return true;
   }
 
@@ -1012,6 +1154,28 @@ r_scan_variable(const string &str, size_t &vp) {
   return str.substr(start, vp - start);
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_param
+//       Access: Private
+//  Description: Expands one parameter returned by tokenize_params()
+//               with expand false.  The result is the same as that
+//               parameter would have had with expand true, so a
+//               function can tokenize its parameters unexpanded and
+//               then expand only the ones it needs.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_param(const string &param) {
+  string result = r_expand_string(param, (ExpandedVariable *)NULL);
+
+  // tokenize_params() strips the trailing whitespace after expansion.
+  size_t q = result.length();
+  while (q > 0 && isspace(result[q - 1])) {
+    q--;
+  }
+  result.resize(q);
+  return result;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::r_expand_variable
 //       Access: Private
@@ -1082,12 +1246,21 @@ r_expand_variable(const string &str, size_t &vp,
     string params = varname.substr(p);
 
     // Is it a user-defined function?
-    const PPSubroutine *sub = PPSubroutine::get_func(funcname);
+    const PPSubroutine *sub = _context->get_func(funcname);
     if (sub != (const PPSubroutine *)NULL) {
       return expand_function(funcname, sub, params);
     }
 
     // Is it a built-in function?
+    PPProfiler::Frame frame("func", funcname);
+    PPStats::count_function(funcname);
+    if (_context->_memo_recorder != (MemoRecorder *)NULL &&
+        !is_pure_function(funcname)) {
+      // The result of most functions depends on more than the
+      // variables they read, so a #memo variable that calls one can't
+      // be remembered.
+      memo_uncacheable();
+    }
     if (funcname == "isfullpath") {
       return expand_isfullpath(params);
     } else if (funcname == "osfilename") {
@@ -1116,6 +1289,14 @@ r_expand_variable(const string &str, size_t &vp,
       return expand_bintest(params);
     } else if (funcname == "shell") {
       return expand_shell(params);
+    } else if (funcname == "shell-cached") {
+      return expand_shell_cached(params);
+    } else if (funcname == "shell-async") {
+      return expand_shell_async(params);
+    } else if (funcname == "shell-wait") {
+      return expand_shell_wait(params);
+    } else if (funcname == "sed") {
+      return expand_sed(params);
     } else if (funcname == "standardize") {
       return expand_standardize(params);
     } else if (funcname == "canonical") {
@@ -1236,6 +1417,9 @@ r_expand_variable(const string &str, size_t &vp,
     if (ev->_varname == varname) {
       // Yes, this is a cyclical expansion.
       cerr << "Ignoring cyclical expansion of " << varname << "\n";
+      if (_context->_memo_recorder != (MemoRecorder *)NULL) {
+        memo_uncacheable();
+      }
       return string();
     }
   }
@@ -1243,6 +1427,7 @@ r_expand_variable(const string &str, size_t &vp,
   // And now expand the variable.
 
   string expansion;
+  bool memoized = false;
 
   // Check for a special inline patsubst operation, like GNU make:
   // $[varname:%.c=%.o]
@@ -1263,6 +1448,11 @@ r_expand_variable(const string &str, size_t &vp,
     varname = varname.substr(0, p);
     expansion = expand_variable_nested(varname, scope_names);
 
+  } else if (!_context->_memo_variables.empty() &&
+             _context->_memo_variables.find(varname) != _context->_memo_variables.end()) {
+    // A #memo variable; we may already know its expansion.
+    memoized = true;
+
   } else {
     // No special scoping; just expand the variable name.
     expansion = get_variable(varname);
@@ -1273,7 +1463,12 @@ r_expand_variable(const string &str, size_t &vp,
   ExpandedVariable new_var;
   new_var._varname = varname;
   new_var._next = expanded;
-  string result = r_expand_string(expansion, &new_var);
+  string result;
+  if (memoized) {
+    result = expand_memo_variable(varname, &new_var);
+  } else {
+    result = r_expand_string(expansion, &new_var);
+  }
 
   // And *then* apply any inline patsubst.
   if (got_patsubst) {
@@ -1286,7 +1481,7 @@ r_expand_variable(const string &str, size_t &vp,
            << VARIABLE_PATSUBST << PATTERN_WILDCARD << ".c"
            << VARIABLE_PATSUBST_DELIM << PATTERN_WILDCARD << ".o"
            << VARIABLE_CLOSE_BRACE << ".\n";
-      errors_occurred = true;
+      _context->set_errors_occurred();
     } else {
       PPFilenamePattern from(tokens[0]);
       PPFilenamePattern to(tokens[1]);
@@ -1294,7 +1489,7 @@ r_expand_variable(const string &str, size_t &vp,
       if (!from.has_wildcard() || !to.has_wildcard()) {
         cerr << "The two parameters of inline patsubst must both include "
              << PATTERN_WILDCARD << ".\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         return string();
       }
 
@@ -1325,6 +1520,11 @@ r_expand_variable(const string &str, size_t &vp,
 string PPScope::
 expand_variable_nested(const string &varname,
                        const string &scope_names) {
+  if (_context->_memo_recorder != (MemoRecorder *)NULL) {
+    // The set of named scopes isn't tracked.
+    memo_uncacheable();
+  }
+
   if (_named_scopes == (PPNamedScopes *)NULL) {
     return string();
   }
@@ -1361,6 +1561,198 @@ expand_variable_nested(const string &varname,
   return result;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_memo_variable
+//       Access: Private
+//  Description: Expands a variable named by #memo, reusing the
+//               result from the last time it was expanded in this
+//               scope if that is still valid.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_memo_variable(const string &varname, ExpandedVariable *expanded) {
+  string result;
+  if (check_memo(varname, result)) {
+    return result;
+  }
+
+  MemoRecorder recorder(_context);
+  result = r_expand_string(get_variable(varname), expanded);
+
+  if (recorder._cacheable) {
+    Memo &memo = (*get_memos(true))[varname];
+    memo._stack.clear();
+    ScopeStack::const_iterator si;
+    for (si = _context->_scope_stack.begin(); si != _context->_scope_stack.end(); ++si) {
+      memo._stack.push_back((*si)->_serial);
+    }
+    memo._output_directory = _context->get_output_directory();
+    memo._epoch = _context->_memo_epoch;
+
+    // Record each variable's generation as it stands now, after the
+    // expansion; a variable the expansion defined itself is expected
+    // to be left as the expansion left it.
+    memo._deps.clear();
+    MemoRecorder::Names::const_iterator ni;
+    for (ni = recorder._names.begin(); ni != recorder._names.end(); ++ni) {
+      memo._deps.push_back(MemoDeps::value_type((*ni).first, *(*ni).first));
+    }
+    memo._result = result;
+
+  } else {
+    Memos *memos = get_memos(false);
+    if (memos != (Memos *)NULL) {
+      memos->erase(varname);
+    }
+  }
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::check_memo
+//       Access: Private
+//  Description: If this scope has a remembered expansion of the
+//               indicated variable that is still valid, stores it in
+//               result and returns true.  Otherwise returns false.
+////////////////////////////////////////////////////////////////////
+bool PPScope::
+check_memo(const string &varname, string &result) {
+  const Memos *memos = get_memos(false);
+  if (memos == (Memos *)NULL) {
+    return false;
+  }
+  Memos::const_iterator mi = memos->find(varname);
+  if (mi == memos->end()) {
+    return false;
+  }
+  const Memo &memo = (*mi).second;
+
+  if (memo._epoch != _context->_memo_epoch ||
+      memo._output_directory != _context->get_output_directory() ||
+      memo._stack.size() != _context->_scope_stack.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < _context->_scope_stack.size(); ++i) {
+    if (_context->_scope_stack[i]->_serial != memo._stack[i]) {
+      return false;
+    }
+  }
+
+  MemoDeps::const_iterator di;
+  for (di = memo._deps.begin(); di != memo._deps.end(); ++di) {
+    if (*(*di).first != (*di).second) {
+      return false;
+    }
+  }
+
+  // If another memo is being computed, it depends on everything this
+  // one did.
+  MemoRecorder *rec;
+  for (rec = _context->_memo_recorder; rec != (MemoRecorder *)NULL; rec = rec->_next) {
+    for (di = memo._deps.begin(); di != memo._deps.end(); ++di) {
+      rec->_names.insert(MemoRecorder::Names::value_type((*di).first, true));
+    }
+  }
+
+  result = memo._result;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::memo_read
+//       Access: Private
+//  Description: Notes that the named variable has been read by the
+//               memos currently being computed.
+////////////////////////////////////////////////////////////////////
+void PPScope::
+memo_read(const string &varname) {
+  if (varname == "DEPENDS_INDEX") {
+    // This is computed on the fly, not defined.
+    memo_uncacheable();
+    return;
+  }
+
+  unsigned int *generation = &_context->_generations[varname];
+  MemoRecorder *rec;
+  for (rec = _context->_memo_recorder; rec != (MemoRecorder *)NULL; rec = rec->_next) {
+    rec->_names.insert(MemoRecorder::Names::value_type(generation, true));
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::memo_uncacheable
+//       Access: Private
+//  Description: Indicates that the memos currently being computed
+//               depend on something other than variable definitions,
+//               and must not be remembered.
+////////////////////////////////////////////////////////////////////
+void PPScope::
+memo_uncacheable() {
+  MemoRecorder *rec;
+  for (rec = _context->_memo_recorder; rec != (MemoRecorder *)NULL; rec = rec->_next) {
+    rec->_cacheable = false;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::is_pure_function
+//       Access: Private, Static
+//  Description: Returns true if the named built-in function's result
+//               depends only on its parameters and the variables it
+//               reads, so that it may appear in a remembered #memo
+//               expansion.  Functions that consult the filesystem,
+//               run commands, or look into other scopes do not
+//               qualify.
+////////////////////////////////////////////////////////////////////
+bool PPScope::
+is_pure_function(const string &funcname) {
+  static const char *const pure_functions[] = {
+    "isfullpath", "osfilename", "osgeneric", "unixfilename", "cygpath_w",
+    "cygpath_p", "standardize", "length", "substr", "findstring", "dir",
+    "notdir", "suffix", "basename", "makeguid", "word", "wordlist",
+    "words", "firstword", "patsubst", "patsubstw", "subst", "wordsubst",
+    "filter", "filter_out", "filter-out", "join", "sort", "unique",
+    "matrix", "if", "eq", "ne", "=", "==", "!=", "<", "<=", ">", ">=",
+    "+", "-", "*", "/", "%", "not", "or", "and", "upcase", "downcase",
+    "cdefine", "foreach",
+  };
+  static const int num_pure_functions =
+    sizeof(pure_functions) / sizeof(pure_functions[0]);
+
+  // The set is built the first time it is needed.
+  static const set<string> pure(pure_functions,
+                                pure_functions + num_pure_functions);
+
+  return pure.find(funcname) != pure.end();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::MemoRecorder::Constructor
+//       Access: Public
+//  Description: Begins recording the variables read, until the
+//               recorder is destructed.  Recorders nest; each one
+//               sees everything read while it exists.
+////////////////////////////////////////////////////////////////////
+PPScope::MemoRecorder::
+MemoRecorder(PPContext *context) :
+  _context(context)
+{
+  _cacheable = true;
+  _next = _context->_memo_recorder;
+  _context->_memo_recorder = this;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::MemoRecorder::Destructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPScope::MemoRecorder::
+~MemoRecorder() {
+  assert(_context->_memo_recorder == this);
+  _context->_memo_recorder = _next;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::expand_isfullpath
 //       Access: Private
@@ -1580,7 +1972,7 @@ expand_libtest(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "libtest requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -1629,38 +2021,32 @@ expand_libtest(const string &params) {
   }
 
   // We now require all given libraries to be found for the test to pass.
+  PPSearchCache *cache = get_search_cache();
 
   for (size_t i = 0; i < libnames.size(); i++) {
     Filename libname = libnames[i];
-
-    bool found = false;
+    vector<Filename> candidates;
 
 #ifdef WIN32
     if (libname.get_extension() != string("lib")) {
       libname = "lib" + libname.get_basename() + ".lib";
     }
-    found = libname.resolve_filename(directories);
-    if (!found) {
-      libname.set_extension("dll");
-      found = libname.resolve_filename(directories);
-    }
+    candidates.push_back(libname);
+    libname.set_extension("dll");
+    candidates.push_back(libname);
 
 #else  // WIN32
     libname = "lib" + libname.get_basename() + ".a";
-    found = libname.resolve_filename(directories);
-    if (!found) {
-      libname.set_extension("so");
-      found = libname.resolve_filename(directories);
-    }
+    candidates.push_back(libname);
+    libname.set_extension("so");
+    candidates.push_back(libname);
 #ifdef HAVE_OSX
-    if (!found) {
-      libname.set_extension("dylib");
-      found = libname.resolve_filename(directories);
-    }
+    libname.set_extension("dylib");
+    candidates.push_back(libname);
 #endif  // HAVE_OSX
 #endif  // WIN32
 
-    if (!found) {
+    if (cache->find_file(directories, candidates).empty()) {
       //cerr << "libtest: " << libname.get_fullpath() << " not found.\n";
       return string();
     }
@@ -1729,19 +2115,47 @@ expand_bintest(const string &params) {
   directories.append_path(pathvar, ":");
 #endif
 
+  vector<Filename> candidates;
+  candidates.push_back(binname);
 #ifdef WIN32
-  bool found = binname.resolve_filename(directories, "exe");
-#else
-  bool found = binname.resolve_filename(directories);
+  if (binname.get_extension().empty()) {
+    Filename exename = binname;
+    exename.set_extension("exe");
+    candidates.push_back(exename);
+  }
 #endif
 
-  if (found) {
-    return binname.get_fullpath();
+  Filename found = get_search_cache()->find_file(directories, candidates);
+
+  if (!found.empty()) {
+    return found.get_fullpath();
   } else {
     return string();
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::get_search_cache
+//       Access: Private
+//  Description: Returns the cache used by $[libtest] and $[bintest],
+//               after first loading the answers saved by a previous
+//               session from $[SEARCH_CACHE_FILENAME], if it is
+//               defined.
+////////////////////////////////////////////////////////////////////
+PPSearchCache *PPScope::
+get_search_cache() {
+  PPSearchCache *cache = _context->get_search_cache();
+  string cache_filename = trim_blanks(expand_variable("SEARCH_CACHE_FILENAME"));
+  if (!cache_filename.empty()) {
+    Filename filename(cache_filename);
+    if (!filename.is_fully_qualified()) {
+      filename = Filename(_context->get_root(), cache_filename);
+    }
+    cache->read(filename);
+  }
+  return cache;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::expand_shell
 //       Access: Private
@@ -1751,160 +2165,236 @@ expand_bintest(const string &params) {
 ////////////////////////////////////////////////////////////////////
 string PPScope::
 expand_shell(const string &params) {
-  // We run $[shell] commands within the directory indicated by
-  // $[DIRPREFIX].  This way, local filenames will be expanded the
-  // way we expect.
-  string dirname = trim_blanks(expand_variable("DIRPREFIX"));
-  if (dirname.empty()) {
-    // If $[DIRPREFIX] is empty, we are not currently in a Sources.pp
-    // scope, so use $[THISDIRPREFIX] instead.
-    dirname = trim_blanks(expand_variable("THISDIRPREFIX"));
-  }
-
-  std::string os_dirname = Filename(dirname).to_os_specific();
-
   string command = expand_string(params);
-  string output;
+  return run_shell(command, get_shell_dirname());
+}
 
-#ifdef WIN32_VC
-  static array<char, 4096> buffer;
-  SECURITY_ATTRIBUTES sa;
-  sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-  sa.bInheritHandle = TRUE;
-  sa.lpSecurityDescriptor = NULL;
-  HANDLE stderr_pipe_rd = NULL;
-  HANDLE stderr_pipe_wr = NULL;
-  if (!CreatePipe(&stderr_pipe_rd, &stderr_pipe_wr, &sa, 0)) {
-    cerr << "$[shell]: couldn't create win pipe " << GetLastError() << "\n";
-    errors_occurred = true;
-    return string();
-  }
-  if (!SetHandleInformation(stderr_pipe_rd, HANDLE_FLAG_INHERIT, 0)) {
-    cerr << "$[shell]: couldn't set handle information " << GetLastError() << "\n";
-    errors_occurred = true;
-    return string();
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_shell_cached
+//       Access: Private
+//  Description: Expands the "shell-cached" function variable.  This
+//               is like "shell", but the command's output is assumed
+//               to depend only on the command itself, the directory
+//               it runs in, and the files and environment variables
+//               named by $[SHELL_CACHE_DEPENDS] and
+//               $[SHELL_CACHE_ENV]; so the command is not run again
+//               as long as none of these have changed.
+//
+//               If $[SHELL_CACHE_FILENAME] is defined, the results
+//               are also remembered between sessions in the named
+//               file, relative to the root of the source tree.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_shell_cached(const string &params) {
+  string command = expand_string(params);
+  string dirname = get_shell_dirname();
+
+  PPShellCache *cache = _context->get_shell_cache();
+  string cache_filename = trim_blanks(expand_variable("SHELL_CACHE_FILENAME"));
+  if (!cache_filename.empty()) {
+    Filename filename(cache_filename);
+    if (!filename.is_fully_qualified()) {
+      filename = Filename(_context->get_root(), cache_filename);
+    }
+    cache->read(filename);
   }
 
-  PROCESS_INFORMATION proc_info;
-  STARTUPINFOA start_info;
-  bool success = FALSE;
-
-  ZeroMemory(&proc_info, sizeof(PROCESS_INFORMATION));
-  ZeroMemory(&start_info, sizeof(STARTUPINFOA));
-  start_info.cb = sizeof(STARTUPINFOA);
-  start_info.hStdOutput = stderr_pipe_wr;
-  start_info.dwFlags |= STARTF_USESTDHANDLES;
-
-  success = CreateProcessA(
-    NULL,
-    (char *)command.c_str(),
-    NULL,
-    NULL,
-    TRUE,
-    CREATE_NO_WINDOW,
-    NULL,
-    (char *)os_dirname.c_str(),
-    &start_info,
-    &proc_info
-  );
-
-  if (!success) {
-    cerr << "$[shell]: couldn't create process " << GetLastError() << "\n";
-    errors_occurred = true;
-    return string();
+  // The fingerprint records the state of everything the command was
+  // declared to depend on.
+  string fingerprint;
+  vector<string> words;
+  tokenize_whitespace(expand_variable("SHELL_CACHE_DEPENDS"), words);
+  vector<string>::const_iterator wi;
+  for (wi = words.begin(); wi != words.end(); ++wi) {
+    Filename filename(*wi);
+    if (!filename.is_fully_qualified() && !dirname.empty()) {
+      filename = Filename(dirname, *wi);
+    }
+    char buffer[64];
+    _context->get_output_queue()->wait_for(filename);
+    if (filename.exists()) {
+      sprintf(buffer, " %lld %lld\n", (long long)filename.get_timestamp(),
+              (long long)filename.get_file_size());
+    } else {
+      sprintf(buffer, " -\n");
+    }
+    fingerprint += (*wi);
+    fingerprint += buffer;
   }
 
-  CloseHandle(stderr_pipe_wr);
+  words.clear();
+  tokenize_whitespace(expand_variable("SHELL_CACHE_ENV"), words);
+  for (wi = words.begin(); wi != words.end(); ++wi) {
+    const char *value = getenv((*wi).c_str());
+    fingerprint += (*wi);
+    if (value == (const char *)NULL) {
+      fingerprint += "\n";
+    } else {
+      fingerprint += "=";
+      fingerprint += value;
+      fingerprint += "\n";
+    }
+  }
+  fingerprint = PPShellCache::hash(fingerprint);
 
-  DWORD dw_read = 0;
-  bool success2 = FALSE;
-  for (;;) {
-    success2 = ReadFile(stderr_pipe_rd, buffer.data(), buffer.size(), &dw_read, NULL);
-    if (!success2 || dw_read == 0) {
-      break;
+  string result;
+  if (cache->lookup(command, dirname, fingerprint, result)) {
+    if (verbose >= 2) {
+      cerr << "Using cached result of " << command << "\n";
     }
-    std::string s(buffer.data(), dw_read);
-    output += s;
+    return result;
   }
 
-  CloseHandle(stderr_pipe_rd);
+  // A command that failed may succeed next time, so only a successful
+  // result is remembered.
+  bool succeeded;
+  result = run_shell(command, dirname, &succeeded);
+  if (succeeded) {
+    cache->store(command, dirname, fingerprint, result);
+  }
+  return result;
+}
 
-#else // WIN32_VC
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_shell_async
+//       Access: Private
+//  Description: Expands the "shell-async" function variable.  This
+//               starts the given command in a subprocess, but does
+//               not wait for it to finish; instead, it returns the
+//               string "$[shell-wait n]", which in turn expands to
+//               the command's output, once it is available.
+//
+//               This is intended to be used with #define, e.g.:
+//
+//                 #define OUTPUTS $[shell-async gen --list-outputs]
+//
+//               The command runs in the background while the rest of
+//               the file is read, and $[OUTPUTS] waits for it only
+//               when it is first referenced.  At most
+//               $[SHELL_ASYNC_JOBS] commands (by default, the number
+//               of CPU's) run at once; the rest wait their turn.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_shell_async(const string &params) {
+  string command = expand_string(params);
+  string dirname = get_shell_dirname();
 
-  // Posix implementation.
+  if (_context->_async_commands == (ShellCommandQueue *)NULL) {
+    _context->_async_commands = new ShellCommandQueue;
+  }
 
-  int pid, status;
+  string jobs_str = trim_blanks(expand_variable("SHELL_ASYNC_JOBS"));
+  if (!jobs_str.empty()) {
+    _context->_async_commands->set_max_jobs(atoi(jobs_str.c_str()));
+  }
+
+  int id = _context->_async_commands->add(command, dirname);
+  PPStats::count(PPStats::C_shell_commands);
+
+  char buffer[32];
+  sprintf(buffer, "$[shell-wait %d]", id);
+  return buffer;
+}
 
-  int pd[2];
-  if (pipe(pd) < 0) {
-    // pipe() failed.
-    perror("pipe");
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_shell_wait
+//       Access: Private
+//  Description: Expands the "shell-wait" function variable.  This
+//               waits for the command started by a previous
+//               $[shell-async] to finish, and returns its output.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_shell_wait(const string &params) {
+  string param = trim_blanks(expand_string(params));
+  PPProfiler::Frame frame("shell", "(wait)");
+  PPTrace::Span span("shell", PPTrace::is_enabled() ?
+                      "shell-wait " + param : string());
+  PPStats::Timer timer(PPStats::C_shell_wait_usec);
+  string output;
+  if (_context->_async_commands == (ShellCommandQueue *)NULL ||
+      !_context->_async_commands->wait(atoi(param.c_str()), output)) {
+    cerr << "Invalid shell-wait parameter: " << param << "\n";
+    _context->set_errors_occurred();
     return string();
   }
 
-  pid = fork();
-  if (pid < 0) {
-    // fork() failed.
-    perror("fork");
-    return string();
+  // Collapse the whitespace, the same as $[shell].
+  vector<string> results;
+  tokenize_whitespace(output, results);
+
+  return repaste(results, " ");
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::get_shell_dirname
+//       Access: Private
+//  Description: Returns the directory in which $[shell] commands
+//               should be run.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+get_shell_dirname() {
+  // We run $[shell] commands within the directory indicated by
+  // $[DIRPREFIX].  This way, local filenames will be expanded the
+  // way we expect.
+  string dirname = trim_blanks(expand_variable("DIRPREFIX"));
+  if (dirname.empty()) {
+    // If $[DIRPREFIX] is empty, we are not currently in a Sources.pp
+    // scope, so use $[THISDIRPREFIX] instead.
+    dirname = trim_blanks(expand_variable("THISDIRPREFIX"));
   }
+  return dirname;
+}
 
-  if (pid == 0) {
-    // Child.
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::run_shell
+//       Access: Private
+//  Description: Runs the indicated command in the indicated directory
+//               and returns its standard output, with all whitespace
+//               collapsed to single spaces.  If succeeded is not
+//               NULL, it is set true if the command ran and exited
+//               with status 0, or false otherwise.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+run_shell(const string &command, const string &dirname, bool *succeeded) {
+  // The profile is summarized by program, not by full command line;
+  // but there's no need to find the program if we're not profiling.
+  string program;
+  if (PPProfiler::is_enabled()) {
+    program = command.substr(0, command.find_first_of(" \t\n;|&<>()"));
+  }
+  PPProfiler::Frame frame("shell", program);
+  PPTrace::Span span("shell", command);
+  PPStats::count(PPStats::C_shell_commands);
+  PPStats::Timer timer(PPStats::C_shell_wait_usec);
 
-    if (!dirname.empty()) {
-      // We don't have to restore the directory after we're done,
-      // because we're doing the chdir() call only within the child
-      // process.
-      if (chdir(dirname.c_str()) < 0) {
-        perror("chdir");
-      }
-    }
+  string output;
+  int exit_status = -1;
+  if (succeeded != (bool *)NULL) {
+    *succeeded = false;
+  }
 
-    close(pd[0]);
-    dup2(pd[1], STDOUT_FILENO);
-    char *argv[4];
-    argv[0] = (char *)"sh";
-    argv[1] = (char *)"-c";
-    argv[2] = (char *)command.c_str();
-    argv[3] = (char *)NULL;
-    execv("/bin/sh", argv);
-    exit(127);
-  }
-
-  // Parent.  Wait for the child to terminate, and read from its
-  // output while we're waiting.
-  close(pd[1]);
-  bool child_done = false;
-  bool pipe_closed = false;
-
-  while (!child_done && !pipe_closed) {
-    static const int buffer_size = 1024;
-    char buffer[buffer_size];
-    int read_bytes = (int)read(pd[0], buffer, buffer_size);
-    if (read_bytes < 0) {
-      perror("read");
-    } else if (read_bytes == 0) {
-      pipe_closed = true;
-    } else {
-      output += string(buffer, read_bytes);
-    }
+  // If $[SHELL_COPROCESS] is defined, the commands are all fed to one
+  // long-running shell, which saves starting a new shell for each one.
+  bool ran = false;
+  if (!trim_blanks(expand_variable("SHELL_COPROCESS")).empty()) {
+    ran = _context->get_shell_coprocess()->run(command, dirname, output,
+                                                exit_status);
+  }
 
-    if (!child_done) {
-      int waitresult = waitpid(pid, &status, WNOHANG);
-      if (waitresult < 0) {
-        if (errno != EINTR) {
-          perror("waitpid");
-          return string();
-        }
-      } else if (waitresult > 0) {
-        child_done = true;
-      }
+  if (!ran) {
+    ShellCommand shell(command, dirname);
+    if (!shell.run()) {
+      cerr << "$[shell]: couldn't run " << command << "\n";
+      _context->set_errors_occurred();
+      return string();
     }
+    output = shell.get_output();
+    exit_status = shell.get_exit_status();
   }
-  close(pd[0]);
 
-#endif // WIN32_VC
+  if (succeeded != (bool *)NULL) {
+    *succeeded = (exit_status == 0);
+  }
 
   // Now get the output.  We split it into words and then reconnect
   // it, to simulate the shell's backpop operator.
@@ -1916,6 +2406,68 @@ expand_shell(const string &params) {
   return result;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::expand_sed
+//       Access: Private
+//  Description: Expands the "sed" function variable.  This runs the
+//               sed script given as the first parameter, with the
+//               same limited syntax as ppremake -s, on the text given
+//               by the remaining parameters, and returns the result.
+//               Each script is compiled only the first time it is
+//               used.
+//
+//               Since the script is separated from the text by a
+//               comma, a script that itself contains a comma (e.g. a
+//               range of lines) must be passed in via a variable.
+////////////////////////////////////////////////////////////////////
+string PPScope::
+expand_sed(const string &params) {
+  vector<string> tokens;
+  tokenize_params(params, tokens, true);
+
+  if (tokens.size() < 2) {
+    cerr << "sed requires at least two parameters.\n";
+    _context->set_errors_occurred();
+    return string();
+  }
+
+  const string &script = tokens[0];
+  SedProcess *sp;
+  PPContext::SedScripts::const_iterator si = _context->_sed_scripts.find(script);
+  if (si != _context->_sed_scripts.end()) {
+    sp = (*si).second;
+  } else {
+    sp = new SedProcess;
+    if (!sp->add_script_line(script)) {
+      cerr << "Invalid sed script: " << script << "\n";
+      _context->set_errors_occurred();
+      delete sp;
+      sp = (SedProcess *)NULL;
+    }
+    _context->_sed_scripts[script] = sp;
+  }
+
+  if (sp == (SedProcess *)NULL) {
+    return string();
+  }
+
+  // The rest of the parameters are the text, commas and all.
+  string text = tokens[1];
+  for (size_t i = 2; i < tokens.size(); i++) {
+    text += ",";
+    text += tokens[i];
+  }
+
+  string result;
+  sp->run(text, result);
+
+  // Remove the newline sed adds after the last line.
+  if (!result.empty() && result[result.length() - 1] == '\n') {
+    result.resize(result.length() - 1);
+  }
+  return result;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::expand_standardize
 //       Access: Private
@@ -1988,7 +2540,7 @@ expand_substr(const string &params) {
 
   if (tokens.size() != 3) {
     cerr << "substr requires three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2149,7 +2701,7 @@ expand_makeguid(const string &params) {
 
   if (expansion.size() == 0) {
     cerr << "makeguid requires an argument.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2218,7 +2770,7 @@ expand_word(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "word requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2250,7 +2802,7 @@ expand_wordlist(const string &params) {
 
   if (tokens.size() != 3) {
     cerr << "wordlist requires three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2336,13 +2888,13 @@ expand_patsubst(const string &params, bool separate_words) {
 
   if (tokens.size() < 3) {
     cerr << "patsubst requires at least three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
   if ((tokens.size() % 2) != 1) {
     cerr << "patsubst requires an odd number of parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2374,7 +2926,7 @@ expand_patsubst(const string &params, bool separate_words) {
       if (!pattern.has_wildcard()) {
         cerr << "All the \"from\" parameters of patsubst must include "
              << PATTERN_WILDCARD << ".\n";
-        errors_occurred = true;
+        _context->set_errors_occurred();
         return string();
       }
       from.back().push_back(pattern);
@@ -2424,7 +2976,7 @@ expand_filter(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "filter requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2481,7 +3033,7 @@ expand_filter_out(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "filter-out requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2538,13 +3090,13 @@ expand_subst(const string &params) {
 
   if (tokens.size() < 3) {
     cerr << "subst requires at least three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
   if ((tokens.size() % 2) != 1) {
     cerr << "subst requires an odd number of parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2583,7 +3135,7 @@ expand_findstring(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "findstring requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
   string str = tokens.back();
@@ -2610,13 +3162,13 @@ expand_wordsubst(const string &params) {
 
   if (tokens.size() < 3) {
     cerr << "subst requires at least three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
   if ((tokens.size() % 2) != 1) {
     cerr << "subst requires an odd number of parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2653,7 +3205,7 @@ expand_join(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "join requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2754,29 +3306,32 @@ expand_matrix(const string &params) {
 //               if the result is true (i.e. nonempty) and the third
 //               parameter (if present) if the result is false
 //               (i.e. empty).
+//
+//               Only the chosen parameter is expanded, so the other
+//               one may be arbitrarily expensive.
 ////////////////////////////////////////////////////////////////////
 string PPScope::
 expand_if(const string &params) {
   // Split the string up into tokens based on the commas.
   vector<string> tokens;
-  tokenize_params(params, tokens, true);
+  tokenize_params(params, tokens, false);
 
   if (tokens.size() == 2) {
-    if (!tokens[0].empty()) {
-      return tokens[1];
+    if (!expand_param(tokens[0]).empty()) {
+      return expand_param(tokens[1]);
     } else {
       return "";
     }
   } else if (tokens.size() == 3) {
-    if (!tokens[0].empty()) {
-      return tokens[1];
+    if (!expand_param(tokens[0]).empty()) {
+      return expand_param(tokens[1]);
     } else {
-      return tokens[2];
+      return expand_param(tokens[2]);
     }
   }
 
   cerr << "if requires two or three parameters.\n";
-  errors_occurred = true;
+  _context->set_errors_occurred();
   return string();
 }
 
@@ -2794,7 +3349,7 @@ expand_eq(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "eq requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -2820,7 +3375,7 @@ expand_ne(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "ne requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3041,7 +3596,7 @@ expand_divide(const string &params) {
   if (tokens.size() != 2) {
     cerr << tokens.size() << " parameters supplied when two were expected:\n"
          << params << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3064,7 +3619,7 @@ expand_modulo(const string &params) {
   if (tokens.size() != 2) {
     cerr << tokens.size() << " parameters supplied when two were expected:\n"
          << params << "\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3086,7 +3641,7 @@ expand_not(const string &params) {
 
   if (tokens.size() != 1) {
     cerr << "not requires one parameter.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3104,17 +3659,19 @@ expand_not(const string &params) {
 //  Description: Expands the "or" function variable.  This returns
 //               nonempty if any of its arguments are nonempty.
 //               Specifically, it returns the first nonempty argument.
+//               The arguments after that one are not expanded.
 ////////////////////////////////////////////////////////////////////
 string PPScope::
 expand_or(const string &params) {
   // Split the string up into tokens based on the commas.
   vector<string> tokens;
-  tokenize_params(params, tokens, true);
+  tokenize_params(params, tokens, false);
 
   vector<string>::const_iterator ti;
   for (ti = tokens.begin(); ti != tokens.end(); ++ti) {
-    if (!(*ti).empty()) {
-      return (*ti);
+    string result = expand_param(*ti);
+    if (!result.empty()) {
+      return result;
     }
   }
   return string();
@@ -3125,26 +3682,25 @@ expand_or(const string &params) {
 //       Access: Private
 //  Description: Expands the "and" function variable.  This returns
 //               nonempty if all of its arguments are nonempty.
-//               Specifically, it returns the last argument.
+//               Specifically, it returns the last argument.  The
+//               arguments after the first empty one are not
+//               expanded.
 ////////////////////////////////////////////////////////////////////
 string PPScope::
 expand_and(const string &params) {
   // Split the string up into tokens based on the commas.
   vector<string> tokens;
-  tokenize_params(params, tokens, true);
+  tokenize_params(params, tokens, false);
 
+  string result = "1";
   vector<string>::const_iterator ti;
   for (ti = tokens.begin(); ti != tokens.end(); ++ti) {
-    if ((*ti).empty()) {
+    result = expand_param(*ti);
+    if (result.empty()) {
       return string();
     }
   }
 
-  string result = "1";
-  if (!tokens.empty()) {
-    result = tokens.back();
-  }
-
   return result;
 }
 
@@ -3221,7 +3777,7 @@ expand_closure(const string &params) {
 
   if (tokens.size() != 2 && tokens.size() != 3) {
     cerr << "closure requires two or three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3308,7 +3864,7 @@ expand_unmapped(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "unmapped requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3356,29 +3912,53 @@ expand_dependencies(const string &params) {
   PPDirectory *directory = get_directory();
   assert(directory != (PPDirectory *)NULL);
 
-  vector<string> results;
+  // Take the union of the complete dependencies of all the named
+  // files.  Each file's dependencies are cached as a sorted list of
+  // file indices, so we can simply merge the lists.
+  PPDirectoryTree *main_tree = directory->get_tree()->get_main_tree();
+  vector<int> indices, merged;
+
   vector<string>::const_iterator fi;
   for (fi = filenames.begin(); fi != filenames.end(); ++fi) {
     PPDependableFile *file = directory->get_dependable_file(*fi, false);
     assert(file != (PPDependableFile *)NULL);
 
-    vector<PPDependableFile *> files;
-    file->get_complete_dependencies(files);
-
-    vector<PPDependableFile *>::const_iterator dfi;
-    for (dfi = files.begin(); dfi != files.end(); ++dfi) {
-      PPDependableFile *df = (*dfi);
-      string rel_filename =
-        current_output_directory->get_rel_to(df->get_directory()) + "/" +
-        df->get_filename();
-      results.push_back(rel_filename);
+    const vector<int> &closure = file->get_closure();
+    if (indices.empty()) {
+      indices = closure;
+    } else {
+      merged.clear();
+      set_union(indices.begin(), indices.end(),
+                closure.begin(), closure.end(), back_inserter(merged));
+      indices.swap(merged);
     }
   }
 
-  sort(results.begin(), results.end());
-  results.erase(unique(results.begin(), results.end()), results.end());
+  // Each file caches its name relative to the output directory, so
+  // we sort pointers to those strings and copy each one only once, into
+  // the result.
+  const PPDirectory *output_directory = _context->get_output_directory();
+  vector<const string *> results;
+  results.reserve(indices.size());
+  vector<int>::const_iterator ii;
+  for (ii = indices.begin(); ii != indices.end(); ++ii) {
+    PPDependableFile *df = main_tree->get_dependable_file(*ii);
+    results.push_back(&df->get_rel_filename(output_directory));
+  }
 
-  string result = repaste(results, " ");
+  sort(results.begin(), results.end(), SortStringPointers());
+
+  string result;
+  vector<const string *>::const_iterator ri;
+  for (ri = results.begin(); ri != results.end(); ++ri) {
+    if (ri != results.begin()) {
+      if (*(*ri) == *(*(ri - 1))) {
+        continue;
+      }
+      result += ' ';
+    }
+    result += *(*ri);
+  }
   return result;
 }
 
@@ -3396,7 +3976,7 @@ expand_foreach(const string &params) {
 
   if (tokens.size() != 3) {
     cerr << "foreach requires three parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3434,7 +4014,7 @@ expand_forscopes(const string &params) {
 
   if (tokens.size() != 2) {
     cerr << "forscopes requires two parameters.\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3479,8 +4059,14 @@ expand_forscopes(const string &params) {
 string PPScope::
 expand_function(const string &funcname,
                 const PPSubroutine *sub, const string &params) {
-  PPScope::push_scope((PPScope *)this);
-  PPScope nested_scope(_named_scopes);
+  PPProfiler::Frame frame("defun", funcname);
+  if (_context->_memo_recorder != (MemoRecorder *)NULL) {
+    // A function may do anything at all.
+    memo_uncacheable();
+  }
+
+  _context->push_scope((PPScope *)this);
+  PPScope nested_scope(_context, _named_scopes);
   nested_scope.define_formals(funcname, sub->_formals, params);
 
 #ifdef HAVE_SSTREAM
@@ -3493,17 +4079,14 @@ expand_function(const string &funcname,
   command.set_output(&ostr);
 
   command.begin_read();
-  bool okflag = true;
-  vector<string>::const_iterator li;
-  for (li = sub->_lines.begin(); li != sub->_lines.end() && okflag; ++li) {
-    okflag = command.read_line(*li);
-  }
+  bool okflag = command.read_lines(sub->_lines, sub->_line_numbers,
+                                   sub->_filename);
   if (okflag) {
     okflag = command.end_read();
   }
   // We don't do anything with okflag here.  What can we do?
 
-  PPScope::pop_scope();
+  _context->pop_scope();
 
   // Now get the output.  We split it into words and then reconnect
   // it, to replace all whitespace with spaces.
@@ -3540,7 +4123,7 @@ expand_map_variable(const string &varname, const string &params) {
   if (tokens.size() != 2) {
     cerr << "map variable expansions require two parameters: $["
          << varname << " " << params << "]\n";
-    errors_occurred = true;
+    _context->set_errors_occurred();
     return string();
   }
 
@@ -3639,17 +4222,31 @@ r_expand_matrix(vector<string> &results, const vector<vector<string> > &words,
 //       Access: Private
 //  Description: The implementation of find_map_variable() for a
 //               particular static scope, without checking the stack.
+//               If for_write is true and the variable is found in a
+//               frozen scope, it is first copied into the Overlay.
 ////////////////////////////////////////////////////////////////////
 PPScope::MapVariableDefinition &PPScope::
-p_find_map_variable(const string &varname) {
+p_find_map_variable(const string &varname, bool for_write) {
   MapVariables::const_iterator mvi;
+  Layer *layer = get_layer(false);
+  if (layer != (Layer *)NULL) {
+    mvi = layer->_map_variables.find(varname);
+    if (mvi != layer->_map_variables.end()) {
+      return (MapVariableDefinition &)(*mvi).second;
+    }
+  }
+
   mvi = _map_variables.find(varname);
   if (mvi != _map_variables.end()) {
+    layer = for_write ? get_layer(true) : (Layer *)NULL;
+    if (layer != (Layer *)NULL) {
+      return layer->_map_variables[varname] = (*mvi).second;
+    }
     return (MapVariableDefinition &)(*mvi).second;
   }
 
   if (_parent_scope != (PPScope *)NULL) {
-    return _parent_scope->p_find_map_variable(varname);
+    return _parent_scope->p_find_map_variable(varname, for_write);
   }
 
   return _null_map_def;
@@ -3660,22 +4257,86 @@ p_find_map_variable(const string &varname) {
 //       Access: Private
 //  Description: The implementation of find_dict_variable() for a
 //               particular static scope, without checking the stack.
+//               If for_write is true and the variable is found in a
+//               frozen scope, it is first copied into the Overlay.
 ////////////////////////////////////////////////////////////////////
 PPScope::DictVariableDefinition &PPScope::
-p_find_dict_variable(const string &varname) {
+p_find_dict_variable(const string &varname, bool for_write) {
   DictVariables::const_iterator mvi;
+  Layer *layer = get_layer(false);
+  if (layer != (Layer *)NULL) {
+    mvi = layer->_dict_variables.find(varname);
+    if (mvi != layer->_dict_variables.end()) {
+      return (DictVariableDefinition &)(*mvi).second;
+    }
+  }
+
   mvi = _dict_variables.find(varname);
   if (mvi != _dict_variables.end()) {
+    layer = for_write ? get_layer(true) : (Layer *)NULL;
+    if (layer != (Layer *)NULL) {
+      return layer->_dict_variables[varname] = (*mvi).second;
+    }
     return (DictVariableDefinition &)(*mvi).second;
   }
 
   if (_parent_scope != (PPScope *)NULL) {
-    return _parent_scope->p_find_dict_variable(varname);
+    return _parent_scope->p_find_dict_variable(varname, for_write);
   }
 
   return _null_dict_def;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::get_layer
+//       Access: Private
+//  Description: Returns the Layer that holds the changes made to this
+//               scope within the current Overlay, creating it first
+//               if create is true, or NULL if the scope is not frozen
+//               or no Overlay is in effect (in which case changes are
+//               made directly to the scope).
+////////////////////////////////////////////////////////////////////
+PPScope::Layer *PPScope::
+get_layer(bool create) {
+  if (_context->_overlay == (Overlay *)NULL ||
+      _serial > _context->_frozen_serial) {
+    return (Layer *)NULL;
+  }
+
+  Overlay::Layers::const_iterator li = _context->_overlay->_layers.find(_serial);
+  if (li != _context->_overlay->_layers.end()) {
+    return (*li).second;
+  }
+  if (!create) {
+    return (Layer *)NULL;
+  }
+
+  Layer *layer = new Layer;
+  _context->_overlay->_layers[_serial] = layer;
+  return layer;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPScope::get_memos
+//       Access: Private
+//  Description: Returns the remembered #memo expansions for this
+//               scope.  A frozen scope keeps these in the Overlay,
+//               like any other change; if it has none there yet, this
+//               returns NULL unless create is true.
+////////////////////////////////////////////////////////////////////
+PPScope::Memos *PPScope::
+get_memos(bool create) {
+  if (_context->_overlay == (Overlay *)NULL ||
+      _serial > _context->_frozen_serial) {
+    return &_memos;
+  }
+  Layer *layer = get_layer(create);
+  if (layer != (Layer *)NULL) {
+    return &layer->_memos;
+  }
+  return (Memos *)NULL;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: PPScope::glob_string
 //       Access: Private
@@ -3687,6 +4348,8 @@ p_find_dict_variable(const string &varname) {
 ////////////////////////////////////////////////////////////////////
 void PPScope::
 glob_string(const string &str, vector<string> &results) {
+  PPProfiler::Frame frame("glob", "match_files");
+
   // The globbing is relative to THISDIRPREFIX, not necessarily the
   // current directory.
   string dirname = trim_blanks(expand_variable("THISDIRPREFIX"));
@@ -3696,6 +4359,13 @@ glob_string(const string &str, vector<string> &results) {
 
   vector<string>::const_iterator wi;
   for (wi = words.begin(); wi != words.end(); ++wi) {
+    // A file we generated may match; make sure it has been written.
+    Filename pattern(*wi);
+    if (pattern.is_local() && !dirname.empty()) {
+      pattern = Filename(dirname, pattern);
+    }
+    _context->get_output_queue()->wait_for_matches(pattern.get_fullpath());
+
     GlobPattern glob(*wi);
     glob.match_files(results, dirname);
   }
@@ -3711,8 +4381,16 @@ expand_model_depends(const string &params) {
 
   PPDirectory *directory = get_directory();
 
+  // Refresh all of the named files at once, so that any that are
+  // out of date may be processed together.
+  vector_string filenames;
+  for (const string &token : tokens) {
+    tokenize_whitespace(token, filenames);
+  }
+  directory->refresh_depended_models(filenames);
+
   vector_string all_depends;
-  for (const string &filename : tokens) {
+  for (const string &filename : filenames) {
     const vector_string &depends = directory->get_depended_models(filename);
     all_depends.insert(all_depends.end(), depends.begin(), depends.end());
   }
@@ -8,12 +8,15 @@
 
 #include "ppremake.h"
 
+#include <atomic>
 #include <map>
 #include <vector>
 
+class PPContext;
 class PPNamedScopes;
 class PPDirectory;
 class PPSubroutine;
+class PPSearchCache;
 
 ///////////////////////////////////////////////////////////////////
 //   Class : PPScope
@@ -21,14 +24,30 @@ class PPSubroutine;
 //               definitions.  Variables may be defined in a
 //               system-wide variable file, in a template file, or in
 //               an individual source file.
+//
+//               Each scope belongs to a PPContext, which holds the
+//               dynamic scope stack and the other state shared by
+//               all of the scopes of one evaluation.
+//
+//               Once all of the source files have been read, the
+//               scopes may be frozen with
+//               PPContext::freeze_scopes().  From then
+//               on, the changes a template makes to a frozen scope
+//               while an Overlay is in effect--by #define, #set,
+//               #push, #map, #addmap, #dict, #adddict, and so on--are
+//               made to a private copy of the variable within the
+//               Overlay, so that the frozen scopes themselves are
+//               only ever read.
 ////////////////////////////////////////////////////////////////////
 class PPScope {
 public:
   typedef map<string, PPScope *> MapVariableDefinition;
   typedef map<string, string> DictVariableDefinition;
 
-  PPScope(PPNamedScopes *named_scopes);
+  PPScope(PPContext *context, PPNamedScopes *named_scopes);
+  PPScope(const PPScope &copy);
 
+  PPContext *get_context() const;
   PPNamedScopes *get_named_scopes();
 
   void set_parent(PPScope *parent);
@@ -50,8 +69,10 @@ public:
 
   string get_variable(const string &varname);
   string expand_variable(const string &varname);
-  MapVariableDefinition &find_map_variable(const string &varname);
-  DictVariableDefinition &find_dict_variable(const string &varname);
+  MapVariableDefinition &find_map_variable(const string &varname,
+                                           bool for_write = false);
+  DictVariableDefinition &find_dict_variable(const string &varname,
+                                             bool for_write = false);
 
   PPDirectory *get_directory();
   void set_directory(PPDirectory *directory);
@@ -59,11 +80,6 @@ public:
   string expand_string(const string &str);
   string expand_self_reference(const string &str, const string &varname);
 
-  static void push_scope(PPScope *scope);
-  static PPScope *pop_scope();
-  static PPScope *get_bottom_scope();
-  static PPScope *get_enclosing_scope(int n);
-
   void tokenize_params(const string &str, vector<string> &tokens,
                        bool expand);
   bool tokenize_numeric_pair(const string &str, double &a, double &b);
@@ -71,6 +87,30 @@ public:
   size_t scan_to_whitespace(const string &str, size_t start = 0);
   static string format_int(int num);
 
+  void memoize_variable(const string &varname);
+  void invalidate_memos(const string &varname);
+
+  class Layer;
+
+  // While an Overlay exists, the scopes frozen by
+  // PPContext::freeze_scopes() are not modified; changes to them are
+  // kept in the Overlay instead, and forgotten when it is destructed.
+  class Overlay {
+  public:
+    Overlay(PPContext *context);
+    ~Overlay();
+
+  private:
+    PPContext *_context;
+
+    // Keyed by the scope's serial number, which unlike its address is
+    // never reused.
+    typedef map<int, Layer *> Layers;
+    Layers _layers;
+
+    friend class PPScope;
+  };
+
   static MapVariableDefinition _null_map_def;
   static DictVariableDefinition _null_dict_def;
 
@@ -86,10 +126,18 @@ private:
 
   string r_expand_string(const string &str, ExpandedVariable *expanded);
   string r_scan_variable(const string &str, size_t &vp);
+  string expand_param(const string &param);
   string r_expand_variable(const string &str, size_t &vp,
                PPScope::ExpandedVariable *expanded);
   string expand_variable_nested(const string &varname,
                 const string &scope_names);
+  string expand_memo_variable(const string &varname,
+                              ExpandedVariable *expanded);
+  bool check_memo(const string &varname, string &result);
+
+  void memo_read(const string &varname);
+  void memo_uncacheable();
+  static bool is_pure_function(const string &funcname);
 
   string expand_isfullpath(const string &params);
   string expand_osfilename(const string &params);
@@ -103,7 +151,15 @@ private:
   string expand_isfile(const string &params);
   string expand_libtest(const string &params);
   string expand_bintest(const string &params);
+  PPSearchCache *get_search_cache();
   string expand_shell(const string &params);
+  string expand_shell_cached(const string &params);
+  string expand_shell_async(const string &params);
+  string expand_shell_wait(const string &params);
+  string get_shell_dirname();
+  string run_shell(const string &command, const string &dirname,
+                   bool *succeeded = NULL);
+  string expand_sed(const string &params);
   string expand_standardize(const string &params);
   string expand_canonical(const string &params);
   string expand_length(const string &params);
@@ -167,12 +223,15 @@ private:
           int index, const string &prefix);
 
   MapVariableDefinition &
-  p_find_map_variable(const string &varname);
+  p_find_map_variable(const string &varname, bool for_write);
   DictVariableDefinition &
-  p_find_dict_variable(const string &varname);
+  p_find_dict_variable(const string &varname, bool for_write);
+
+  Layer *get_layer(bool create);
 
   void glob_string(const string &str, vector<string> &results);
 
+  PPContext *_context;
   PPNamedScopes *_named_scopes;
 
   PPDirectory *_directory;
@@ -188,7 +247,46 @@ private:
 
   PPScope *_parent_scope;
   typedef vector<PPScope *> ScopeStack;
-  static ScopeStack _scope_stack;
+
+  // The remembered expansions of the #memo variables, as expanded
+  // within this scope.  Each one is valid for as long as none of the
+  // variables it read has been redefined, and the scope stack and
+  // output directory are the same.
+  typedef vector<pair<unsigned int *, unsigned int> > MemoDeps;
+  class Memo {
+  public:
+    vector<int> _stack;
+    PPDirectory *_output_directory;
+    unsigned int _epoch;
+    MemoDeps _deps;
+    string _result;
+  };
+  typedef map<string, Memo> Memos;
+  Memos _memos;
+  Memos *get_memos(bool create);
+  int _serial;
+
+  // Collects the variables read while a memo is being computed.  The
+  // value is true for a variable first read from outside, false for
+  // one the expansion defined itself (e.g. the $[foreach] variable).
+  class MemoRecorder {
+  public:
+    MemoRecorder(PPContext *context);
+    ~MemoRecorder();
+
+    typedef map<unsigned int *, bool> Names;
+    Names _names;
+    bool _cacheable;
+    MemoRecorder *_next;
+
+  private:
+    PPContext *_context;
+  };
+
+  // Serial numbers are unique across all contexts.
+  static atomic<int> _next_serial;
+
+  friend class PPContext;
 };
 
 
@@ -0,0 +1,319 @@
+// Filename: ppSearchCache.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppSearchCache.h"
+#include "dSearchPath.h"
+#include "ppStats.h"
+#include "executionEnvironment.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+
+// The first line of the cache file, so we can recognize our own
+// files (and ignore files written by an incompatible version).
+static const string cache_header = "ppremake search cache 1";
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::Directory::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPSearchCache::Directory::
+Directory() {
+  _stat = false;
+  _timestamp = 0;
+  _scanned = false;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::find_file
+//       Access: Public
+//  Description: Searches for each of the candidate filenames in turn
+//               along the indicated search path, and returns the
+//               first one found, in the same form that
+//               DSearchPath::find_file() would return it; or the
+//               empty filename if none of them is found.
+////////////////////////////////////////////////////////////////////
+Filename PPSearchCache::
+find_file(const DSearchPath &searchpath, const vector<Filename> &candidates) {
+  // The answer depends on the candidates, the directories searched,
+  // and (if any of those directories is relative) the current
+  // directory.  It remains the same as long as none of the
+  // directories is modified.
+  Filename cwd;
+  int num_dirs = searchpath.get_num_directories();
+  string key;
+  vector<Filename> dirnames;
+  vector_string subdirs;
+  vector<Filename>::const_iterator ci;
+  for (ci = candidates.begin(); ci != candidates.end(); ++ci) {
+    key += (*ci).get_fullpath();
+    key += '|';
+
+    // Each distinct subdirectory named by the candidates means a
+    // different set of directories to search.
+    string subdir = (*ci).get_dirname();
+    if (find(subdirs.begin(), subdirs.end(), subdir) != subdirs.end()) {
+      continue;
+    }
+    subdirs.push_back(subdir);
+    for (int i = 0; i < num_dirs; ++i) {
+      Filename dirname = searchpath.get_directory(i);
+      if (dirname.is_local()) {
+        if (cwd.empty()) {
+          cwd = ExecutionEnvironment::get_cwd();
+        }
+        dirname = Filename(cwd, dirname);
+      }
+      if (!subdir.empty()) {
+        dirname = Filename(dirname, subdir);
+      }
+      dirnames.push_back(dirname);
+    }
+  }
+
+  string fingerprint;
+  vector<Filename>::const_iterator di;
+  for (di = dirnames.begin(); di != dirnames.end(); ++di) {
+    key += (*di).get_fullpath();
+    key += '|';
+
+    char buffer[32];
+    sprintf(buffer, "%lld ", (long long)get_directory(*di)._timestamp);
+    fingerprint += buffer;
+  }
+
+  Entries::iterator ei = _entries.find(key);
+  if (ei != _entries.end() && (*ei).second._fingerprint == fingerprint) {
+    return (*ei).second._result;
+  }
+
+  Filename result = search(searchpath, candidates);
+
+  Entry &entry = _entries[key];
+  entry._fingerprint = fingerprint;
+  entry._result = result.get_fullpath();
+  _modified = true;
+
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::read
+//       Access: Public
+//  Description: Reads the answers saved by a previous session from
+//               the indicated file, if it exists.  This only reads
+//               the file the first time it is called; the same file
+//               will be rewritten by write().
+////////////////////////////////////////////////////////////////////
+void PPSearchCache::
+read(const Filename &filename) {
+  if (_read) {
+    return;
+  }
+  _read = true;
+  _filename = filename;
+  _filename.set_text();
+
+  ifstream in;
+  if (!_filename.open_read(in)) {
+    return;
+  }
+
+  if (verbose) {
+    cerr << "Loading search cache " << _filename << "\n";
+  }
+
+  string line;
+  getline(in, line);
+  if (line != cache_header) {
+    // Not a file we understand; we'll replace it.
+    _modified = true;
+    return;
+  }
+
+  // Each line is the fingerprint, the key, and the result, separated
+  // by tabs.
+  getline(in, line);
+  while (!in.fail() && !in.eof()) {
+    size_t p = line.find('\t');
+    size_t q = (p == string::npos) ? p : line.find('\t', p + 1);
+    if (q == string::npos) {
+      cerr << "Ignoring invalid line in " << _filename << "\n";
+      _modified = true;
+    } else {
+      string key = line.substr(p + 1, q - p - 1);
+      if (_entries.find(key) == _entries.end()) {
+        Entry &entry = _entries[key];
+        entry._fingerprint = line.substr(0, p);
+        entry._result = line.substr(q + 1);
+      }
+    }
+    getline(in, line);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::write
+//       Access: Public
+//  Description: Saves the answers to the file named to read(), if
+//               anything has changed.  The file is replaced
+//               atomically, so that another ppremake reading it at
+//               the same time never sees it half-written.  Returns
+//               true on success (or if there is nothing to do), false
+//               on failure.
+////////////////////////////////////////////////////////////////////
+bool PPSearchCache::
+write() {
+  if (!_read || !_modified || dry_run) {
+    return true;
+  }
+
+  if (verbose) {
+    cerr << "Rewriting search cache " << _filename << "\n";
+  }
+
+  string contents = cache_header;
+  contents += "\n";
+  Entries::const_iterator ei;
+  for (ei = _entries.begin(); ei != _entries.end(); ++ei) {
+    contents += (*ei).second._fingerprint;
+    contents += "\t";
+    contents += (*ei).first;
+    contents += "\t";
+    contents += (*ei).second._result;
+    contents += "\n";
+  }
+
+  if (!_filename.atomic_write_contents(contents)) {
+    cerr << "Cannot update search cache " << _filename << "\n";
+    return false;
+  }
+
+  _modified = false;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPSearchCache::
+PPSearchCache() {
+  _read = false;
+  _modified = false;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::get_directory
+//       Access: Private
+//  Description: Returns the record for the indicated directory,
+//               which must be given as a full path.  The directory's
+//               timestamp is checked only the first time it is
+//               requested in a session, and its contents are not
+//               read until they are needed.
+////////////////////////////////////////////////////////////////////
+PPSearchCache::Directory &PPSearchCache::
+get_directory(const Filename &dirname) {
+  Directory &dir = _directories[dirname.get_fullpath()];
+  if (!dir._stat) {
+    dir._stat = true;
+    PPStats::count(PPStats::C_stats);
+    dir._timestamp = dirname.get_timestamp();
+  }
+  return dir;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::has_file
+//       Access: Private
+//  Description: Returns true if the named directory (a full path)
+//               lists a file by the indicated name.
+////////////////////////////////////////////////////////////////////
+bool PPSearchCache::
+has_file(const Filename &dirname, const string &basename) {
+  Directory &dir = get_directory(dirname);
+  if (!dir._scanned) {
+    dir._scanned = true;
+    if (dir._timestamp != 0) {
+      PPStats::count(PPStats::C_dirs_listed);
+      dirname.scan_directory(dir._files);
+#ifdef WIN32
+      // Windows filenames are not case-sensitive.
+      vector_string::iterator fi;
+      for (fi = dir._files.begin(); fi != dir._files.end(); ++fi) {
+        transform((*fi).begin(), (*fi).end(), (*fi).begin(), ::tolower);
+      }
+#endif
+      sort(dir._files.begin(), dir._files.end());
+    }
+  }
+
+#ifdef WIN32
+  string name = basename;
+  transform(name.begin(), name.end(), name.begin(), ::tolower);
+  return binary_search(dir._files.begin(), dir._files.end(), name);
+#else
+  return binary_search(dir._files.begin(), dir._files.end(), basename);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPSearchCache::search
+//       Access: Private
+//  Description: Does the actual work of find_file(), using the
+//               directory listings in place of stat'ing each
+//               candidate file.
+////////////////////////////////////////////////////////////////////
+Filename PPSearchCache::
+search(const DSearchPath &searchpath, const vector<Filename> &candidates) {
+  Filename cwd;
+  int num_dirs = searchpath.get_num_directories();
+
+  vector<Filename>::const_iterator ci;
+  for (ci = candidates.begin(); ci != candidates.end(); ++ci) {
+    const Filename &filename = (*ci);
+    if (!filename.is_local()) {
+      // A full path doesn't get searched for.
+      if (filename.exists()) {
+        return filename;
+      }
+      continue;
+    }
+
+    string subdir = filename.get_dirname();
+    string basename = filename.get_basename();
+    for (int i = 0; i < num_dirs; ++i) {
+      const Filename &dirname = searchpath.get_directory(i);
+      Filename fulldir = dirname;
+      if (fulldir.is_local()) {
+        if (cwd.empty()) {
+          cwd = ExecutionEnvironment::get_cwd();
+        }
+        fulldir = Filename(cwd, fulldir);
+      }
+      if (!subdir.empty()) {
+        fulldir = Filename(fulldir, subdir);
+      }
+
+      if (has_file(fulldir, basename)) {
+        // The directory lists it; make sure it's not (for instance) a
+        // dangling symlink, as DSearchPath would.
+        Filename match(dirname, filename);
+        if (match.exists()) {
+          if (dirname == "." && filename.is_fully_qualified()) {
+            // The same special case as in DSearchPath::find_file().
+            return filename;
+          }
+          return match;
+        }
+      }
+    }
+  }
+
+  return Filename();
+}
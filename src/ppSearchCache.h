@@ -0,0 +1,75 @@
+// Filename: ppSearchCache.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPSEARCHCACHE_H
+#define PPSEARCHCACHE_H
+
+#include "ppremake.h"
+#include "filename.h"
+#include "vector_string.h"
+
+#include <map>
+
+class DSearchPath;
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPSearchCache
+// Description : Speeds up the searches made by $[libtest] and
+//               $[bintest], which tend to look for the same handful
+//               of files along the same search paths over and over.
+//
+//               Rather than stat each candidate file in each
+//               directory, we read the list of files in each
+//               directory once, and look the candidates up in that.
+//               The answer to each search is also remembered, along
+//               with the timestamps of the directories that were
+//               searched; if $[SEARCH_CACHE_FILENAME] is defined,
+//               these answers are saved between sessions, and
+//               remain valid as long as none of the directories has
+//               since been modified.
+////////////////////////////////////////////////////////////////////
+class PPSearchCache {
+public:
+  PPSearchCache();
+
+  Filename find_file(const DSearchPath &searchpath,
+                     const vector<Filename> &candidates);
+
+  void read(const Filename &filename);
+  bool write();
+
+private:
+  class Directory {
+  public:
+    Directory();
+
+    bool _stat;
+    time_t _timestamp;
+    bool _scanned;
+    vector_string _files;
+  };
+
+  Directory &get_directory(const Filename &dirname);
+  bool has_file(const Filename &dirname, const string &basename);
+  Filename search(const DSearchPath &searchpath,
+                  const vector<Filename> &candidates);
+
+  typedef map<string, Directory> Directories;
+  Directories _directories;
+
+  class Entry {
+  public:
+    string _fingerprint;
+    string _result;
+  };
+  typedef map<string, Entry> Entries;
+  Entries _entries;
+
+  Filename _filename;
+  bool _read;
+  bool _modified;
+};
+
+#endif
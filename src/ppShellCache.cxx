@@ -0,0 +1,191 @@
+// Filename: ppShellCache.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppShellCache.h"
+#include "md5.h"
+
+#include <stdio.h>
+
+// The first line of the cache file, so we can recognize our own
+// files (and ignore files written by an incompatible version).
+static const string cache_header = "ppremake shell cache 1";
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::lookup
+//       Access: Public
+//  Description: Looks for a previous result of the indicated command
+//               in the indicated directory.  If there is one, and its
+//               fingerprint matches, fills result and returns true;
+//               otherwise returns false.
+////////////////////////////////////////////////////////////////////
+bool PPShellCache::
+lookup(const string &command, const string &dirname,
+       const string &fingerprint, string &result) {
+  Entries::const_iterator ei = _entries.find(make_key(command, dirname));
+  if (ei == _entries.end() || (*ei).second._fingerprint != fingerprint) {
+    return false;
+  }
+  result = (*ei).second._result;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::store
+//       Access: Public
+//  Description: Records the result of running the indicated command
+//               in the indicated directory, replacing any previous
+//               result for the same command.
+////////////////////////////////////////////////////////////////////
+void PPShellCache::
+store(const string &command, const string &dirname,
+      const string &fingerprint, const string &result) {
+  Entry &entry = _entries[make_key(command, dirname)];
+  if (entry._fingerprint != fingerprint || entry._result != result) {
+    entry._fingerprint = fingerprint;
+    entry._result = result;
+    _modified = true;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::read
+//       Access: Public
+//  Description: Reads the results saved by a previous session from
+//               the indicated file, if it exists.  This only reads
+//               the file the first time it is called; the same file
+//               will be rewritten by write().
+////////////////////////////////////////////////////////////////////
+void PPShellCache::
+read(const Filename &filename) {
+  if (_read) {
+    return;
+  }
+  _read = true;
+  _filename = filename;
+  _filename.set_text();
+
+  ifstream in;
+  if (!_filename.open_read(in)) {
+    return;
+  }
+
+  if (verbose) {
+    cerr << "Loading shell cache " << _filename << "\n";
+  }
+
+  string line;
+  getline(in, line);
+  if (line != cache_header) {
+    // Not a file we understand; we'll replace it.
+    _modified = true;
+    return;
+  }
+
+  // Each line is the key, the fingerprint, and the result, separated
+  // by a single space.  The key and fingerprint are hex digests, and
+  // the result never contains a newline.
+  getline(in, line);
+  while (!in.fail() && !in.eof()) {
+    size_t p = line.find(' ');
+    size_t q = (p == string::npos) ? p : line.find(' ', p + 1);
+    if (q == string::npos) {
+      cerr << "Ignoring invalid line in " << _filename << "\n";
+      _modified = true;
+    } else {
+      Entry &entry = _entries[line.substr(0, p)];
+      entry._fingerprint = line.substr(p + 1, q - p - 1);
+      entry._result = line.substr(q + 1);
+    }
+    getline(in, line);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::write
+//       Access: Public
+//  Description: Saves the results to the file named to read(), if
+//               anything has changed.  The file is replaced
+//               atomically, so that another ppremake reading it at
+//               the same time never sees it half-written.  Returns
+//               true on success (or if there is nothing to do), false
+//               on failure.
+////////////////////////////////////////////////////////////////////
+bool PPShellCache::
+write() {
+  if (!_read || !_modified || dry_run) {
+    return true;
+  }
+
+  if (verbose) {
+    cerr << "Rewriting shell cache " << _filename << "\n";
+  }
+
+  string contents = cache_header;
+  contents += "\n";
+  Entries::const_iterator ei;
+  for (ei = _entries.begin(); ei != _entries.end(); ++ei) {
+    contents += (*ei).first;
+    contents += " ";
+    contents += (*ei).second._fingerprint;
+    contents += " ";
+    contents += (*ei).second._result;
+    contents += "\n";
+  }
+
+  if (!_filename.atomic_write_contents(contents)) {
+    cerr << "Cannot update shell cache " << _filename << "\n";
+    return false;
+  }
+
+  _modified = false;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::hash
+//       Access: Public, Static
+//  Description: Returns the MD5 digest of the indicated string, as
+//               32 hex digits.
+////////////////////////////////////////////////////////////////////
+string PPShellCache::
+hash(const string &str) {
+  PP_MD5_CTX context;
+  unsigned char digest[16];
+
+  MD5Init(&context);
+  MD5Update(&context, reinterpret_cast<const unsigned char *>(str.data()),
+            str.size());
+  MD5Final(digest, &context);
+
+  string result;
+  char hex[3];
+  for (int i = 0; i < 16; i++) {
+    sprintf(hex, "%02x", digest[i]);
+    result.append(hex);
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPShellCache::
+PPShellCache() {
+  _read = false;
+  _modified = false;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPShellCache::make_key
+//       Access: Private, Static
+//  Description: Returns the key under which the result of the
+//               indicated command is stored.
+////////////////////////////////////////////////////////////////////
+string PPShellCache::
+make_key(const string &command, const string &dirname) {
+  return hash(dirname + '\0' + command);
+}
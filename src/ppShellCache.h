@@ -0,0 +1,59 @@
+// Filename: ppShellCache.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPSHELLCACHE_H
+#define PPSHELLCACHE_H
+
+#include "ppremake.h"
+#include "filename.h"
+
+#include <map>
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPShellCache
+// Description : Remembers the results of $[shell-cached] commands,
+//               so that the same command need not be run more than
+//               once.  Each result is keyed by the command and the
+//               directory it runs in, and is valid only as long as
+//               its fingerprint is unchanged; the fingerprint is
+//               computed by the caller from whatever files and
+//               environment variables the command was declared to
+//               depend on.
+//
+//               The results are always kept for the duration of the
+//               session, and are also saved between sessions if
+//               $[SHELL_CACHE_FILENAME] is defined.
+////////////////////////////////////////////////////////////////////
+class PPShellCache {
+public:
+  PPShellCache();
+
+  bool lookup(const string &command, const string &dirname,
+              const string &fingerprint, string &result);
+  void store(const string &command, const string &dirname,
+             const string &fingerprint, const string &result);
+
+  void read(const Filename &filename);
+  bool write();
+
+  static string hash(const string &str);
+
+private:
+  static string make_key(const string &command, const string &dirname);
+
+  class Entry {
+  public:
+    string _fingerprint;
+    string _result;
+  };
+  typedef map<string, Entry> Entries;
+  Entries _entries;
+
+  Filename _filename;
+  bool _read;
+  bool _modified;
+};
+
+#endif
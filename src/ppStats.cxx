@@ -0,0 +1,186 @@
+// Filename: ppStats.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppStats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+#ifdef WIN32_VC
+#include <windows.h>
+#include <psapi.h>
+#elif defined(HAVE_SYS_RESOURCE_H)
+#include <sys/resource.h>
+#endif
+
+PPStats *PPStats::_global_ptr = (PPStats *)NULL;
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPStats::enable
+//       Access: Public, Static
+//  Description: Turns on counting for the rest of the session.  This
+//               must be called before any other threads are started.
+////////////////////////////////////////////////////////////////////
+void PPStats::
+enable() {
+  if (_global_ptr == (PPStats *)NULL) {
+    _global_ptr = new PPStats;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPStats::write_report
+//       Access: Public, Static
+//  Description: Writes the counts gathered so far to cerr, if --stats
+//               is in effect.  This should be called only when no
+//               other threads are running.
+////////////////////////////////////////////////////////////////////
+void PPStats::
+write_report() {
+  if (!is_enabled()) {
+    return;
+  }
+  PPStats *stats = _global_ptr;
+
+  unsigned long long counters[C_num_counters];
+  for (int i = 0; i < C_num_counters; ++i) {
+    counters[i] = stats->_counters[i].load();
+  }
+
+  unsigned long long num_found = 0;
+  Levels::const_iterator li;
+  for (li = stats->_lookup_levels.begin();
+       li != stats->_lookup_levels.end();
+       ++li) {
+    num_found += (*li);
+  }
+  unsigned long long num_lookups = num_found +
+    counters[C_env_lookups] + counters[C_undefined_lookups];
+
+  vector<pair<unsigned long long, string> > functions;
+  unsigned long long num_calls = 0;
+  Functions::const_iterator fi;
+  for (fi = stats->_functions.begin(); fi != stats->_functions.end(); ++fi) {
+    functions.push_back(make_pair((*fi).second, (*fi).first));
+    num_calls += (*fi).second;
+  }
+  // Most calls first, then by name.
+  sort(functions.begin(), functions.end(),
+       [](const pair<unsigned long long, string> &a,
+          const pair<unsigned long long, string> &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+
+  ostringstream out;
+  out << "\nRun statistics:\n";
+
+  char buffer[128];
+  auto line = [&](const string &label, unsigned long long value) {
+    sprintf(buffer, "  %-38s %12llu\n", label.c_str(), value);
+    out << buffer;
+  };
+
+  line(SOURCE_FILENAME " files read", counters[C_source_files]);
+  line("script lines executed", counters[C_script_lines]);
+
+  line("variable lookups", num_lookups);
+  for (size_t level = 0; level < stats->_lookup_levels.size(); ++level) {
+    if (level == 0) {
+      line("  found in the current scope", stats->_lookup_levels[level]);
+    } else {
+      sprintf(buffer, "  found %d level%s down the stack", (int)level,
+              level == 1 ? "" : "s");
+      line(buffer, stats->_lookup_levels[level]);
+    }
+  }
+  line("  found in the environment", counters[C_env_lookups]);
+  line("  undefined", counters[C_undefined_lookups]);
+
+  line("function calls", num_calls);
+  vector<pair<unsigned long long, string> >::const_iterator ci;
+  for (ci = functions.begin(); ci != functions.end(); ++ci) {
+    line("  $[" + (*ci).second + "]", (*ci).first);
+  }
+
+  line("shell commands run", counters[C_shell_commands]);
+  sprintf(buffer, "  %-38s %12.3f\n", "  seconds waiting for them",
+          counters[C_shell_wait_usec] / 1000000.0);
+  out << buffer;
+
+  line("files scanned for #include", counters[C_files_scanned]);
+  line("files served from dependency cache", counters[C_files_from_cache]);
+  line("  cache entries out of date", counters[C_cache_stale]);
+  line("  cache entries flushed as suspect", counters[C_cache_suspect]);
+
+  line("stat() calls", counters[C_stats]);
+  line("directories listed", counters[C_dirs_listed]);
+
+  line("output files compared", counters[C_outputs_compared]);
+  line("output files rewritten", counters[C_outputs_written]);
+
+  unsigned long long peak_rss = get_peak_rss();
+  if (peak_rss != 0) {
+    line("peak RSS (KB)", peak_rss / 1024);
+  }
+
+  cerr << out.str();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPStats::Constructor
+//       Access: Private
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPStats::
+PPStats() {
+  for (int i = 0; i < C_num_counters; ++i) {
+    _counters[i] = 0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPStats::get_time
+//       Access: Private, Static
+//  Description: Returns a time in microseconds, for Timer.
+////////////////////////////////////////////////////////////////////
+long long PPStats::
+get_time() {
+  return chrono::duration_cast<chrono::microseconds>
+    (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPStats::get_peak_rss
+//       Access: Private, Static
+//  Description: Returns the largest amount of memory, in bytes, the
+//               process has had resident at once, or 0 if this can't
+//               be determined on this platform.
+////////////////////////////////////////////////////////////////////
+unsigned long long PPStats::
+get_peak_rss() {
+#ifdef WIN32_VC
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+
+#elif defined(HAVE_SYS_RESOURCE_H)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef HAVE_OSX
+  // OSX reports this in bytes, everyone else in kilobytes.
+  return (unsigned long long)usage.ru_maxrss;
+#else
+  return (unsigned long long)usage.ru_maxrss * 1024;
+#endif
+
+#else
+  return 0;
+#endif
+}
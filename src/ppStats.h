@@ -0,0 +1,94 @@
+// Filename: ppStats.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPSTATS_H
+#define PPSTATS_H
+
+#include "ppremake.h"
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPStats
+// Description : Counts the expensive operations performed during a
+//               run, for --stats: files read, lines interpreted,
+//               variable lookups, function calls, shell commands,
+//               dependency scans, stat() calls, directory listings,
+//               and output files.  A summary is written to cerr at
+//               the end of the run.
+//
+//               This is the cheap complement to PPProfiler: it keeps
+//               no timings (other than the time spent waiting for
+//               shell commands) and no stacks, so it can be left on
+//               for any run to see at a glance why the run was slow.
+//
+//               The simple counters may be bumped from any thread.
+//               The variable lookups and function calls are broken
+//               down further, and those are counted only by the main
+//               thread, which is the only one that expands variables.
+////////////////////////////////////////////////////////////////////
+class PPStats {
+public:
+  enum Counter {
+    C_source_files,
+    C_script_lines,
+    C_env_lookups,
+    C_undefined_lookups,
+    C_shell_commands,
+    C_shell_wait_usec,
+    C_files_scanned,
+    C_files_from_cache,
+    C_cache_stale,
+    C_cache_suspect,
+    C_stats,
+    C_dirs_listed,
+    C_outputs_compared,
+    C_outputs_written,
+
+    C_num_counters
+  };
+
+  static void enable();
+  INLINE static bool is_enabled();
+  INLINE static void count(Counter counter, unsigned long long n = 1);
+  INLINE static void count_lookup(size_t level);
+  INLINE static void count_function(const string &funcname);
+  static void write_report();
+
+  class Timer {
+  public:
+    INLINE Timer(Counter counter);
+    INLINE ~Timer();
+
+  private:
+    bool _active;
+    Counter _counter;
+    long long _start;
+  };
+
+private:
+  PPStats();
+
+  static long long get_time();
+  static unsigned long long get_peak_rss();
+
+  atomic<unsigned long long> _counters[C_num_counters];
+
+  // The number of variables found in the current scope (level 0), in
+  // the scope one down the stack (level 1), and so on.
+  typedef vector<unsigned long long> Levels;
+  Levels _lookup_levels;
+
+  typedef map<string, unsigned long long> Functions;
+  Functions _functions;
+
+  static PPStats *_global_ptr;
+};
+
+#include "ppStats.I"
+
+#endif
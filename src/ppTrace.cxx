@@ -0,0 +1,178 @@
+// Filename: ppTrace.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppTrace.h"
+#include "filename.h"
+
+#include <chrono>
+#include <stdio.h>
+
+PPTrace *PPTrace::_global_ptr = (PPTrace *)NULL;
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::enable
+//       Access: Public, Static
+//  Description: Turns on tracing for the rest of the session.  The
+//               events will be written to the indicated file by
+//               write().
+////////////////////////////////////////////////////////////////////
+void PPTrace::
+enable(const string &filename) {
+  if (_global_ptr == (PPTrace *)NULL) {
+    _global_ptr = new PPTrace(filename);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::write
+//       Access: Public, Static
+//  Description: Writes out the events recorded so far, if tracing is
+//               enabled.  This should be called only when no other
+//               threads are running.  Returns true on success (or if
+//               there is nothing to do), false on failure.
+////////////////////////////////////////////////////////////////////
+bool PPTrace::
+write() {
+  if (!is_enabled()) {
+    return true;
+  }
+  PPTrace *trace = _global_ptr;
+
+  Filename filename = Filename::text_filename(trace->_filename);
+  ofstream out;
+  if (!filename.open_write(out)) {
+    cerr << "Unable to write trace " << filename << "\n";
+    return false;
+  }
+
+  out << "{\"traceEvents\":[\n";
+
+  // Name the tracks first.
+  int num_threads = (int)trace->_threads.size();
+  for (int i = 0; i < num_threads; ++i) {
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+        << ",\"args\":{\"name\":\"";
+    if (i == 0) {
+      out << "ppremake";
+    } else {
+      out << "worker " << i;
+    }
+    out << "\"}},\n";
+  }
+
+  Events::const_iterator ei;
+  for (ei = trace->_events.begin(); ei != trace->_events.end(); ++ei) {
+    const Event &event = (*ei);
+    out << "{\"name\":";
+    write_string(out, event._name);
+    out << ",\"cat\":\"" << event._category << "\",\"ph\":\"X\",\"ts\":"
+        << event._start << ",\"dur\":" << event._duration
+        << ",\"pid\":1,\"tid\":" << event._thread << "},\n";
+  }
+
+  // A final event with no comma after it, to close the list.
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+      << "\"args\":{\"name\":\"ppremake\"}}\n"
+      << "],\"displayTimeUnit\":\"ms\"}\n";
+
+  if (!out) {
+    cerr << "Unable to write trace " << filename << "\n";
+    return false;
+  }
+
+  cerr << "Wrote trace to " << filename << "\n";
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::Constructor
+//       Access: Private
+//  Description:
+////////////////////////////////////////////////////////////////////
+PPTrace::
+PPTrace(const string &filename) :
+  _filename(filename)
+{
+  _epoch = 0;
+  _epoch = get_time();
+
+  // This is called from the main thread, so that gets track 0.
+  get_thread_index();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::get_time
+//       Access: Private
+//  Description: Returns the number of microseconds since tracing was
+//               enabled.
+////////////////////////////////////////////////////////////////////
+long long PPTrace::
+get_time() const {
+  long long now = chrono::duration_cast<chrono::microseconds>
+    (chrono::steady_clock::now().time_since_epoch()).count();
+  return now - _epoch;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::add_event
+//       Access: Private
+//  Description: Records a completed span.  This may be called from
+//               any thread.
+////////////////////////////////////////////////////////////////////
+void PPTrace::
+add_event(const char *category, const string &name,
+          long long start, long long end) {
+  lock_guard<mutex> guard(_lock);
+  Event event;
+  event._category = category;
+  event._name = name;
+  event._start = start;
+  event._duration = end - start;
+  event._thread = get_thread_index();
+  _events.push_back(event);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::get_thread_index
+//       Access: Private
+//  Description: Returns a small number that identifies the calling
+//               thread, numbering them in the order they are first
+//               seen.  The lock must be held.
+////////////////////////////////////////////////////////////////////
+int PPTrace::
+get_thread_index() {
+  thread::id id = this_thread::get_id();
+  Threads::const_iterator ti = _threads.find(id);
+  if (ti != _threads.end()) {
+    return (*ti).second;
+  }
+  int index = (int)_threads.size();
+  _threads[id] = index;
+  return index;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: PPTrace::write_string
+//       Access: Private, Static
+//  Description: Writes the indicated string as a quoted JSON string.
+////////////////////////////////////////////////////////////////////
+void PPTrace::
+write_string(ostream &out, const string &str) {
+  out << '"';
+  string::const_iterator si;
+  for (si = str.begin(); si != str.end(); ++si) {
+    unsigned char c = (*si);
+    if (c == '"' || c == '\\') {
+      out << '\\' << (*si);
+    } else if (c < 0x20) {
+      char buffer[8];
+      sprintf(buffer, "\\u%04x", c);
+      out << buffer;
+    } else {
+      out << (*si);
+    }
+  }
+  out << '"';
+}
@@ -0,0 +1,84 @@
+// Filename: ppTrace.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPTRACE_H
+#define PPTRACE_H
+
+#include "ppremake.h"
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////
+//       Class : PPTrace
+// Description : Records a timeline of the run for --trace, in the
+//               Trace Event format read by chrome://tracing and
+//               Perfetto.
+//
+//               Each Span object marks out one event: a phase of the
+//               run, such as reading the source tree or processing
+//               one directory, or a piece of work within one, such as
+//               a $[shell] command, an #include, a dependency scan,
+//               or the writing of an output file.  Spans nest, and
+//               may be opened from any thread; each thread appears
+//               as its own track in the timeline.
+//
+//               Unlike PPProfiler, which summarizes, this keeps every
+//               event, so it records only the coarser kinds of work.
+////////////////////////////////////////////////////////////////////
+class PPTrace {
+public:
+  static void enable(const string &filename);
+  INLINE static bool is_enabled();
+  static bool write();
+
+  class Span {
+  public:
+    INLINE Span(const char *category, const string &name);
+    INLINE ~Span();
+
+  private:
+    bool _active;
+    const char *_category;
+    string _name;
+    long long _start;
+  };
+
+private:
+  PPTrace(const string &filename);
+
+  long long get_time() const;
+  void add_event(const char *category, const string &name,
+                 long long start, long long end);
+  int get_thread_index();
+
+  static void write_string(ostream &out, const string &str);
+
+  class Event {
+  public:
+    const char *_category;
+    string _name;
+    long long _start;
+    long long _duration;
+    int _thread;
+  };
+  typedef vector<Event> Events;
+  Events _events;
+
+  typedef map<thread::id, int> Threads;
+  Threads _threads;
+
+  mutex _lock;
+  string _filename;
+  long long _epoch;
+
+  static PPTrace *_global_ptr;
+};
+
+#include "ppTrace.I"
+
+#endif
@@ -0,0 +1,365 @@
+// Filename: ppbench.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+//
+// A microbenchmark harness for the expansion engine and the
+// string-handling helpers beneath it.  This is not built by default;
+// run "make ppbench" in the src directory to build it.
+//
+// Each benchmark is run for a doubling number of iterations until it
+// has taken at least the minimum time, and is then reported as the
+// time and the number of heap allocations per iteration.
+//
+//   ppbench [-t seconds] [-l] [name ...]
+//
+// With names, only the benchmarks whose names contain one of them are
+// run; -l lists the benchmarks instead of running them.
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppremake.h"
+#include "ppScope.h"
+#include "ppContext.h"
+#include "ppNamedScopes.h"
+#include "ppCommandFile.h"
+#include "ppFilenamePattern.h"
+#include "globPattern.h"
+#include "check_include.h"
+#include "tokenize.h"
+#include "ppbenchAlloc.h"
+
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Results are added into this, so the compiler can't discard the work
+// that produced them.  It is deliberately not static.
+size_t sink = 0;
+
+// The scope that the expansion benchmarks run in; see setup().
+static PPContext *context;
+static PPNamedScopes *named_scopes;
+static PPScope *scope;
+
+// Each of these expressions is a benchmark of PPScope::expand_string().
+struct ExpandBenchmark {
+  const char *_name;
+  const char *_expr;
+};
+
+static const ExpandBenchmark expand_benchmarks[] = {
+  { "expand/plain-text",
+    "some ordinary text without any variable references at all" },
+  { "expand/variable", "$[SHORT]" },
+  { "expand/deep-nesting",
+    "$[upcase $[downcase $[upcase $[downcase $[upcase $[downcase "
+    "$[upcase $[downcase $[upcase $[downcase $[upcase $[downcase "
+    "$[SHORT]]]]]]]]]]]]]" },
+  { "expand/deferred-chain", "$[D6]" },
+  { "expand/words", "$[words $[WORDS]]" },
+  { "expand/patsubst", "$[patsubst %.cxx,%.o,$[WORDS]]" },
+  { "expand/filter", "$[filter %.h %.I,$[WORDS]]" },
+  { "expand/sort", "$[sort $[WORDS]]" },
+  { "expand/unique", "$[unique $[WORDS] $[WORDS]]" },
+  { "expand/matrix", "$[matrix a b c d,1 2 3 4 5 6,.cxx .h .I]" },
+  { "expand/foreach", "$[foreach w,$[SHORT],<$[w]>]" },
+  { "expand/if", "$[if $[SHORT],$[D3],$[D6]]" },
+  { "expand/map", "$[libs $[KEY],lib10 lib20 lib30 lib40]" },
+  { "expand/closure", "$[closure libs,$[LOCAL_LIBS]]" },
+  { "expand/defun", "$[pair $[SHORT],$[D2]]" },
+};
+static const int num_expand_benchmarks =
+  sizeof(expand_benchmarks) / sizeof(expand_benchmarks[0]);
+
+////////////////////////////////////////////////////////////////////
+//     Function: setup
+//  Description: Defines the variables, named scopes, map variable
+//               and function that the expansion benchmarks refer to.
+//               Returns true on success, false on failure.
+////////////////////////////////////////////////////////////////////
+static bool
+setup() {
+  context = new PPContext;
+  PPScope *global_scope = new PPScope(context, (PPNamedScopes *)NULL);
+  context->push_scope(global_scope);
+
+  named_scopes = new PPNamedScopes(context);
+  named_scopes->set_current("bench");
+  scope = new PPScope(context, named_scopes);
+  context->push_scope(scope);
+
+  // A long list of source filenames, with some repeats.
+  string words;
+  for (int i = 0; i < 400; ++i) {
+    string base = "file" + PPScope::format_int((i * 7919) % 300);
+    words += base + ".cxx " + base + ".h " + base + ".I ";
+  }
+  scope->define_variable("WORDS", words);
+
+  ostringstream script;
+  script
+    << "#define SHORT alpha beta gamma delta epsilon zeta eta theta\n"
+    << "#defer D0 x\n";
+  for (int i = 1; i <= 6; ++i) {
+    script << "#defer D" << i << " $[D" << i - 1 << "] $[D" << i - 1 << "]\n";
+  }
+
+  // A chain of libraries, each depending on the two before it.
+  for (int i = 0; i < 50; ++i) {
+    script << "#begin lib\n"
+           << "  #define KEY lib" << i << "\n"
+           << "  #define LOCAL_LIBS";
+    if (i > 0) {
+      script << " lib" << i - 1;
+    }
+    if (i > 1) {
+      script << " lib" << i - 2;
+    }
+    script << "\n#end lib\n";
+  }
+  script
+    << "#map libs KEY(lib)\n"
+    << "#define LOCAL_LIBS lib49\n"
+    << "#defun pair a,b\n"
+    << "  $[a]-$[b]\n"
+    << "#end pair\n";
+
+  PPCommandFile setup_file(scope);
+  istringstream in(script.str());
+  if (!setup_file.read_stream(in, "setup") ||
+      context->get_errors_occurred()) {
+    cerr << "Error in benchmark setup.\n";
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_expand
+//  Description: The body of each of the expand_benchmarks.
+////////////////////////////////////////////////////////////////////
+static void
+run_expand(const string &expr, int iterations) {
+  for (int i = 0; i < iterations; ++i) {
+    sink += scope->expand_string(expr).length();
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_tokenize_params
+//  Description:
+////////////////////////////////////////////////////////////////////
+static void
+run_tokenize_params(int iterations) {
+  string params = "%.cxx, $[patsubst %.h,%.I,$[SOURCES]] , a b c,"
+    "$[if $[x],$[y],$[z]],$[foreach w,1 2 3,$[w]],last";
+  vector<string> tokens;
+  for (int i = 0; i < iterations; ++i) {
+    tokens.clear();
+    scope->tokenize_params(params, tokens, false);
+    sink += tokens.size();
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_tokenize_whitespace
+//  Description: Splits the long word list up and pastes it back
+//               together again.
+////////////////////////////////////////////////////////////////////
+static void
+run_tokenize_whitespace(int iterations) {
+  string words = scope->expand_variable("WORDS");
+  vector<string> tokens;
+  for (int i = 0; i < iterations; ++i) {
+    tokens.clear();
+    tokenize_whitespace(words, tokens);
+    sink += repaste(tokens, " ").length();
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_glob_matches
+//  Description:
+////////////////////////////////////////////////////////////////////
+static void
+run_glob_matches(int iterations) {
+  GlobPattern star("*_src.cxx");
+  GlobPattern range("[a-m]*.[hI]");
+  static const char *const names[] = {
+    "ppScope.cxx", "ppScope.h", "composite_src.cxx", "globPattern.I",
+    "tokenize.h", "Sources.pp",
+  };
+  for (int i = 0; i < iterations; ++i) {
+    for (int n = 0; n < 6; ++n) {
+      sink += star.matches(names[n]);
+      sink += range.matches(names[n]);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_filename_pattern
+//  Description:
+////////////////////////////////////////////////////////////////////
+static void
+run_filename_pattern(int iterations) {
+  PPFilenamePattern from("%.cxx");
+  PPFilenamePattern to("$[ODIR]/%.o");
+  for (int i = 0; i < iterations; ++i) {
+    sink += to.transform("ppCommandFile.cxx", from).length();
+    sink += to.transform("ppCommandFile.h", from).length();
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_check_include
+//  Description:
+////////////////////////////////////////////////////////////////////
+static void
+run_check_include(int iterations) {
+  static const char *const lines[] = {
+    "#include \"ppScope.h\"",
+    "  #  include <vector>",
+    "int main(int argc, char *argv[]) {",
+    "// #include \"commented.h\"",
+  };
+  for (int i = 0; i < iterations; ++i) {
+    for (int n = 0; n < 4; ++n) {
+      sink += check_include(lines[n]).length();
+    }
+  }
+}
+
+typedef void OtherFunc(int iterations);
+struct OtherBenchmark {
+  const char *_name;
+  OtherFunc *_func;
+};
+
+static const OtherBenchmark other_benchmarks[] = {
+  { "tokenize_params", run_tokenize_params },
+  { "tokenize_whitespace+repaste", run_tokenize_whitespace },
+  { "GlobPattern::matches", run_glob_matches },
+  { "PPFilenamePattern::transform", run_filename_pattern },
+  { "check_include", run_check_include },
+};
+static const int num_other_benchmarks =
+  sizeof(other_benchmarks) / sizeof(other_benchmarks[0]);
+
+////////////////////////////////////////////////////////////////////
+//     Function: run_one
+//  Description: Runs the indicated benchmark (either expr is
+//               non-NULL, for an expansion benchmark, or func is) and
+//               reports its results.
+////////////////////////////////////////////////////////////////////
+static void
+run_one(const char *name, const char *expr, OtherFunc *func,
+        double min_time) {
+  // Once first, so that any one-time setup is not counted.
+  if (expr != NULL) {
+    run_expand(expr, 1);
+  } else {
+    func(1);
+  }
+
+  int iterations = 1;
+  double elapsed = 0.0;
+  unsigned long long allocs = 0;
+  for (;;) {
+    unsigned long long start_allocs = ppbench_allocations;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (expr != NULL) {
+      run_expand(expr, iterations);
+    } else {
+      func(iterations);
+    }
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    allocs = ppbench_allocations - start_allocs;
+    elapsed = chrono::duration<double>(end - start).count();
+    if (elapsed >= min_time || iterations >= (1 << 30)) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  printf("%-32s %12d %12.1f %12.1f\n", name, iterations,
+         elapsed * 1.0e9 / iterations, (double)allocs / iterations);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: is_selected
+//  Description: Returns true if the named benchmark was asked for on
+//               the command line (or if none were named).
+////////////////////////////////////////////////////////////////////
+static bool
+is_selected(const string &name, const vector_string &filters) {
+  if (filters.empty()) {
+    return true;
+  }
+  vector_string::const_iterator fi;
+  for (fi = filters.begin(); fi != filters.end(); ++fi) {
+    if (name.find(*fi) != string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int
+main(int argc, char *argv[]) {
+  double min_time = 0.5;
+  bool list_only = false;
+  vector_string filters;
+
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-t" && i + 1 < argc) {
+      min_time = atof(argv[++i]);
+    } else if (arg == "-l") {
+      list_only = true;
+    } else if (!arg.empty() && arg[0] == '-') {
+      cerr << "Usage: ppbench [-t seconds] [-l] [name ...]\n";
+      return 1;
+    } else {
+      filters.push_back(arg);
+    }
+  }
+
+  if (!setup()) {
+    return 1;
+  }
+
+  if (!list_only) {
+    printf("%-32s %12s %12s %12s\n", "benchmark", "iterations", "ns/op",
+           "allocs/op");
+  }
+
+  for (int i = 0; i < num_expand_benchmarks; ++i) {
+    const ExpandBenchmark &bench = expand_benchmarks[i];
+    if (is_selected(bench._name, filters)) {
+      if (list_only) {
+        printf("%s\n", bench._name);
+      } else {
+        run_one(bench._name, bench._expr, NULL, min_time);
+      }
+    }
+  }
+  for (int i = 0; i < num_other_benchmarks; ++i) {
+    const OtherBenchmark &bench = other_benchmarks[i];
+    if (is_selected(bench._name, filters)) {
+      if (list_only) {
+        printf("%s\n", bench._name);
+      } else {
+        run_one(bench._name, NULL, bench._func, min_time);
+      }
+    }
+  }
+
+  if (context->get_errors_occurred()) {
+    cerr << "Errors occurred during the benchmarks.\n";
+    return 1;
+  }
+  return 0;
+}
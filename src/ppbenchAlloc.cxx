@@ -0,0 +1,56 @@
+// Filename: ppbenchAlloc.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+//
+// The replacement operator new and delete for ppbench.  These live in
+// their own file so that the compiler never inlines them into their
+// callers; otherwise GCC sees free() applied to the result of a call
+// to operator new, and warns that they are mismatched.
+//
+////////////////////////////////////////////////////////////////////
+
+#include "ppremake.h"
+#include "ppbenchAlloc.h"
+
+#include <new>
+#include <stdlib.h>
+
+// The benchmarks are run from the main thread only, so this needn't
+// be atomic.
+unsigned long long ppbench_allocations = 0;
+
+void *
+operator new(size_t size) {
+  ++ppbench_allocations;
+  void *ptr = malloc(size > 0 ? size : 1);
+  if (ptr == NULL) {
+    throw bad_alloc();
+  }
+  return ptr;
+}
+
+void *
+operator new[](size_t size) {
+  return operator new(size);
+}
+
+void
+operator delete(void *ptr) noexcept {
+  free(ptr);
+}
+
+void
+operator delete[](void *ptr) noexcept {
+  free(ptr);
+}
+
+void
+operator delete(void *ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void
+operator delete[](void *ptr, size_t) noexcept {
+  free(ptr);
+}
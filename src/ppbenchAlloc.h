@@ -0,0 +1,13 @@
+// Filename: ppbenchAlloc.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef PPBENCHALLOC_H
+#define PPBENCHALLOC_H
+
+// The number of times operator new has been called.  ppbench replaces
+// the global operator new and delete to count this.
+extern unsigned long long ppbench_allocations;
+
+#endif
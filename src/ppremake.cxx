@@ -6,21 +6,25 @@
 #include "ppremake.h"
 #include "ppMain.h"
 #include "ppScope.h"
+#include "ppContext.h"
 #include "check_include.h"
 #include "tokenize.h"
 #include "sedProcess.h"
+#include "ppProfiler.h"
+#include "ppStats.h"
+#include "ppTrace.h"
 
 #ifdef HAVE_UNISTD_H
   #include <unistd.h>
 #endif
 
-#if HAVE_GETOPT
+#if HAVE_GETOPT && HAVE_GETOPT_LONG
   #ifdef HAVE_GETOPT_H
     #include <getopt.h>
   #endif  // HAVE_GETOPT_H
 #else
   #include "gnu_getopt.h"
-#endif  // HAVE_GETOPT
+#endif  // HAVE_GETOPT && HAVE_GETOPT_LONG
 
 #include <set>
 #include <vector>
@@ -28,16 +32,15 @@
 #include <sys/stat.h>
 #include <assert.h>
 
-bool unix_platform = false;
-bool windows_platform = false;
-bool dry_run = false;
-bool verbose_dry_run = false;
-int verbose = 0;
-int debug_expansions = 0;
-
-bool errors_occurred = false;
-
-DebugExpand debug_expand;
+// The values returned by getopt_long() for options that have only a
+// long form.
+enum LongOption {
+  LO_profile = 256,
+  LO_trace,
+  LO_lazy,
+  LO_stats,
+  LO_explain,
+};
 
 class DebugExpandReport {
 public:
@@ -73,6 +76,7 @@ usage() {
     "ppremake [opts] subdir-name [subdir-name..]\n"
     "ppremake\n"
     "ppremake -s 'sed-command' <input >output\n"
+    "ppremake -s 'sed-command' [-s ...] [-i [-j jobs]] file [file..]\n"
     "\n"
     "This is Panda pre-make: a script preprocessor that scans the source\n"
     "directory hierarchy containing the current directory, looking for\n"
@@ -97,7 +101,12 @@ usage() {
     "ppremake -s is a special form of the command that runs as a very limited\n"
     "sed.  It has nothing to do with building makefiles, but is provided mainly\n"
     "so platforms that don't have sed built in can still portably run simple sed\n"
-    "scripts.\n\n"
+    "scripts.  The -s option may be repeated to build up a longer script.  If\n"
+    "filenames are given, the script is applied to each named file in turn\n"
+    "and the results are written to standard output; with -i, each file is\n"
+    "instead rewritten in place (if it changes), and with -j as well, that\n"
+    "many files are processed in parallel.  (Older versions of ppremake\n"
+    "ignored any filenames after -s and always read standard input.)\n\n"
 
     "Options:\n\n"
 
@@ -109,6 +118,31 @@ usage() {
     "  -x count     Print a histogram of the count most-frequently expanded strings\n"
     "               and their results.  Useful to optimize .pp scripts so that\n"
     "               variables are not needlessly repeatedly expanded.\n\n"
+    "  --profile[=name]\n"
+    "               Measure the time spent on each source line, subroutine,\n"
+    "               function, directory, shell command, and so on.  A report\n"
+    "               sorted by time is written to name.txt, and the same\n"
+    "               times by call stack to name.folded, which can be fed to\n"
+    "               flamegraph.pl.  The default name is ppremake-profile.\n\n"
+    "  --trace=file.json\n"
+    "               Record a timeline of the run: each phase, each directory,\n"
+    "               and the shell commands, #include files, dependency scans\n"
+    "               and output files within them.  The file can be loaded\n"
+    "               into chrome://tracing or ui.perfetto.dev.\n\n"
+    "  --lazy       When directories are named on the command line, read only\n"
+    "               the Sources.pp files for those directories and the ones\n"
+    "               they depend on, and read the rest only if a */ scope\n"
+    "               reference asks for them.  This makes regenerating one\n"
+    "               directory in a large tree much quicker.\n\n"
+    "  --stats      At the end of the run, report how many times each of the\n"
+    "               expensive operations was performed: files read, lines\n"
+    "               executed, variable lookups, function calls, shell commands,\n"
+    "               #include scans, stat() calls, output files written, and\n"
+    "               so on.\n\n"
+    "  --explain    Report why each output file was rewritten (where it first\n"
+    "               differs from the file on disk), why each source file's\n"
+    "               #include dependencies were not taken from the dependency\n"
+    "               cache, and why each model's dependencies were refreshed.\n\n"
 
     "  -P           Report the current platform name, and exit.\n\n"
 
@@ -267,12 +301,21 @@ main(int argc, char *argv[]) {
   string progname = argv[0];
   extern char *optarg;
   extern int optind;
-  const char *optstr = "hVIvx:PD:drnNp:c:s:";
+  const char *optstr = "hVIvx:PD:drnNp:c:s:ij:";
+  static const struct option long_options[] = {
+    { "profile", optional_argument, NULL, LO_profile },
+    { "trace", required_argument, NULL, LO_trace },
+    { "lazy", no_argument, NULL, LO_lazy },
+    { "stats", no_argument, NULL, LO_stats },
+    { "explain", no_argument, NULL, LO_explain },
+    { NULL, 0, NULL, 0 }
+  };
 
   bool any_d = false;
   bool dependencies_stale = false;
   bool report_depends = false;
   bool report_reverse_depends = false;
+  bool lazy = false;
 
   string platform;
   char *platform_env = getenv("PPREMAKE_PLATFORM");
@@ -284,9 +327,11 @@ main(int argc, char *argv[]) {
 
   string ppremake_config;
   bool got_ppremake_config = false;
-  string sed_command;
-  bool got_sed_command = false;
-  int flag = getopt(argc, argv, optstr);
+  vector_string sed_commands;
+  bool sed_in_place = false;
+  int sed_jobs = 1;
+  bool got_sed_jobs = false;
+  int flag = getopt_long(argc, argv, optstr, long_options, NULL);
 
   while (flag != EOF) {
     switch (flag) {
@@ -351,24 +396,82 @@ main(int argc, char *argv[]) {
       break;
 
     case 's':
-      sed_command = optarg;
-      got_sed_command = true;
+      sed_commands.push_back(optarg);
+      break;
+
+    case 'i':
+      sed_in_place = true;
+      break;
+
+    case 'j':
+      sed_jobs = atoi(optarg);
+      got_sed_jobs = true;
+      break;
+
+    case LO_profile:
+      PPProfiler::enable(optarg != NULL ? optarg : "ppremake-profile");
+      break;
+
+    case LO_trace:
+      PPTrace::enable(optarg);
+      break;
+
+    case LO_lazy:
+      lazy = true;
+      break;
+
+    case LO_stats:
+      PPStats::enable();
+      break;
+
+    case LO_explain:
+      explain = true;
       break;
 
     default:
       exit(1);
     }
-    flag = getopt(argc, argv, optstr);
+    flag = getopt_long(argc, argv, optstr, long_options, NULL);
   }
 
   argc -= (optind-1);
   argv += (optind-1);
 
-  if (got_sed_command) {
-    SedProcess sp;
-    if (!sp.add_script_line(sed_command)) {
+  if (sed_commands.empty() && (sed_in_place || got_sed_jobs)) {
+    cerr << "Options -i and -j may only be used with -s.\n";
+    exit(1);
+  }
+  if (got_sed_jobs && !sed_in_place) {
+    cerr << "Option -j may only be used with -i.\n";
+    exit(1);
+  }
+  if (got_sed_jobs && sed_jobs < 1) {
+    cerr << "Option -j requires a positive number of jobs.\n";
+    exit(1);
+  }
+
+  if (!sed_commands.empty()) {
+    if (sed_in_place && argc < 2) {
+      cerr << "Option -i requires one or more filenames.\n";
       exit(1);
     }
+    if (argc >= 2) {
+      // Run the script on each of the named files.
+      vector_string filenames(argv + 1, argv + argc);
+      if (!SedProcess::run_files(sed_commands, filenames, sed_in_place,
+                                 sed_jobs, cout)) {
+        exit(1);
+      }
+      exit(0);
+    }
+
+    SedProcess sp;
+    vector_string::const_iterator si;
+    for (si = sed_commands.begin(); si != sed_commands.end(); ++si) {
+      if (!sp.add_script_line(*si)) {
+        exit(1);
+      }
+    }
     sp.run(cin, cout);
     exit(0);
   }
@@ -388,13 +491,9 @@ main(int argc, char *argv[]) {
     cout << progname << "\n";
   }
 
-  PPScope global_scope((PPNamedScopes *)NULL);
-  global_scope.define_variable("PPREMAKE", PACKAGE);
-  global_scope.define_variable("PPREMAKE_VERSION", VERSION);
-  global_scope.define_variable("PLATFORM", platform);
-  global_scope.define_variable("PACKAGE_FILENAME", PACKAGE_FILENAME);
-  global_scope.define_variable("SOURCE_FILENAME", SOURCE_FILENAME);
-  global_scope.define_variable("INSTALL_DIR", INSTALL_DIR);
+  PPContext context;
+  PPScope global_scope(&context, (PPNamedScopes *)NULL);
+  PPMain::define_builtin_variables(&global_scope, platform);
 
   if (got_ppremake_config) {
     // If this came in on the command line, define a variable as such.
@@ -403,16 +502,11 @@ main(int argc, char *argv[]) {
     global_scope.define_variable("PPREMAKE_CONFIG", ppremake_config);
   }
 
-  // Also, it's convenient to have a way to represent the literal tab
-  // character, without actually putting a literal tab character in
-  // the source file.  Similarly with some other special characters.
-  global_scope.define_variable("TAB", "\t");
-  global_scope.define_variable("SPACE", " ");
-  global_scope.define_variable("DOLLAR", "$");
-  global_scope.define_variable("HASH", "#");
-  global_scope.define_variable("DOUBLESLASH", "//");
-
   PPMain ppmain(&global_scope);
+  if (lazy && argc >= 2 && !report_depends && !report_reverse_depends) {
+    // The -d and -r reports need the whole tree.
+    ppmain.set_lazy(vector_string(argv + 1, argv + argc));
+  }
   if (!ppmain.read_source(".")) {
     exit(1);
   }
@@ -453,12 +547,21 @@ main(int argc, char *argv[]) {
     }
   }
 
+  if (!PPProfiler::write_report()) {
+    context.set_errors_occurred();
+  }
+  if (!PPTrace::write()) {
+    context.set_errors_occurred();
+  }
+  PPStats::write_report();
+
   if (debug_expansions > 0) {
     // Now report the worst expansion offenders.  These are the
     // strings that were most often expanded to the same thing.
     cerr << "\nExpansion report:\n";
     vector<DebugExpandReport> report;
 
+    const DebugExpand &debug_expand = context.get_debug_expand();
     DebugExpand::const_iterator dei;
     for (dei = debug_expand.begin(); dei != debug_expand.end(); ++dei) {
       const ExpandResultCount &result_count = (*dei).second;
@@ -479,7 +582,7 @@ main(int argc, char *argv[]) {
     cerr << "\n";
   }
 
-  if (errors_occurred) {
+  if (context.get_errors_occurred()) {
     cerr << "Errors occurred during ppremake.\n";
     return (1);
 
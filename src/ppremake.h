@@ -112,18 +112,14 @@ extern bool dry_run;
 extern bool verbose_dry_run;
 extern int verbose; // 0..9 to set verbose level.  0 == off.
 extern int debug_expansions;
-
-/* This is set true internally if an error occurred while processing
-   any of the scripts. */
-extern bool errors_occurred;
+extern bool explain;
 
 /* This structure tracks the number of expansions that are performed
    on a particular string, and the different values it produces, only
    if debug_expansions (above) is set true by command-line parameter
-   -x. */
+   -x.  Each PPContext keeps its own. */
 typedef map<string, int> ExpandResultCount;
 typedef map<string, ExpandResultCount> DebugExpand;
-extern DebugExpand debug_expand;
 
 #endif
 
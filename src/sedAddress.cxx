@@ -7,6 +7,7 @@
 #include "sedContext.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <assert.h>
 
@@ -97,6 +98,7 @@ parse_address(const string &line, size_t &p) {
     }
 
     _address_type = AT_re;
+    _literal = get_required_literal(re);
   }
 
   // Skip whitespace following the address.
@@ -127,6 +129,12 @@ matches(const SedContext &context) const {
     return context._is_last_line;
 
   case AT_re:
+    // Most lines don't even contain the fixed part of the expression,
+    // and can be rejected without running the regex.
+    if (!_literal.empty() &&
+        context._pattern_space.find(_literal) == string::npos) {
+      return false;
+    }
     return (regexec(&_re, context._pattern_space.c_str(), 0, (regmatch_t *)NULL, 0) == 0);
   }
 
@@ -150,3 +158,113 @@ precedes(const SedContext &context) const {
   return false;
 }
 
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedAddress::get_required_literal
+//       Access: Public, Static
+//  Description: Examines the indicated basic regular expression, and
+//               returns the longest string of ordinary characters
+//               that must appear, as is, in any string it matches; or
+//               the empty string if there is no such string (or we
+//               can't be sure of one).
+//
+//               This is used to quickly reject lines that can't
+//               possibly match, before calling regexec().  It is
+//               always safe for this to return less than it might.
+////////////////////////////////////////////////////////////////////
+string SedAddress::
+get_required_literal(const string &re) {
+  string best;
+  string run;
+  int depth = 0;
+
+  size_t p = 0;
+  while (p < re.length()) {
+    char ch = re[p];
+    bool literal = false;
+    size_t next = p + 1;
+
+    if (ch == '\\') {
+      if (next >= re.length()) {
+        return string();
+      }
+      char esc = re[next];
+      ++next;
+      if (esc == '|') {
+        // An alternation means nothing is certain.
+        return string();
+      } else if (esc == '(') {
+        ++depth;
+      } else if (esc == ')') {
+        --depth;
+      } else if (esc == '{') {
+        // An interval applies to whatever came before; skip it.
+        while (next < re.length() && re[next] != '}') {
+          ++next;
+        }
+        ++next;
+      } else if (strchr(".[]*^$\\/", esc) != (char *)NULL ||
+                 (ispunct(esc) && strchr("{}?+<>`'", esc) == (char *)NULL)) {
+        ch = esc;
+        literal = true;
+      }
+
+    } else if (ch == '[') {
+      // Skip over the bracket expression.  A close bracket right at
+      // the start is part of the set.
+      if (next < re.length() && re[next] == '^') {
+        ++next;
+      }
+      if (next < re.length() && re[next] == ']') {
+        ++next;
+      }
+      while (next < re.length() && re[next] != ']') {
+        if (re[next] == '[' && next + 1 < re.length() &&
+            strchr(":.=", re[next + 1]) != (char *)NULL) {
+          // A character class like [:alpha:]; skip to its end.
+          char delim = re[next + 1];
+          next += 2;
+          while (next + 1 < re.length() &&
+                 !(re[next] == delim && re[next + 1] == ']')) {
+            ++next;
+          }
+          next += 2;
+        } else {
+          ++next;
+        }
+      }
+      ++next;
+
+    } else if (strchr(".*^$", ch) == (char *)NULL) {
+      literal = true;
+    }
+
+    // A character followed by a repetition operator is not reliably
+    // present (or not only once).
+    bool repeated = false;
+    if (next < re.length()) {
+      if (re[next] == '*') {
+        repeated = true;
+      } else if (re[next] == '\\' && next + 1 < re.length() &&
+                 strchr("?{+", re[next + 1]) != (char *)NULL) {
+        repeated = true;
+      }
+    }
+
+    if (literal && depth == 0 && !repeated) {
+      run += ch;
+    } else {
+      if (run.length() > best.length()) {
+        best = run;
+      }
+      run = string();
+    }
+
+    p = next;
+  }
+
+  if (run.length() > best.length()) {
+    best = run;
+  }
+  return best;
+}
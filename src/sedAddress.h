@@ -33,6 +33,8 @@ public:
   bool matches(const SedContext &context) const;
   bool precedes(const SedContext &context) const;
 
+  static string get_required_literal(const string &re);
+
 private:
   enum AddressType {
     AT_invalid,
@@ -44,6 +46,7 @@ private:
 
   int _number;
   regex_t _re;
+  string _literal;
 };
 
 #endif
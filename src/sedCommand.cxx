@@ -160,6 +160,17 @@ run(SedScript &script, SedContext &context) {
   }
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: SedCommand::reset
+//       Access: Public
+//  Description: Forgets any address range in progress, in preparation
+//               for running the command on a new input.
+////////////////////////////////////////////////////////////////////
+void SedCommand::
+reset() {
+  _active = false;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: SedCommand::parse_s_params
 //       Access: Private
@@ -206,6 +217,8 @@ parse_s_params(const string &line, size_t &p) {
     return false;
   }
   _flags |= F_have_re;
+  _literal = SedAddress::get_required_literal(re);
+  _pmatch.resize(_re.re_nsub + 1);
 
   // Get the replacement string.
   begin = p;
@@ -224,6 +237,9 @@ parse_s_params(const string &line, size_t &p) {
   }
 
   _string2 = line.substr(begin, p - begin);
+  if (!parse_replacement(_string2)) {
+    return false;
+  }
 
   // Skip the final delimiter.
   p++;
@@ -241,6 +257,63 @@ parse_s_params(const string &line, size_t &p) {
   return true;
 }
 
+////////////////////////////////////////////////////////////////////
+//     Function: SedCommand::parse_replacement
+//       Access: Private
+//  Description: Breaks up the replacement string of an s command
+//               into literal text and subexpression references, so
+//               that this need not be done again for each match.
+//               Returns true on success, false on error.
+////////////////////////////////////////////////////////////////////
+bool SedCommand::
+parse_replacement(const string &repl) {
+  _replacement.clear();
+  ReplacementPiece piece;
+  piece._ref = -1;
+
+  size_t p = 0;
+  while (p < repl.length()) {
+    if (repl[p] == '\\') {
+      p++;
+      if (p < repl.length()) {
+        if (isdigit(repl[p])) {
+          // Here's a subexpression reference.
+          const char *numstr = repl.c_str() + p;
+          char *numend;
+          int ref = strtol(numstr, &numend, 10);
+          p += (numend - numstr);
+
+          if (ref <= 0 || ref >= (int)_pmatch.size()) {
+            cerr << "Invalid subexpression number: " << ref << "\n";
+            return false;
+          }
+          if (!piece._text.empty()) {
+            _replacement.push_back(piece);
+            piece._text = string();
+          }
+          piece._ref = ref;
+          _replacement.push_back(piece);
+          piece._ref = -1;
+
+        } else {
+          // Here's an escaped character.
+          piece._text += repl[p];
+          p++;
+        }
+      }
+    } else {
+      // Here's a normal character.
+      piece._text += repl[p];
+      p++;
+    }
+  }
+
+  if (!piece._text.empty()) {
+    _replacement.push_back(piece);
+  }
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////
 //     Function: SedCommand::do_command
 //       Access: Private
@@ -278,64 +351,91 @@ do_command(SedScript &script, SedContext &context) {
 ////////////////////////////////////////////////////////////////////
 void SedCommand::
 do_s_command(SedContext &context) {
-  size_t nmatch = _re.re_nsub + 1;
-  regmatch_t *pmatch = new regmatch_t[nmatch];
+  const string &space = context._pattern_space;
+
+  // If the fixed part of the expression isn't anywhere on the line,
+  // there's no need to run the regex at all.
+  if (!_literal.empty() && space.find(_literal) == string::npos) {
+    return;
+  }
+
+  size_t nmatch = _pmatch.size();
+  regmatch_t *pmatch = &_pmatch[0];
+  const char *begin = space.c_str();
+  const char *end = begin + space.length();
+  const char *str = begin;
+  int eflags = 0;
+
+  int error = regexec(&_re, str, nmatch, pmatch, eflags);
+  if (error != 0) {
+    // No match; leave the pattern space alone.
+    return;
+  }
 
-  string result;
-  const char *str = context._pattern_space.c_str();
-  int error = regexec(&_re, str, nmatch, pmatch, 0);  
+  _result.clear();
+  const char *last_match_end = (const char *)NULL;
   while (error == 0) {
-    // Here's a match.  Determine the replacement.
-    string repl;
+    const char *match_start = str + pmatch[0].rm_so;
+    const char *match_end = str + pmatch[0].rm_eo;
+
+    if (match_start == match_end && match_start == last_match_end) {
+      // An empty match right where the last match ended doesn't
+      // count, so that s/b*/-/g turns "abc" into "-a-c-".  Step past
+      // one character and look again.
+      if (match_start >= end) {
+        break;
+      }
+      _result.append(str, match_start + 1 - str);
+      str = match_start + 1;
 
-    size_t p = 0;
-    while (p < _string2.length()) {
-      if (_string2[p] == '\\') {
-        p++;
-        if (p < _string2.length()) {
-          if (isdigit(_string2[p])) {
-            // Here's a subexpression reference.
-            const char *numstr = _string2.c_str() + p;
-            char *numend;
-            int ref = strtol(numstr, &numend, 10);
-            p += (numend - numstr);
-            if (ref <= 0 || ref >= (int)nmatch) {
-              cerr << "Invalid subexpression number: " << ref << "\n";
-            } else {
-              repl += string(str + pmatch[ref].rm_so,
-                             pmatch[ref].rm_eo - pmatch[ref].rm_so);
-            }
-          } else {
-            // Here's an escaped character.
-            repl += _string2[p];
-            p++;
-          }
+    } else {
+      // Here's a match.  Copy the text before it, then the
+      // replacement.
+      _result.append(str, pmatch[0].rm_so);
+
+      Replacement::const_iterator ri;
+      for (ri = _replacement.begin(); ri != _replacement.end(); ++ri) {
+        const ReplacementPiece &piece = (*ri);
+        if (piece._ref < 0) {
+          _result += piece._text;
+        } else if (pmatch[piece._ref].rm_so >= 0) {
+          _result.append(str + pmatch[piece._ref].rm_so,
+                         pmatch[piece._ref].rm_eo - pmatch[piece._ref].rm_so);
         }
-      } else {
-        // Here's a normal character.
-        repl += _string2[p];
-        p++;
       }
-    }
+      last_match_end = match_end;
+      str = match_end;
 
-    // Store the result so far.
-    result += string(str, pmatch[0].rm_so);
-    result += repl;
-    str += pmatch[0].rm_eo;
-
-    if ((_flags & F_g) == 0) {
-      // If we don't have the global flag set, stop after the first iteration.
-      result += str;
-      context._pattern_space = result;
-      delete[] pmatch;
-      return;
+      if ((_flags & F_g) == 0) {
+        // If we don't have the global flag set, stop after the first
+        // iteration.
+        break;
+      }
+
+      if (match_start == match_end) {
+        // An empty match; step past one character, so we don't keep
+        // matching the same empty string forever.  An empty match at
+        // the end of the line is the last one.
+        if (str >= end) {
+          break;
+        }
+        _result += *str;
+        str++;
+      }
     }
 
-    error = regexec(&_re, str, nmatch, pmatch, 0);  
+    // The remainder of the line doesn't begin a line, as far as ^ is
+    // concerned.  We still look for a match when nothing remains,
+    // since the expression may match the empty string there.
+    eflags = REG_NOTBOL;
+    if (!_literal.empty() &&
+        space.find(_literal, str - begin) == string::npos) {
+      break;
+    }
+    error = regexec(&_re, str, nmatch, pmatch, eflags);
   }
 
   // All done.
-  result += str;
-  context._pattern_space = result;
-  delete[] pmatch;
+  _result.append(str, end - str);
+  context._pattern_space.swap(_result);
 }
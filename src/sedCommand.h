@@ -9,6 +9,7 @@
 #include "ppremake.h"
 
 #include <sys/types.h>
+#include <vector>
 
 #ifdef HAVE_REGEX_H
 #include <regex.h>
@@ -34,9 +35,11 @@ public:
   bool parse_command(const string &line, size_t &p);
 
   void run(SedScript &script, SedContext &context);
+  void reset();
 
 private:
   bool parse_s_params(const string &line, size_t &p);
+  bool parse_replacement(const string &repl);
   void do_command(SedScript &script, SedContext &context);
   void do_s_command(SedContext &context);
 
@@ -50,6 +53,23 @@ private:
   string _string1;
   string _string2;
 
+  // The replacement string of an s command, broken up in advance
+  // into literal text and references to subexpressions.
+  class ReplacementPiece {
+  public:
+    string _text;
+    int _ref;
+  };
+  typedef vector<ReplacementPiece> Replacement;
+  Replacement _replacement;
+
+  // A string that must appear in the pattern space for _re to match.
+  string _literal;
+
+  // Reused from one line to the next, to avoid reallocating.
+  vector<regmatch_t> _pmatch;
+  string _result;
+
   enum Flags {
     F_have_re  = 0x001,
     F_g        = 0x002,
@@ -12,7 +12,7 @@
 //  Description: 
 ////////////////////////////////////////////////////////////////////
 SedContext::
-SedContext(ostream &out) : _out(out) {
+SedContext() {
   _line_number = 0;
   _is_last_line = false;
   _deleted = false;
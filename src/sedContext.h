@@ -17,7 +17,7 @@
 ////////////////////////////////////////////////////////////////////
 class SedContext {
 public:
-  SedContext(ostream &out);
+  SedContext();
 
   int _line_number;
   bool _is_last_line;
@@ -25,7 +25,9 @@ public:
   string _hold_space;
   bool _deleted;
 
-  ostream &_out;
+  // The output is accumulated here, and written out in large blocks
+  // by the SedProcess.
+  string _output;
 };
 
 #endif
@@ -6,6 +6,9 @@
 #include "sedProcess.h"
 #include "sedContext.h"
 
+#include <atomic>
+#include <thread>
+
 ////////////////////////////////////////////////////////////////////
 //     Function: SedProcess::Constructor
 //       Access: Public
@@ -50,21 +53,271 @@ add_script_line(const string &line) {
 //  Description: Reads the input stream and executes the script once
 //               for each line on the input stream.  Output is written
 //               to the indicated output stream.
+//
+//               The input is read, and the output written, in large
+//               blocks, rather than a line at a time.
 ////////////////////////////////////////////////////////////////////
 void SedProcess::
 run(istream &in, ostream &out) {
-  SedContext context(out);
+  _script.reset();
+  SedContext context;
+
+  string input;
+  size_t p = 0;
+  bool more = true;
+
+  for (;;) {
+    // Find the end of the next line, reading more if necessary.
+    size_t nl = input.find('\n', p);
+    while (nl == string::npos && more) {
+      more = read_block(in, input, p);
+      nl = input.find('\n', p);
+    }
+    if (nl == string::npos) {
+      if (p >= input.length()) {
+        // No more lines.
+        break;
+      }
+      // The last line has no newline.
+      nl = input.length();
+    }
+
+    context._pattern_space.assign(input, p, nl - p);
+    context._line_number++;
+    p = (nl < input.length()) ? nl + 1 : nl;
+
+    // We have to know whether this is the last line before we run
+    // the script on it.
+    if (p >= input.length() && more) {
+      more = read_block(in, input, p);
+    }
+    context._is_last_line = (p >= input.length() && !more);
+
+    bool keep_going = _script.run(context);
+    if (nl == input.length()) {
+      strip_newline(context);
+    }
+
+    if (context._output.length() >= block_size) {
+      out.write(context._output.data(), context._output.length());
+      context._output.clear();
+    }
+    if (!keep_going) {
+      break;
+    }
+  }
+
+  out.write(context._output.data(), context._output.length());
+  context._output.clear();
+  out.flush();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedProcess::run
+//       Access: Public
+//  Description: Executes the script once for each line of the input
+//               string, and fills output with the result.
+////////////////////////////////////////////////////////////////////
+void SedProcess::
+run(const string &input, string &output) {
+  _script.reset();
+  SedContext context;
+  context._output.reserve(input.length());
+
+  size_t p = 0;
+  while (p < input.length()) {
+    size_t nl = input.find('\n', p);
+    if (nl == string::npos) {
+      // The last line has no newline.
+      nl = input.length();
+    }
 
-  string line;
-  getline(in, line);
-  while (!in.fail() && !in.eof()) {
-    context._pattern_space = line;
+    context._pattern_space.assign(input, p, nl - p);
     context._line_number++;
-    getline(in, line);
+    p = (nl < input.length()) ? nl + 1 : nl;
+    context._is_last_line = (p >= input.length());
 
-    if (in.eof()) {
-      context._is_last_line = true;
+    bool keep_going = _script.run(context);
+    if (nl == input.length()) {
+      strip_newline(context);
+    }
+    if (!keep_going) {
+      break;
     }
-    _script.run(context);
+  }
+
+  output.swap(context._output);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedProcess::run_file
+//       Access: Public
+//  Description: Executes the script on the contents of the indicated
+//               file.  If in_place is true, the file is replaced with
+//               the result (unless it is unchanged, in which case the
+//               file is not touched); otherwise, the result is
+//               written to out.  Returns true on success, false on
+//               failure.
+////////////////////////////////////////////////////////////////////
+bool SedProcess::
+run_file(const Filename &filename, bool in_place, ostream &out) {
+  Filename text_filename = filename;
+  text_filename.set_text();
+
+  ifstream in;
+  if (!text_filename.open_read(in)) {
+    cerr << "Cannot read " << filename << "\n";
+    return false;
+  }
+
+  string input;
+  char buffer[block_size];
+  in.read(buffer, block_size);
+  while (in.gcount() > 0) {
+    input.append(buffer, (size_t)in.gcount());
+    in.read(buffer, block_size);
+  }
+  if (in.bad()) {
+    cerr << "Error reading " << filename << "\n";
+    return false;
+  }
+  in.close();
+
+  string output;
+  run(input, output);
+
+  if (!in_place) {
+    out.write(output.data(), output.length());
+    return true;
+  }
+
+  if (output == input) {
+    // Leave the file, and its timestamp, alone.
+    return true;
+  }
+
+  return text_filename.atomic_write_contents(output);
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedProcess::run_files
+//       Access: Public, Static
+//  Description: Runs the indicated script on each of the indicated
+//               files in turn.  The script is compiled only once (or
+//               once per job).
+//
+//               If in_place is true, each file is replaced with its
+//               result, and up to max_jobs files are processed at
+//               once.  Otherwise, the results are written to out, one
+//               after the other, and the files are processed in
+//               order.
+//
+//               Returns true if all files were processed
+//               successfully, false if any failed.
+////////////////////////////////////////////////////////////////////
+bool SedProcess::
+run_files(const vector_string &script_lines, const vector_string &filenames,
+          bool in_place, int max_jobs, ostream &out) {
+  if (!in_place || max_jobs <= 1 || filenames.size() <= 1) {
+    SedProcess sp;
+    vector_string::const_iterator li;
+    for (li = script_lines.begin(); li != script_lines.end(); ++li) {
+      if (!sp.add_script_line(*li)) {
+        return false;
+      }
+    }
+
+    bool okflag = true;
+    vector_string::const_iterator fi;
+    for (fi = filenames.begin(); fi != filenames.end(); ++fi) {
+      if (!sp.run_file(Filename::from_os_specific(*fi), in_place, out)) {
+        okflag = false;
+      }
+    }
+    out.flush();
+    return okflag;
+  }
+
+  // Each job compiles its own copy of the script, since a compiled
+  // script carries state from one line to the next, and since regexec()
+  // may serialize calls that share the same compiled expression.
+  if (max_jobs > (int)filenames.size()) {
+    max_jobs = (int)filenames.size();
+  }
+
+  vector<SedProcess *> processes;
+  for (int i = 0; i < max_jobs; ++i) {
+    SedProcess *sp = new SedProcess;
+    processes.push_back(sp);
+    vector_string::const_iterator li;
+    for (li = script_lines.begin(); li != script_lines.end(); ++li) {
+      if (!sp->add_script_line(*li)) {
+        for (size_t j = 0; j < processes.size(); ++j) {
+          delete processes[j];
+        }
+        return false;
+      }
+    }
+  }
+
+  atomic<size_t> next_file(0);
+  atomic<bool> okflag(true);
+  vector<thread> threads;
+  for (int i = 0; i < max_jobs; ++i) {
+    SedProcess *sp = processes[i];
+    threads.push_back(thread([sp, &filenames, &next_file, &okflag, &out]() {
+      size_t fi = next_file++;
+      while (fi < filenames.size()) {
+        if (!sp->run_file(Filename::from_os_specific(filenames[fi]), true, out)) {
+          okflag = false;
+        }
+        fi = next_file++;
+      }
+    }));
+  }
+
+  for (int i = 0; i < max_jobs; ++i) {
+    threads[i].join();
+    delete processes[i];
+  }
+
+  return okflag;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedProcess::read_block
+//       Access: Private, Static
+//  Description: Discards the part of the input buffer before p, which
+//               has already been processed, and appends the next
+//               block of the input stream.  Returns true if there may
+//               be more to read, or false if we have reached the end
+//               of the input.
+////////////////////////////////////////////////////////////////////
+bool SedProcess::
+read_block(istream &in, string &input, size_t &p) {
+  input.erase(0, p);
+  p = 0;
+
+  size_t orig_length = input.length();
+  input.resize(orig_length + block_size);
+  in.read(&input[orig_length], block_size);
+  input.resize(orig_length + (size_t)in.gcount());
+
+  return !in.fail() && !in.eof();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedProcess::strip_newline
+//       Access: Private, Static
+//  Description: Called after the script has run on a final line that
+//               had no newline in the input; removes the newline that
+//               was written after it, so that the output ends the
+//               same way the input did.
+////////////////////////////////////////////////////////////////////
+void SedProcess::
+strip_newline(SedContext &context) {
+  if (!context._deleted && !context._output.empty() &&
+      context._output[context._output.length() - 1] == '\n') {
+    context._output.erase(context._output.length() - 1);
   }
 }
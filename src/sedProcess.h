@@ -8,11 +8,17 @@
 
 #include "ppremake.h"
 #include "sedScript.h"
+#include "filename.h"
+#include "vector_string.h"
+
+class SedContext;
 
 ///////////////////////////////////////////////////////////////////
 //       Class : SedProcess
 // Description : This supervises the whole sed process, from beginning
-//               to end.
+//               to end.  The same SedProcess may be run on any number
+//               of inputs in turn, so that its script need be
+//               compiled only once.
 ////////////////////////////////////////////////////////////////////
 class SedProcess {
 public:
@@ -22,8 +28,20 @@ public:
   bool add_script_line(const string &line);
 
   void run(istream &in, ostream &out);
+  void run(const string &input, string &output);
+  bool run_file(const Filename &filename, bool in_place, ostream &out);
+
+  static bool run_files(const vector_string &script_lines,
+                        const vector_string &filenames,
+                        bool in_place, int max_jobs, ostream &out);
 
 private:
+  static bool read_block(istream &in, string &input, size_t &p);
+  static void strip_newline(SedContext &context);
+
+  // The size of the blocks in which we read and write.
+  enum { block_size = 65536 };
+
   SedScript _script;
 };
 
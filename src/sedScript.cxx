@@ -90,8 +90,24 @@ run(SedContext &context) {
   }
 
   if (!context._deleted) {
-    context._out << context._pattern_space << "\n";
+    context._output += context._pattern_space;
+    context._output += '\n';
   }
 
   return !_quit;
 }
+
+////////////////////////////////////////////////////////////////////
+//     Function: SedScript::reset
+//       Access: Public
+//  Description: Resets the script to its initial state, so that it
+//               may be run again on a new input.
+////////////////////////////////////////////////////////////////////
+void SedScript::
+reset() {
+  _quit = false;
+  Commands::iterator ci;
+  for (ci = _commands.begin(); ci != _commands.end(); ++ci) {
+    (*ci)->reset();
+  }
+}
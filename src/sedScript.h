@@ -27,6 +27,7 @@ public:
   bool add_line(const string &line);
 
   bool run(SedContext &context);
+  void reset();
 
 public:
   bool _quit;
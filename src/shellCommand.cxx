@@ -0,0 +1,568 @@
+// Filename: shellCommand.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "shellCommand.h"
+#include "filename.h"
+
+#include <thread>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#ifndef WIN32_VC
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_SPAWN_H
+#include <spawn.h>
+#endif
+
+#if defined(HAVE_POSIX_SPAWN) && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+// We can use posix_spawn() to create subprocesses, since it can also
+// set the new process's working directory for us.
+#define USE_POSIX_SPAWN
+extern char **environ;
+#endif
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::Constructor
+//       Access: Public
+//  Description: Prepares to run the indicated command line with
+//               /bin/sh (or directly, on Windows).  The command will
+//               be run within the named directory, unless it is
+//               empty, in which case the current directory is used.
+////////////////////////////////////////////////////////////////////
+ShellCommand::
+ShellCommand(const string &command, const string &dirname) :
+  _command(command),
+  _dirname(dirname)
+{
+  _exit_status = -1;
+#ifdef WIN32_VC
+  _process = NULL;
+  _pipe = NULL;
+#else
+  _pid = -1;
+  _pipe = -1;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::Destructor
+//       Access: Public
+//  Description: If the command is still running, waits for it to
+//               finish.
+////////////////////////////////////////////////////////////////////
+ShellCommand::
+~ShellCommand() {
+  finish();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::get_command
+//       Access: Public
+//  Description: Returns the command line this object runs.
+////////////////////////////////////////////////////////////////////
+const string &ShellCommand::
+get_command() const {
+  return _command;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::get_output
+//       Access: Public
+//  Description: Returns the complete standard output of the command,
+//               once it has been run.
+////////////////////////////////////////////////////////////////////
+const string &ShellCommand::
+get_output() const {
+  return _output;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::get_exit_status
+//       Access: Public
+//  Description: Returns the exit status of the command, once it has
+//               been run, or -1 if it did not exit normally (or has
+//               not been run).
+////////////////////////////////////////////////////////////////////
+int ShellCommand::
+get_exit_status() const {
+  return _exit_status;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::quote
+//       Access: Public, Static
+//  Description: Returns the string quoted so that the shell will
+//               read it as a single word with the same contents, for
+//               building a command line from arbitrary filenames.
+////////////////////////////////////////////////////////////////////
+string ShellCommand::
+quote(const string &str) {
+#ifdef WIN32_VC
+  // There's no shell on Windows; the program parses its own command
+  // line, by the C runtime's rules.
+  string result = "\"";
+  for (size_t p = 0; p < str.length(); ++p) {
+    if (str[p] == '"') {
+      result += "\\\"";
+    } else {
+      result += str[p];
+    }
+  }
+  result += "\"";
+  return result;
+
+#else  // WIN32_VC
+  string result = "'";
+  for (size_t p = 0; p < str.length(); ++p) {
+    if (str[p] == '\'') {
+      result += "'\\''";
+    } else {
+      result += str[p];
+    }
+  }
+  result += "'";
+  return result;
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::run
+//       Access: Public
+//  Description: Runs the command and waits for it to finish.
+//               Returns true if the command was run, or false if the
+//               subprocess could not be created.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+run() {
+  if (!start()) {
+    return false;
+  }
+  return finish();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::run_all
+//       Access: Public, Static
+//  Description: Runs all of the indicated commands, keeping up to
+//               max_jobs of them running at once, and returns when
+//               they have all finished.  Each command's output is
+//               collected separately, so the results do not depend
+//               on the order in which the commands complete.
+//
+//               Returns true if all the commands were run, or false
+//               if any of them could not be.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+run_all(const vector<ShellCommand *> &commands, int max_jobs) {
+  bool okflag = true;
+
+#ifdef WIN32_VC
+  // On Windows, we just run them one at a time.
+  vector<ShellCommand *>::const_iterator ci;
+  for (ci = commands.begin(); ci != commands.end(); ++ci) {
+    if (!(*ci)->run()) {
+      okflag = false;
+    }
+  }
+
+#else  // WIN32_VC
+  if (max_jobs < 1) {
+    max_jobs = 1;
+  }
+
+  vector<ShellCommand *> running;
+  vector<struct pollfd> fds;
+  size_t next = 0;
+
+  while (next < commands.size() || !running.empty()) {
+    // Start as many new commands as we are allowed.
+    while (next < commands.size() && (int)running.size() < max_jobs) {
+      ShellCommand *command = commands[next];
+      ++next;
+      if (command->start()) {
+        running.push_back(command);
+      } else {
+        okflag = false;
+      }
+    }
+
+    if (running.empty()) {
+      continue;
+    }
+
+    // Now wait for any of them to produce output.
+    fds.resize(running.size());
+    for (size_t i = 0; i < running.size(); ++i) {
+      fds[i].fd = running[i]->_pipe;
+      fds[i].events = POLLIN;
+      fds[i].revents = 0;
+    }
+
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      okflag = false;
+      break;
+    }
+
+    size_t ri = 0;
+    for (size_t i = 0; i < fds.size(); ++i) {
+      ShellCommand *command = running[i];
+      if (fds[i].revents != 0 && !command->read_output()) {
+        // That one's done.
+        if (!command->finish()) {
+          okflag = false;
+        }
+      } else {
+        running[ri] = command;
+        ++ri;
+      }
+    }
+    running.resize(ri);
+  }
+
+  // If we bailed out early, clean up whatever is still running.
+  vector<ShellCommand *>::const_iterator ci;
+  for (ci = running.begin(); ci != running.end(); ++ci) {
+    (*ci)->finish();
+  }
+#endif  // WIN32_VC
+
+  return okflag;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::get_default_jobs
+//       Access: Public, Static
+//  Description: Returns a reasonable default for the number of
+//               subprocesses to run in parallel: the number of
+//               processors on this machine.
+////////////////////////////////////////////////////////////////////
+int ShellCommand::
+get_default_jobs() {
+  int jobs = (int)thread::hardware_concurrency();
+  return (jobs > 0) ? jobs : 1;
+}
+
+#ifndef WIN32_VC
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::spawn_shell
+//       Access: Public, Static
+//  Description: Starts /bin/sh in a subprocess with the indicated
+//               arguments, within the indicated directory (if it is
+//               not empty).  If the directory can't be entered, a
+//               warning is printed and the subprocess runs in the
+//               current directory instead.  If stdin_fd or stdout_fd
+//               is not -1, the subprocess's standard input or output
+//               is connected to it.  Returns the new process id, or
+//               -1 on failure.
+//
+//               We avoid a plain fork() where possible, since the
+//               cost of duplicating our address space grows with the
+//               size of the source tree we have read, only to throw
+//               it away again at the exec.
+////////////////////////////////////////////////////////////////////
+int ShellCommand::
+spawn_shell(char *const argv[], const string &dirname,
+            int stdin_fd, int stdout_fd) {
+#ifdef USE_POSIX_SPAWN
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (!dirname.empty() && can_chdir(dirname)) {
+    posix_spawn_file_actions_addchdir_np(&actions, dirname.c_str());
+  }
+  if (stdin_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+    posix_spawn_file_actions_addclose(&actions, stdin_fd);
+  }
+  if (stdout_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, stdout_fd);
+  }
+
+  pid_t pid;
+  int result = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (result != 0) {
+    errno = result;
+    perror("posix_spawn");
+    return -1;
+  }
+  return (int)pid;
+
+#else  // USE_POSIX_SPAWN
+#ifdef HAVE_VFORK
+  int pid = vfork();
+#else
+  int pid = fork();
+#endif
+  if (pid < 0) {
+    // fork() failed.
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    // Child.
+
+    if (!dirname.empty()) {
+      // We don't have to restore the directory after we're done,
+      // because we're doing the chdir() call only within the child
+      // process.
+      if (chdir(dirname.c_str()) < 0) {
+        perror("chdir");
+      }
+    }
+
+    if (stdin_fd >= 0) {
+      dup2(stdin_fd, STDIN_FILENO);
+      close(stdin_fd);
+    }
+    if (stdout_fd >= 0) {
+      dup2(stdout_fd, STDOUT_FILENO);
+      close(stdout_fd);
+    }
+    execv("/bin/sh", argv);
+    _exit(127);
+  }
+
+  return pid;
+#endif  // USE_POSIX_SPAWN
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::can_chdir
+//       Access: Public, Static
+//  Description: Returns true if the indicated directory exists and
+//               may be changed to.  If not, reports why, just as a
+//               failed chdir() in the subprocess would, and returns
+//               false.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+can_chdir(const string &dirname) {
+  struct stat st;
+  if (stat(dirname.c_str(), &st) < 0) {
+    perror("chdir");
+    return false;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    errno = ENOTDIR;
+    perror("chdir");
+    return false;
+  }
+  return true;
+}
+#endif  // WIN32_VC
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::start
+//       Access: Private
+//  Description: Creates the subprocess and the pipe from which we
+//               will read its output.  Returns true on success, or
+//               false if the subprocess could not be created.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+start() {
+  _output = string();
+
+#ifdef WIN32_VC
+  SECURITY_ATTRIBUTES sa;
+  sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+  sa.bInheritHandle = TRUE;
+  sa.lpSecurityDescriptor = NULL;
+  HANDLE pipe_rd = NULL;
+  HANDLE pipe_wr = NULL;
+  if (!CreatePipe(&pipe_rd, &pipe_wr, &sa, 0)) {
+    cerr << "$[shell]: couldn't create win pipe " << GetLastError() << "\n";
+    return false;
+  }
+  if (!SetHandleInformation(pipe_rd, HANDLE_FLAG_INHERIT, 0)) {
+    cerr << "$[shell]: couldn't set handle information " << GetLastError() << "\n";
+    CloseHandle(pipe_rd);
+    CloseHandle(pipe_wr);
+    return false;
+  }
+
+  PROCESS_INFORMATION proc_info;
+  STARTUPINFOA start_info;
+
+  ZeroMemory(&proc_info, sizeof(PROCESS_INFORMATION));
+  ZeroMemory(&start_info, sizeof(STARTUPINFOA));
+  start_info.cb = sizeof(STARTUPINFOA);
+  start_info.hStdOutput = pipe_wr;
+  start_info.dwFlags |= STARTF_USESTDHANDLES;
+
+  string os_dirname = Filename(_dirname).to_os_specific();
+
+  BOOL success = CreateProcessA(
+    NULL,
+    (char *)_command.c_str(),
+    NULL,
+    NULL,
+    TRUE,
+    CREATE_NO_WINDOW,
+    NULL,
+    _dirname.empty() ? NULL : (char *)os_dirname.c_str(),
+    &start_info,
+    &proc_info
+  );
+
+  CloseHandle(pipe_wr);
+
+  if (!success) {
+    cerr << "$[shell]: couldn't create process " << GetLastError() << "\n";
+    CloseHandle(pipe_rd);
+    return false;
+  }
+
+  CloseHandle(proc_info.hThread);
+  _process = proc_info.hProcess;
+  _pipe = pipe_rd;
+
+#else // WIN32_VC
+
+  // Posix implementation.
+  int pd[2];
+  if (pipe(pd) < 0) {
+    // pipe() failed.
+    perror("pipe");
+    return false;
+  }
+
+  // Don't let the read end of this pipe leak into any other
+  // subprocesses we might start while this one is still running.
+  fcntl(pd[0], F_SETFD, FD_CLOEXEC);
+
+  char *argv[4];
+  argv[0] = (char *)"sh";
+  argv[1] = (char *)"-c";
+  argv[2] = (char *)_command.c_str();
+  argv[3] = (char *)NULL;
+
+  int pid = spawn_shell(argv, _dirname, -1, pd[1]);
+  if (pid < 0) {
+    close(pd[0]);
+    close(pd[1]);
+    return false;
+  }
+
+  // Parent.
+  close(pd[1]);
+  _pid = pid;
+  _pipe = pd[0];
+
+#endif // WIN32_VC
+
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::read_output
+//       Access: Private
+//  Description: Reads the next chunk of output from the subprocess,
+//               blocking until some is available.  Returns true if
+//               there may be more output to come, or false once the
+//               subprocess has closed its end of the pipe.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+read_output() {
+  // A pipe gives us no more than this much at a time anyway.  The
+  // output string grows geometrically as it is appended to.
+  static const size_t buffer_size = 65536;
+  char buffer[buffer_size];
+
+#ifdef WIN32_VC
+  DWORD dw_read = 0;
+  if (!ReadFile(_pipe, buffer, (DWORD)buffer_size, &dw_read, NULL)) {
+    dw_read = 0;
+  }
+  _output.append(buffer, dw_read);
+  return (dw_read != 0);
+
+#else  // WIN32_VC
+  int read_bytes = (int)read(_pipe, buffer, buffer_size);
+  while (read_bytes < 0 && errno == EINTR) {
+    read_bytes = (int)read(_pipe, buffer, buffer_size);
+  }
+  if (read_bytes < 0) {
+    perror("read");
+    read_bytes = 0;
+  }
+  _output.append(buffer, read_bytes);
+  return (read_bytes != 0);
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommand::finish
+//       Access: Private
+//  Description: Reads the rest of the output from the subprocess and
+//               waits for it to exit.  Returns true on success, or
+//               false if something went wrong waiting for it.  It is
+//               harmless to call this if the subprocess has not been
+//               started.
+////////////////////////////////////////////////////////////////////
+bool ShellCommand::
+finish() {
+  bool okflag = true;
+
+#ifdef WIN32_VC
+  if (_pipe != NULL) {
+    while (read_output()) {
+    }
+    CloseHandle(_pipe);
+    _pipe = NULL;
+  }
+  if (_process != NULL) {
+    WaitForSingleObject(_process, INFINITE);
+    DWORD exit_code;
+    if (GetExitCodeProcess(_process, &exit_code)) {
+      _exit_status = (int)exit_code;
+    }
+    CloseHandle(_process);
+    _process = NULL;
+  }
+
+#else  // WIN32_VC
+  if (_pipe >= 0) {
+    while (read_output()) {
+    }
+    close(_pipe);
+    _pipe = -1;
+  }
+  if (_pid > 0) {
+    int status;
+    while (waitpid(_pid, &status, 0) < 0) {
+      if (errno != EINTR) {
+        perror("waitpid");
+        okflag = false;
+        break;
+      }
+    }
+    if (okflag && WIFEXITED(status)) {
+      _exit_status = WEXITSTATUS(status);
+    }
+    _pid = -1;
+  }
+#endif  // WIN32_VC
+
+  return okflag;
+}
@@ -0,0 +1,69 @@
+// Filename: shellCommand.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef SHELLCOMMAND_H
+#define SHELLCOMMAND_H
+
+#include "ppremake.h"
+
+#include <vector>
+
+#ifdef WIN32_VC
+#include <windows.h>
+#endif
+
+///////////////////////////////////////////////////////////////////
+//       Class : ShellCommand
+// Description : A single command line to be executed by the shell
+//               in a subprocess, within a particular directory,
+//               collecting its standard output.
+//
+//               A ShellCommand may be run synchronously with run(),
+//               or a whole list of them may be run at once with
+//               run_all(), which keeps up to a given number of
+//               subprocesses going in parallel.
+////////////////////////////////////////////////////////////////////
+class ShellCommand {
+public:
+  ShellCommand(const string &command, const string &dirname);
+  ~ShellCommand();
+
+  const string &get_command() const;
+  const string &get_output() const;
+  int get_exit_status() const;
+
+  bool run();
+  static bool run_all(const vector<ShellCommand *> &commands, int max_jobs);
+  static int get_default_jobs();
+  static string quote(const string &str);
+
+#ifndef WIN32_VC
+  static int spawn_shell(char *const argv[], const string &dirname,
+                         int stdin_fd, int stdout_fd);
+  static bool can_chdir(const string &dirname);
+#endif
+
+private:
+  bool start();
+  bool read_output();
+  bool finish();
+
+  string _command;
+  string _dirname;
+  string _output;
+  int _exit_status;
+
+#ifdef WIN32_VC
+  HANDLE _process;
+  HANDLE _pipe;
+#else
+  int _pid;
+  int _pipe;
+#endif
+
+  friend class ShellCommandQueue;
+};
+
+#endif
@@ -0,0 +1,128 @@
+// Filename: shellCommandQueue.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "shellCommandQueue.h"
+#include "shellCommand.h"
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+ShellCommandQueue::
+ShellCommandQueue() {
+  _max_jobs = ShellCommand::get_default_jobs();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::Destructor
+//       Access: Public
+//  Description: Waits for any commands still running to finish.
+//               Commands that were never started are abandoned.
+////////////////////////////////////////////////////////////////////
+ShellCommandQueue::
+~ShellCommandQueue() {
+  Commands::iterator ci;
+  for (ci = _commands.begin(); ci != _commands.end(); ++ci) {
+    delete (*ci);
+  }
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::set_max_jobs
+//       Access: Public
+//  Description: Changes the number of commands that may be running at
+//               once.  This affects only commands started from now on.
+////////////////////////////////////////////////////////////////////
+void ShellCommandQueue::
+set_max_jobs(int max_jobs) {
+  _max_jobs = (max_jobs < 1) ? 1 : max_jobs;
+  start_pending();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::add
+//       Access: Public
+//  Description: Adds a new command to the queue, starting it
+//               immediately if there is room, and returns an id by
+//               which its output may later be retrieved with wait().
+////////////////////////////////////////////////////////////////////
+int ShellCommandQueue::
+add(const string &command, const string &dirname) {
+  int id = (int)_commands.size();
+  _commands.push_back(new ShellCommand(command, dirname));
+  _done.push_back(false);
+  _pending.push_back(id);
+  start_pending();
+  return id;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::wait
+//       Access: Public
+//  Description: Waits for the indicated command to finish, if it has
+//               not already, and fills output with its standard
+//               output.  Returns true on success, or false if the id
+//               is invalid.
+////////////////////////////////////////////////////////////////////
+bool ShellCommandQueue::
+wait(int id, string &output) {
+  if (id < 0 || id >= (int)_commands.size()) {
+    return false;
+  }
+
+  // Commands are started in order, so we can only be waiting for
+  // something that has already started, or that will start once
+  // enough of the commands before it have finished.
+  while (!_done[id]) {
+    finish_oldest();
+  }
+
+  output = _commands[id]->get_output();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::finish_oldest
+//       Access: Private
+//  Description: Waits for the command that has been running longest
+//               to finish, and starts the next one waiting in line.
+////////////////////////////////////////////////////////////////////
+void ShellCommandQueue::
+finish_oldest() {
+  if (_running.empty()) {
+    start_pending();
+    if (_running.empty()) {
+      return;
+    }
+  }
+
+  int id = _running.front();
+  _running.pop_front();
+  _commands[id]->finish();
+  _done[id] = true;
+
+  start_pending();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCommandQueue::start_pending
+//       Access: Private
+//  Description: Starts as many of the waiting commands as there is
+//               room for.
+////////////////////////////////////////////////////////////////////
+void ShellCommandQueue::
+start_pending() {
+  while (!_pending.empty() && (int)_running.size() < _max_jobs) {
+    int id = _pending.front();
+    _pending.pop_front();
+    if (_commands[id]->start()) {
+      _running.push_back(id);
+    } else {
+      // It couldn't be started; its output is simply empty.
+      _done[id] = true;
+    }
+  }
+}
@@ -0,0 +1,53 @@
+// Filename: shellCommandQueue.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef SHELLCOMMANDQUEUE_H
+#define SHELLCOMMANDQUEUE_H
+
+#include "ppremake.h"
+
+#include <deque>
+#include <vector>
+
+class ShellCommand;
+
+///////////////////////////////////////////////////////////////////
+//       Class : ShellCommandQueue
+// Description : A list of ShellCommands that are started as soon as
+//               they are added, up to a given number at a time, and
+//               whose output is collected only when it is asked for.
+//               Commands beyond the limit wait in line until an
+//               earlier one has finished.
+//
+//               This is used to implement $[shell-async], which lets
+//               slow commands run in the background while ppremake
+//               carries on interpreting the source files.
+////////////////////////////////////////////////////////////////////
+class ShellCommandQueue {
+public:
+  ShellCommandQueue();
+  ~ShellCommandQueue();
+
+  void set_max_jobs(int max_jobs);
+
+  int add(const string &command, const string &dirname);
+  bool wait(int id, string &output);
+
+private:
+  void finish_oldest();
+  void start_pending();
+
+  typedef vector<ShellCommand *> Commands;
+  Commands _commands;
+  vector<bool> _done;
+
+  typedef deque<int> Ids;
+  Ids _running;
+  Ids _pending;
+
+  int _max_jobs;
+};
+
+#endif
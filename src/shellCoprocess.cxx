@@ -0,0 +1,247 @@
+// Filename: shellCoprocess.cxx
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#include "shellCoprocess.h"
+#include "shellCommand.h"
+#include "executionEnvironment.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#ifndef WIN32_VC
+#include <fcntl.h>
+#endif
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::run
+//       Access: Public
+//  Description: Runs the indicated command line in the coprocess,
+//               within the indicated directory, and fills output with
+//               its standard output and exit_status with its exit
+//               status (or -1 if the coprocess died while running
+//               it).  Returns true if the command was run, or false
+//               if the coprocess is not available, in which case the
+//               caller should run the command some other way.
+////////////////////////////////////////////////////////////////////
+bool ShellCoprocess::
+run(const string &command, const string &dirname, string &output,
+    int &exit_status) {
+#ifdef WIN32_VC
+  return false;
+
+#else  // WIN32_VC
+  if (_pid < 0 && !start()) {
+    return false;
+  }
+
+  // The coprocess doesn't follow us if we change directories, so
+  // always give it a full path.
+  string cwd = ExecutionEnvironment::get_cwd().to_os_specific();
+  string fulldir = dirname;
+  if (fulldir.empty()) {
+    fulldir = cwd;
+  } else if (fulldir[0] != '/') {
+    fulldir = cwd + "/" + fulldir;
+  }
+  if (!ShellCommand::can_chdir(fulldir)) {
+    // As with a ShellCommand, run it here instead.
+    fulldir = cwd;
+  }
+
+  // The command is passed through eval, so that even if it has a
+  // syntax error, the coprocess can still parse the rest of our input.
+  // Its standard input is redirected, so it can't consume our input
+  // either.  Its exit status is written on a line of its own just
+  // before the sentinel.
+  ++_sequence;
+  char sentinel[64];
+  sprintf(sentinel, "__ppremake_%d_%d__", (int)getpid(), _sequence);
+
+  string script =
+    "(cd " + ShellCommand::quote(fulldir) + " && eval " +
+    ShellCommand::quote(command) + ") </dev/null\n"
+    "printf '\\n%d\\n' $?; echo " + string(sentinel) + "\n";
+
+  if (!write_all(script)) {
+    cerr << "Lost connection to shell coprocess.\n";
+    stop();
+    return false;
+  }
+
+  // Now read until we see the sentinel at the end of a line.
+  string terminator = "\n" + string(sentinel) + "\n";
+  _buffer = string();
+  static const size_t chunk_size = 65536;
+  char chunk[chunk_size];
+  for (;;) {
+    int read_bytes = (int)read(_from_shell, chunk, chunk_size);
+    while (read_bytes < 0 && errno == EINTR) {
+      read_bytes = (int)read(_from_shell, chunk, chunk_size);
+    }
+    if (read_bytes <= 0) {
+      // The shell went away in the middle of the command.  Return
+      // whatever we got, and start a new one next time.
+      cerr << "Shell coprocess exited while running: " << command << "\n";
+      stop();
+      output = _buffer;
+      exit_status = -1;
+      return true;
+    }
+    _buffer.append(chunk, read_bytes);
+
+    if (_buffer.size() >= terminator.size() &&
+        _buffer.compare(_buffer.size() - terminator.size(),
+                        terminator.size(), terminator) == 0) {
+      output = _buffer.substr(0, _buffer.size() - terminator.size());
+      size_t p = output.rfind('\n');
+      exit_status = atoi(output.c_str() + p + 1);
+      output = output.substr(0, p);
+      return true;
+    }
+  }
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::Constructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+ShellCoprocess::
+ShellCoprocess() {
+  _pid = -1;
+  _to_shell = -1;
+  _from_shell = -1;
+  _sequence = 0;
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::Destructor
+//       Access: Public
+//  Description:
+////////////////////////////////////////////////////////////////////
+ShellCoprocess::
+~ShellCoprocess() {
+  stop();
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::start
+//       Access: Private
+//  Description: Starts the shell process.  Returns true on success.
+////////////////////////////////////////////////////////////////////
+bool ShellCoprocess::
+start() {
+#ifdef WIN32_VC
+  return false;
+
+#else  // WIN32_VC
+  int to_pd[2];
+  int from_pd[2];
+  if (pipe(to_pd) < 0) {
+    perror("pipe");
+    return false;
+  }
+  if (pipe(from_pd) < 0) {
+    perror("pipe");
+    close(to_pd[0]);
+    close(to_pd[1]);
+    return false;
+  }
+
+  // Our ends of the pipes shouldn't leak into other subprocesses.
+  fcntl(to_pd[1], F_SETFD, FD_CLOEXEC);
+  fcntl(from_pd[0], F_SETFD, FD_CLOEXEC);
+
+  // If the shell dies, we'd rather get an error from write() than be
+  // killed outright.
+  signal(SIGPIPE, SIG_IGN);
+
+  char *argv[2];
+  argv[0] = (char *)"sh";
+  argv[1] = (char *)NULL;
+
+  int pid = ShellCommand::spawn_shell(argv, string(), to_pd[0], from_pd[1]);
+  close(to_pd[0]);
+  close(from_pd[1]);
+  if (pid < 0) {
+    close(to_pd[1]);
+    close(from_pd[0]);
+    return false;
+  }
+
+  if (verbose) {
+    cerr << "Started shell coprocess " << pid << "\n";
+  }
+
+  _pid = pid;
+  _to_shell = to_pd[1];
+  _from_shell = from_pd[0];
+  return true;
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::stop
+//       Access: Private
+//  Description: Closes the shell's input, and waits for it to exit.
+////////////////////////////////////////////////////////////////////
+void ShellCoprocess::
+stop() {
+#ifndef WIN32_VC
+  if (_to_shell >= 0) {
+    close(_to_shell);
+    _to_shell = -1;
+  }
+  if (_from_shell >= 0) {
+    close(_from_shell);
+    _from_shell = -1;
+  }
+  if (_pid > 0) {
+    int status;
+    while (waitpid(_pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    _pid = -1;
+  }
+#endif  // WIN32_VC
+}
+
+////////////////////////////////////////////////////////////////////
+//     Function: ShellCoprocess::write_all
+//       Access: Private
+//  Description: Writes the complete string to the shell's standard
+//               input.  Returns true on success.
+////////////////////////////////////////////////////////////////////
+bool ShellCoprocess::
+write_all(const string &data) {
+#ifdef WIN32_VC
+  return false;
+
+#else  // WIN32_VC
+  size_t p = 0;
+  while (p < data.size()) {
+    int written = (int)write(_to_shell, data.data() + p, data.size() - p);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += written;
+  }
+  return true;
+#endif  // WIN32_VC
+}
+
@@ -0,0 +1,44 @@
+// Filename: shellCoprocess.h
+// Created by:  agent (18Oct26)
+//
+////////////////////////////////////////////////////////////////////
+
+#ifndef SHELLCOPROCESS_H
+#define SHELLCOPROCESS_H
+
+#include "ppremake.h"
+
+///////////////////////////////////////////////////////////////////
+//       Class : ShellCoprocess
+// Description : A single long-running /bin/sh process, to which
+//               successive $[shell] commands are fed on its standard
+//               input, rather than starting a new process for each
+//               one.  Each command is run in a subshell of the
+//               coprocess, so it can't disturb the commands that come
+//               after it; and its output is followed by a unique
+//               sentinel line, so we can tell where it ends.
+//
+//               This is enabled by defining $[SHELL_COPROCESS].  It
+//               is not available on Windows.
+////////////////////////////////////////////////////////////////////
+class ShellCoprocess {
+public:
+  ShellCoprocess();
+  ~ShellCoprocess();
+
+  bool run(const string &command, const string &dirname, string &output,
+           int &exit_status);
+
+private:
+  bool start();
+  void stop();
+  bool write_all(const string &data);
+
+  int _pid;
+  int _to_shell;
+  int _from_shell;
+  int _sequence;
+  string _buffer;
+};
+
+#endif